@@ -7,16 +7,16 @@
     APIs: gl=4.3
     Profile: core
     Extensions:
-        
+        GL_ARB_buffer_storage
     Loader: True
     Local files: False
     Omit khrplatform: False
     Reproducible: False
 
     Commandline:
-        --profile="core" --api="gl=4.3" --generator="c-debug" --spec="gl" --extensions=""
+        --profile="core" --api="gl=4.3" --generator="c-debug" --spec="gl" --extensions="GL_ARB_buffer_storage"
     Online:
-        https://glad.dav1d.de/#profile=core&language=c-debug&specification=gl&loader=on&api=gl%3D4.3
+        https://glad.dav1d.de/#profile=core&language=c-debug&specification=gl&loader=on&api=gl%3D4.3&extensions=GL_ARB_buffer_storage
 */
 
 
@@ -1444,6 +1444,13 @@ typedef void (APIENTRY *GLVULKANPROCNV)(void);
 #define GL_DISPLAY_LIST 0x82E7
 #define GL_STACK_UNDERFLOW 0x0504
 #define GL_STACK_OVERFLOW 0x0503
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#define GL_MAP_COHERENT_BIT 0x0080
+#define GL_DYNAMIC_STORAGE_BIT 0x0100
+#define GL_CLIENT_STORAGE_BIT 0x0200
+#define GL_CLIENT_MAPPED_BUFFER_BARRIER_BIT 0x00004000
+#define GL_BUFFER_IMMUTABLE_STORAGE 0x821F
+#define GL_BUFFER_STORAGE_FLAGS 0x8220
 #ifndef GL_VERSION_1_0
 #define GL_VERSION_1_0 1
 GLAPI int GLAD_GL_VERSION_1_0;
@@ -3764,6 +3771,14 @@ GLAPI PFNGLGETPOINTERVPROC glad_glGetPointerv;
 GLAPI PFNGLGETPOINTERVPROC glad_debug_glGetPointerv;
 #define glGetPointerv glad_debug_glGetPointerv
 #endif
+#ifndef GL_ARB_buffer_storage
+#define GL_ARB_buffer_storage 1
+GLAPI int GLAD_GL_ARB_buffer_storage;
+typedef void (APIENTRYP PFNGLBUFFERSTORAGEPROC)(GLenum target, GLsizeiptr size, const void *data, GLbitfield flags);
+GLAPI PFNGLBUFFERSTORAGEPROC glad_glBufferStorage;
+GLAPI PFNGLBUFFERSTORAGEPROC glad_debug_glBufferStorage;
+#define glBufferStorage glad_debug_glBufferStorage
+#endif
 
 #ifdef __cplusplus
 }
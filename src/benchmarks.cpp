@@ -0,0 +1,298 @@
+#include "benchmarks.h"
+#include "collision.h"
+#include "sph.h"
+#include "scenefile.h"
+#include "bvh.h"
+#include "jobs.h"
+#include "timer.h"
+
+#include <format>
+#include <iostream>
+#include <vector>
+#include <array>
+#include <random>
+#include <numeric>
+#include <filesystem>
+#include <thread>
+#include <imgui.h>
+
+namespace bench {
+
+// Random spheres in a unit cube with the same radius range as the scene.
+// velocities.w is mass, as in the simulation.
+static void randomSpheres(std::size_t count, std::vector<glm::vec4>& spheres, std::vector<glm::vec4>& velocities, unsigned int seed = 1) {
+    std::mt19937 rng{seed};
+    std::uniform_real_distribution<float> unit{-0.5f, 0.5f}, radius{0.01f, 0.1f};
+
+    // Keep the density (and so the contacts per sphere) constant as the count grows
+    const float scale = std::cbrt(static_cast<float>(count) / 1000.f) * 4.f;
+    spheres.resize(count);
+    velocities.resize(count);
+    for (std::size_t i{0}; i < count; ++i) {
+        const float r = radius(rng);
+        spheres[i] = glm::vec4{unit(rng) * scale, unit(rng) * scale, unit(rng) * scale, r};
+        velocities[i] = glm::vec4{unit(rng), unit(rng), unit(rng), 10.f * r * r};
+    }
+}
+
+void collisions() {
+    constexpr std::size_t BRUTE_FORCE_LIMIT = 16'000;
+    const sim::CollisionParams params{};
+    std::vector<glm::vec4> spheres, velocities;
+    sim::SpatialGrid grid;
+
+    std::cout << "Collisions (grid vs. brute force):" << std::endl;
+    for (std::size_t count{1'000}; count <= 1'024'000; count *= 4) {
+        randomSpheres(count, spheres, velocities);
+        auto referenceSpheres = spheres;
+        auto referenceVelocities = velocities;
+
+        Timer<std::chrono::high_resolution_clock> timer{};
+        grid.build(spheres);
+        const auto buildTime = timer.elapsedReset<std::chrono::microseconds>();
+        const auto contacts = sim::resolveCollisions(grid, spheres, velocities, params);
+        const auto resolveTime = timer.elapsedReset<std::chrono::microseconds>();
+
+        auto line = std::format("  n = {:>8}: {:>6} contacts, grid {:>9.3f}ms (build {:.3f}ms)",
+            count, contacts, (buildTime + resolveTime) * 0.001, buildTime * 0.001);
+
+        if (count <= BRUTE_FORCE_LIMIT) {
+            timer.reset();
+            const auto referenceContacts = sim::resolveCollisionsBruteForce(referenceSpheres, referenceVelocities, params);
+            const auto bruteTime = timer.elapsedReset<std::chrono::microseconds>();
+
+            float maxError{0.f};
+            for (std::size_t i{0}; i < count; ++i)
+                maxError = std::max(maxError, glm::length(glm::vec3{spheres[i]} - glm::vec3{referenceSpheres[i]}));
+            line += std::format(", brute force {:>9.3f}ms ({} contacts, max deviation {})",
+                bruteTime * 0.001, referenceContacts, maxError);
+        }
+        std::cout << line << std::endl;
+    }
+}
+
+void fluid() {
+    constexpr unsigned int WARMUP_STEPS = 20, STEPS = 20;
+    constexpr float TIMESTEP = 1.f / 120.f;
+
+    std::cout << "SPH fluid:" << std::endl;
+    for (std::size_t count : {10'000u, 50'000u, 200'000u}) {
+        // Jittered lattice at rest spacing, in a box sized so the block fills its lower half
+        sim::FluidParams params{};
+        const float spacing = std::cbrt(params.particleMass / params.restDensity);
+        const auto side = static_cast<std::size_t>(std::ceil(std::cbrt(static_cast<double>(count) * 0.25)));
+        params.boundary = 0.5f * spacing * static_cast<float>(2 * side);
+
+        std::mt19937 rng{1};
+        std::uniform_real_distribution<float> jitter{-0.1f * spacing, 0.1f * spacing};
+        std::vector<glm::vec4> spheres, velocities(count, glm::vec4{0.f, 0.f, 0.f, 1.f});
+        spheres.reserve(count);
+        for (std::size_t i{0}; i < count; ++i) {
+            const glm::vec3 cell{i % (2 * side), i / (4 * side * side), (i / (2 * side)) % (2 * side)};
+            const auto pos = (cell + 0.5f) * spacing - params.boundary;
+            spheres.emplace_back(pos.x + jitter(rng), pos.y + jitter(rng), pos.z + jitter(rng), 0.5f * spacing);
+        }
+
+        sim::Fluid fluid;
+        for (unsigned int i{0}; i < WARMUP_STEPS; ++i)
+            fluid.step(spheres, velocities, TIMESTEP, params);
+
+        const auto rebuilds = fluid.getRebuildCount();
+        const auto substeps = fluid.getStepCount();
+        Timer<std::chrono::high_resolution_clock> timer{};
+        for (unsigned int i{0}; i < STEPS; ++i)
+            fluid.step(spheres, velocities, TIMESTEP, params);
+        const double stepTime = timer.elapsed<std::chrono::microseconds>() * 0.001 / STEPS;
+
+        std::cout << std::format("  n = {:>7}: {:.3f}ms per {:.4f}s step ({} substeps, {} list rebuilds, {:.1f} neighbours per particle)",
+            count, stepTime, TIMESTEP, fluid.getStepCount() - substeps, fluid.getRebuildCount() - rebuilds,
+            static_cast<double>(fluid.getNeighbourCount()) / static_cast<double>(count)) << std::endl;
+    }
+}
+
+void sceneFile() {
+    constexpr std::size_t COUNT = 10'000'000;
+    const auto path = std::filesystem::temp_directory_path() / "benchmark.bsph";
+
+    std::vector<glm::vec4> spheres, velocities;
+    randomSpheres(COUNT, spheres, velocities);
+    const io::SceneGroup group{0, static_cast<std::uint32_t>(COUNT), 0};
+    if (!io::saveScene(path, {&group, 1}, spheres, velocities))
+        return;
+    spheres = {};
+    velocities = {};
+
+    // Reading the mapping back is what bounds scene loading. Note that the file is likely still in the page cache.
+    Timer<std::chrono::high_resolution_clock> timer{};
+    if (const auto file = io::SceneFile::open(path)) {
+        const auto openTime = timer.elapsedReset<std::chrono::microseconds>();
+        const auto read = [](std::span<const glm::vec4> data){
+            return jobs::transformReduce(data.size(), 0.f, std::plus<>{}, [&](std::size_t i){ return data[i].w; });
+        };
+        const float checksum = read(file->spheres()) + read(file->velocities());
+        const auto readTime = timer.elapsedReset<std::chrono::microseconds>();
+        const double gigabytes = static_cast<double>(std::filesystem::file_size(path)) * 1e-9;
+
+        std::cout << std::format("Scene file: {} spheres ({:.2f}GB), open {:.3f}ms, read {:.3f}ms ({:.2f}GB/s, checksum {})",
+            COUNT, gigabytes, openTime * 0.001, readTime * 0.001, gigabytes / (readTime * 1e-6), checksum) << std::endl;
+    }
+    std::filesystem::remove(path);
+}
+
+void bvh() {
+    constexpr std::size_t RAYS = 100'000;
+    std::vector<glm::vec4> spheres, velocities;
+    accel::Bvh tree;
+    accel::WideBvh wideTree;
+
+    std::cout << "BVH:" << std::endl;
+    for (std::size_t count{10'000}; count <= 2'560'000; count *= 4) {
+        randomSpheres(count, spheres, velocities);
+
+        Timer<std::chrono::high_resolution_clock> timer{};
+        tree.build(spheres);
+        const auto buildTime = timer.elapsedReset<std::chrono::microseconds>();
+        const float builtCost = tree.cost();
+
+        // Moves every sphere by up to a tenth of the largest radius, as an animation step would
+        for (std::size_t i{0}; i < count; ++i)
+            spheres[i] += glm::vec4{glm::vec3{velocities[i]} * 0.01f, 0.f};
+        timer.reset();
+        tree.refit(spheres);
+        const auto refitTime = timer.elapsedReset<std::chrono::microseconds>();
+
+        // Rays from outside the scene towards random points in it
+        std::mt19937 rng{2};
+        std::uniform_real_distribution<float> unit{-0.5f, 0.5f};
+        const float scale = std::cbrt(static_cast<float>(count) / 1000.f) * 4.f;
+        std::vector<std::pair<glm::vec3, glm::vec3>> rays(RAYS);
+        for (auto& [origin, direction] : rays) {
+            origin = glm::vec3{scale, unit(rng) * scale, unit(rng) * scale};
+            direction = glm::vec3{unit(rng) * scale, unit(rng) * scale, unit(rng) * scale} - origin;
+        }
+        std::vector<glm::uint> hitSpheres(RAYS);
+        std::size_t hits{0};
+        timer.reset();
+        for (std::size_t i{0}; i < RAYS; ++i) {
+            const auto hit = tree.intersect(rays[i].first, rays[i].second, spheres);
+            hits += hit.has_value();
+            hitSpheres[i] = hit ? hit->sphere : ~0u;
+        }
+        const auto rayTime = timer.elapsedReset<std::chrono::microseconds>();
+
+        wideTree.collapse(tree, spheres);
+        const auto collapseTime = timer.elapsedReset<std::chrono::microseconds>();
+        wideTree.refit(spheres);
+        const auto wideRefitTime = timer.elapsedReset<std::chrono::microseconds>();
+        std::size_t nodeVisits{0}, mismatches{0};
+        for (std::size_t i{0}; i < RAYS; ++i) {
+            const auto hit = wideTree.intersect(rays[i].first, rays[i].second, std::numeric_limits<float>::max(), &nodeVisits);
+            mismatches += (hit ? hit->sphere : ~0u) != hitSpheres[i];
+        }
+        const auto wideRayTime = timer.elapsedReset<std::chrono::microseconds>();
+
+        std::cout << std::format("  n = {:>8}: build {:>9.3f}ms ({:.2f}M spheres/s, {} nodes, cost {:.1f}), refit {:.3f}ms (cost {:.1f}), "
+            "{:.2f}M rays/s ({} hits)", count, buildTime * 0.001, static_cast<double>(count) / std::max<double>(buildTime, 1.0), tree.getNodes().size(),
+            builtCost, refitTime * 0.001, tree.cost(), static_cast<double>(RAYS) / std::max<double>(rayTime, 1.0), hits) << std::endl;
+        std::cout << std::format("  {:>12}  {}-wide: collapse {:.3f}ms ({} nodes), refit {:.3f}ms, {:.2f}M rays/s, {:.1f}M node visits/s "
+            "({:.1f} per ray, {} mismatches)", "", accel::WideBvhNode::WIDTH, collapseTime * 0.001, wideTree.getNodes().size(),
+            wideRefitTime * 0.001, static_cast<double>(RAYS) / std::max<double>(wideRayTime, 1.0),
+            static_cast<double>(nodeVisits) / std::max<double>(wideRayTime, 1.0), static_cast<double>(nodeVisits) / RAYS, mismatches) << std::endl;
+    }
+}
+
+void jobSystem() {
+    constexpr std::size_t BODIES = 8192;
+    constexpr std::size_t SMALL_TASKS = 100'000;
+    constexpr std::size_t TILES = 64;
+    constexpr float SOFTENING = 1e-4f;
+    std::vector<glm::vec4> spheres, velocities;
+    randomSpheres(BODIES, spheres, velocities);
+    std::vector<glm::vec3> accelerations(BODIES);
+    std::vector<float> smallResults(SMALL_TASKS), tiles(TILES * TILES);
+
+    // Work of a few microseconds, a task of its own in the small task and wavefront runs
+    const auto work = [](float seed){
+        for (int i{0}; i < 256; ++i)
+            seed = std::sqrt(seed * seed + 1.f) * 0.5f;
+        return seed;
+    };
+
+    const std::size_t hardwareThreads = std::max(1u, std::thread::hardware_concurrency());
+    std::array<double, 3> baseTimes{};
+    std::cout << "Job system:" << std::endl;
+    for (std::size_t threads{1}; ; threads = std::min(threads * 2, hardwareThreads)) {
+        jobs::Scheduler scheduler{threads - 1};
+        std::array<double, 3> times{};
+        Timer<std::chrono::high_resolution_clock> timer{};
+
+        // Direct sum gravity, split by the automatic grain size
+        scheduler.parallelFor(BODIES, [&](std::size_t begin, std::size_t end){
+            for (auto i{begin}; i < end; ++i) {
+                glm::vec3 a{0.f};
+                for (std::size_t j{0}; j < BODIES; ++j) {
+                    const auto d = glm::vec3{spheres[j]} - glm::vec3{spheres[i]};
+                    const float distSq = glm::dot(d, d) + SOFTENING;
+                    a += d * (velocities[j].w / (distSq * std::sqrt(distSq)));
+                }
+                accelerations[i] = a;
+            }
+        }, 1);
+        times[0] = static_cast<double>(timer.elapsedReset<std::chrono::microseconds>());
+
+        {
+            jobs::TaskGroup group{scheduler};
+            for (std::size_t i{0}; i < SMALL_TASKS; ++i)
+                group.run([&, i]{ smallResults[i] = work(static_cast<float>(i)); });
+        }
+        times[1] = static_cast<double>(timer.elapsedReset<std::chrono::microseconds>());
+
+        // Every tile depends on the one to its left and the one above, so parallelism grows and shrinks along the diagonals
+        std::vector<jobs::TaskHandle> handles(TILES * TILES);
+        for (std::size_t y{0}; y < TILES; ++y)
+            for (std::size_t x{0}; x < TILES; ++x) {
+                std::array<jobs::TaskHandle, 2> dependencies{};
+                if (0 < x)
+                    dependencies[0] = handles[y * TILES + x - 1];
+                if (0 < y)
+                    dependencies[1] = handles[(y - 1) * TILES + x];
+                handles[y * TILES + x] = scheduler.submit([&, x, y]{
+                    const float left = 0 < x ? tiles[y * TILES + x - 1] : 0.f, top = 0 < y ? tiles[(y - 1) * TILES + x] : 0.f;
+                    tiles[y * TILES + x] = work(left + top + 1.f);
+                }, dependencies);
+            }
+        scheduler.wait(handles.back());
+        times[2] = static_cast<double>(timer.elapsedReset<std::chrono::microseconds>());
+
+        if (threads == 1)
+            baseTimes = times;
+        const auto report = [&](std::size_t i){
+            const double speedup = baseTimes[i] / std::max(times[i], 1.0);
+            return std::format("{:>9.3f}ms ({:.2f}x, {:>3.0f}%)", times[i] * 0.001, speedup, 100.0 * speedup / static_cast<double>(threads));
+        };
+        std::cout << std::format("  {:>3} threads: gravity {}, {} small tasks {}, {}x{} wavefront {} (checksum {})", threads, report(0),
+            SMALL_TASKS, report(1), TILES, TILES, report(2), accelerations[0].x + smallResults.back() + tiles.back()) << std::endl;
+
+        if (threads == hardwareThreads)
+            break;
+    }
+}
+
+void menu() {
+    if (ImGui::BeginMenu("Benchmarks")) {
+        if (ImGui::MenuItem("Collisions"))
+            collisions();
+        if (ImGui::MenuItem("SPH fluid"))
+            fluid();
+        if (ImGui::MenuItem("Scene file"))
+            sceneFile();
+        if (ImGui::MenuItem("BVH"))
+            bvh();
+        if (ImGui::MenuItem("Job system"))
+            jobSystem();
+
+        ImGui::EndMenu();
+    }
+}
+
+}
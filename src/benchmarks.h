@@ -0,0 +1,27 @@
+#ifndef BENCHMARKS_H
+#define BENCHMARKS_H
+
+// Offline benchmarks on synthetic data. Results are printed to stdout.
+namespace bench {
+
+// Uniform grid collision pass vs. the brute-force reference at increasing sphere counts
+void collisions();
+
+// SPH step time at increasing particle counts, starting from a settled block of fluid
+void fluid();
+
+// Writes a 10M sphere scene file and times mapping and reading it back
+void sceneFile();
+
+// BVH build throughput, refit after a small displacement and closest hit ray queries at increasing sphere counts
+void bvh();
+
+// Speedup of the job system at 1, 2, 4, ... threads on bulk parallel loops, many small tasks and a wavefront of dependent tasks
+void jobSystem();
+
+// Menu listing all benchmarks
+void menu();
+
+}
+
+#endif // BENCHMARKS_H
@@ -0,0 +1,548 @@
+#include "bvh.h"
+#include "utils.h"
+#include "jobs.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cmath>
+#include <mutex>
+#include <numeric>
+
+// SSE2 is part of every x86-64 target, elsewhere the wide nodes are tested one child at a time
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define BVH_SSE
+#include <immintrin.h>
+// Where the target has it (e.g. with NATIVE_ARCH), box entry distances take one FMA per plane
+#if defined(__FMA__) || defined(__AVX2__)
+#define BVH_FMA
+#endif
+#endif
+
+namespace accel {
+
+namespace {
+
+constexpr std::size_t BIN_COUNT = 32;
+// Ranges at least this large are bounded and binned in parallel
+constexpr std::size_t PARALLEL_RANGE = 1 << 16;
+// Subtrees at least this large are built as tasks of their own
+constexpr std::size_t TASK_RANGE = 1 << 12;
+// Cost of visiting a node relative to testing a sphere
+constexpr float TRAVERSAL_COST = 1.f;
+
+// Bounds of the spheres and of their centers
+struct Bounds {
+    Aabb spheres, centers;
+
+    void grow(const Bounds& b) { spheres.grow(b.spheres); centers.grow(b.centers); }
+};
+
+struct Bin {
+    Bounds bounds;
+    glm::uint count{0};
+};
+using Bins = std::array<std::array<Bin, BIN_COUNT>, 3>;
+
+class Builder {
+private:
+    std::span<const glm::vec4> spheres;
+    std::vector<glm::uint>& indices;
+    std::vector<BvhNode>& nodes;
+    std::atomic<glm::uint> nodeCount{1};
+
+    // Runs f(begin, end) over chunks of the range, in parallel for large ranges, and merges the chunk results
+    template <typename T, typename F, typename M>
+    T reduce(glm::uint begin, glm::uint end, F&& f, M&& merge) const {
+        if (end - begin < PARALLEL_RANGE)
+            return f(begin, end);
+        T result{};
+        std::mutex mutex;
+        util::parallelFor(end - begin, [&](std::size_t b, std::size_t e){
+            const auto chunk = f(begin + static_cast<glm::uint>(b), begin + static_cast<glm::uint>(e));
+            std::lock_guard lock{mutex};
+            merge(result, chunk);
+        }, PARALLEL_RANGE / 4);
+        return result;
+    }
+
+    Bounds rangeBounds(glm::uint begin, glm::uint end) const {
+        return reduce<Bounds>(begin, end, [&](glm::uint b, glm::uint e){
+            Bounds bounds;
+            for (auto i{b}; i < e; ++i) {
+                const auto& s = spheres[indices[i]];
+                bounds.spheres.grow(Aabb::sphere(s));
+                bounds.centers.grow(glm::vec3{s});
+            }
+            return bounds;
+        }, [](Bounds& result, const Bounds& chunk){ result.grow(chunk); });
+    }
+
+    Bins bin(glm::uint begin, glm::uint end, std::size_t binCount, const glm::vec3& origin, const glm::vec3& scale) const {
+        return reduce<Bins>(begin, end, [&](glm::uint b, glm::uint e){
+            Bins bins{};
+            for (auto i{b}; i < e; ++i) {
+                const auto& s = spheres[indices[i]];
+                const auto box = Aabb::sphere(s);
+                const auto cell = glm::min(glm::uvec3{glm::max((glm::vec3{s} - origin) * scale, glm::vec3{0.f})}, glm::uvec3{static_cast<glm::uint>(binCount - 1)});
+                for (int axis{0}; axis < 3; ++axis) {
+                    auto& bin = bins[axis][cell[axis]];
+                    bin.bounds.spheres.grow(box);
+                    bin.bounds.centers.grow(glm::vec3{s});
+                    ++bin.count;
+                }
+            }
+            return bins;
+        }, [binCount](Bins& result, const Bins& chunk){
+            for (int axis{0}; axis < 3; ++axis)
+                for (std::size_t i{0}; i < binCount; ++i) {
+                    result[axis][i].bounds.grow(chunk[axis][i].bounds);
+                    result[axis][i].count += chunk[axis][i].count;
+                }
+        });
+    }
+
+    void makeLeaf(glm::uint node, glm::uint begin, glm::uint end) {
+        nodes[node].first = begin;
+        nodes[node].count = end - begin;
+    }
+
+    // Splits at the median along the longest axis of the centers
+    glm::uint medianSplit(glm::uint begin, glm::uint end, const Aabb& centers) {
+        const auto extent = centers.hi - centers.lo;
+        const int axis = extent.x < extent.y ? (extent.y < extent.z ? 2 : 1) : (extent.x < extent.z ? 2 : 0);
+        const auto mid = begin + (end - begin) / 2;
+        const auto less = [&](glm::uint a, glm::uint b){ return spheres[a][axis] < spheres[b][axis]; };
+        std::nth_element(indices.begin() + begin, indices.begin() + mid, indices.begin() + end, less);
+        return mid;
+    }
+
+    // Bounds are those of the range, passed down from the parent's bins
+    void buildNode(glm::uint node, glm::uint begin, glm::uint end, const Bounds& bounds, std::size_t depth) {
+        const auto count = end - begin;
+        nodes[node].lo = bounds.spheres.lo;
+        nodes[node].hi = bounds.spheres.hi;
+        if (count <= 1) {
+            makeLeaf(node, begin, end);
+            return;
+        }
+
+        glm::uint mid = begin;
+        Bounds leftBounds, rightBounds;
+        const auto extent = bounds.centers.hi - bounds.centers.lo;
+        if (depth < Bvh::MAX_DEPTH && 0.f < glm::max(extent.x, glm::max(extent.y, extent.z))) {
+            // Small nodes don't have enough spheres to tell many planes apart
+            const auto binCount = std::min<std::size_t>(BIN_COUNT, 8 + count / 8);
+            const auto scale = glm::vec3{static_cast<float>(binCount)} / glm::max(extent, glm::vec3{1e-30f});
+            const auto bins = bin(begin, end, binCount, bounds.centers.lo, scale);
+
+            // Sweep every axis from the right, then from the left, evaluating the cost of every split plane
+            float bestCost = std::numeric_limits<float>::max();
+            int bestAxis{-1};
+            std::size_t bestSplit{0};
+            for (int axis{0}; axis < 3; ++axis) {
+                if (extent[axis] <= 0.f)
+                    continue;
+                std::array<float, BIN_COUNT> rightCosts{};
+                Aabb right;
+                glm::uint rightCount{0};
+                for (std::size_t i{binCount - 1}; 0 < i; --i) {
+                    right.grow(bins[axis][i].bounds.spheres);
+                    rightCount += bins[axis][i].count;
+                    rightCosts[i] = right.halfArea() * static_cast<float>(rightCount);
+                }
+                Aabb left;
+                glm::uint leftCount{0};
+                for (std::size_t i{1}; i < binCount; ++i) {
+                    left.grow(bins[axis][i - 1].bounds.spheres);
+                    leftCount += bins[axis][i - 1].count;
+                    const float cost = left.halfArea() * static_cast<float>(leftCount) + rightCosts[i];
+                    if (0 < leftCount && leftCount < count && cost < bestCost) {
+                        bestCost = cost;
+                        bestAxis = axis;
+                        bestSplit = i;
+                    }
+                }
+            }
+
+            const float leafCost = static_cast<float>(count);
+            const float splitCost = TRAVERSAL_COST + bestCost / std::max(bounds.spheres.halfArea(), 1e-30f);
+            if (count <= Bvh::MAX_LEAF_SIZE && (bestAxis < 0 || leafCost <= splitCost)) {
+                makeLeaf(node, begin, end);
+                return;
+            }
+
+            if (0 <= bestAxis) {
+                for (std::size_t i{0}; i < binCount; ++i)
+                    (i < bestSplit ? leftBounds : rightBounds).grow(bins[bestAxis][i].bounds);
+                const float origin = bounds.centers.lo[bestAxis], axisScale = scale[bestAxis];
+                const auto isLeft = [&](glm::uint i){
+                    return std::min(static_cast<std::size_t>(std::max((spheres[i][bestAxis] - origin) * axisScale, 0.f)), binCount - 1) < bestSplit;
+                };
+                const auto it = std::partition(indices.begin() + begin, indices.begin() + end, isLeft);
+                mid = static_cast<glm::uint>(it - indices.begin());
+            }
+        } else if (count <= Bvh::MAX_LEAF_SIZE) {
+            makeLeaf(node, begin, end);
+            return;
+        }
+        // Too deep, all centers in one place, or no useful plane
+        if (mid == begin || mid == end) {
+            mid = medianSplit(begin, end, bounds.centers);
+            leftBounds = rangeBounds(begin, mid);
+            rightBounds = rangeBounds(mid, end);
+        }
+
+        const auto left = nodeCount.fetch_add(2);
+        nodes[node].first = left;
+        nodes[node].count = 0;
+        if (TASK_RANGE <= std::min(mid - begin, end - mid)) {
+            // Idle workers steal the right subtree, the waiting thread helps with whatever is left
+            jobs::TaskGroup group;
+            group.run([&, left, mid]{ buildNode(left + 1, mid, end, rightBounds, depth + 1); });
+            buildNode(left, begin, mid, leftBounds, depth + 1);
+            group.wait();
+        } else {
+            buildNode(left, begin, mid, leftBounds, depth + 1);
+            buildNode(left + 1, mid, end, rightBounds, depth + 1);
+        }
+    }
+
+public:
+    Builder(std::span<const glm::vec4> spheres, std::vector<glm::uint>& indices, std::vector<BvhNode>& nodes)
+        : spheres{spheres}, indices{indices}, nodes{nodes} {}
+
+    glm::uint build() {
+        const auto count = static_cast<glm::uint>(indices.size());
+        buildNode(0, 0, count, rangeBounds(0, count), 0);
+        return nodeCount;
+    }
+};
+
+// Distance along the ray to the sphere, the far intersection when starting inside it, negative if it misses.
+// a is the squared length of the direction.
+float sphereHit(const glm::vec3& origin, const glm::vec3& direction, float a, const glm::vec4& s) {
+    const auto oc = origin - glm::vec3{s};
+    const float b = glm::dot(oc, direction);
+    const float discriminant = b * b - a * (glm::dot(oc, oc) - s.w * s.w);
+    if (discriminant < 0.f)
+        return -1.f;
+    const float root = std::sqrt(discriminant);
+    const float t = (-b - root) / a;
+    return t < 0.f ? (-b + root) / a : t;
+}
+
+}
+
+void Bvh::build(std::span<const glm::vec4> spheres) {
+    indices.resize(spheres.size());
+    std::iota(indices.begin(), indices.end(), 0u);
+    nodes.clear();
+    if (spheres.empty())
+        return;
+
+    // A binary tree with at most one sphere per leaf has no more nodes than this
+    nodes.resize(2 * spheres.size() - 1);
+    Builder builder{spheres, indices, nodes};
+    nodes.resize(builder.build());
+}
+
+void Bvh::refit(std::span<const glm::vec4> spheres) {
+    // Leaves in parallel, then the interior nodes backwards, so children are done before their parents
+    util::parallelFor(nodes.size(), [&](std::size_t begin, std::size_t end){
+        for (auto n{begin}; n < end; ++n) {
+            auto& node = nodes[n];
+            if (node.count == 0)
+                continue;
+            Aabb bounds;
+            for (auto i{node.first}; i < node.first + node.count; ++i)
+                bounds.grow(Aabb::sphere(spheres[indices[i]]));
+            node.lo = bounds.lo;
+            node.hi = bounds.hi;
+        }
+    }, 4096);
+
+    for (auto n{nodes.size()}; 0 < n--;) {
+        auto& node = nodes[n];
+        if (node.count != 0)
+            continue;
+        const auto& left = nodes[node.first];
+        const auto& right = nodes[node.first + 1];
+        node.lo = glm::min(left.lo, right.lo);
+        node.hi = glm::max(left.hi, right.hi);
+    }
+}
+
+float Bvh::cost() const {
+    if (nodes.empty())
+        return 0.f;
+    float cost{0.f};
+    for (const auto& node : nodes) {
+        const float area = Aabb{node.lo, node.hi}.halfArea();
+        cost += node.count == 0 ? TRAVERSAL_COST * area : static_cast<float>(node.count) * area;
+    }
+    return cost / std::max(Aabb{nodes[0].lo, nodes[0].hi}.halfArea(), 1e-30f);
+}
+
+std::optional<RayHit> Bvh::intersect(const glm::vec3& origin, const glm::vec3& direction, std::span<const glm::vec4> spheres, float tMax) const {
+    if (nodes.empty())
+        return std::nullopt;
+
+    const auto invDirection = 1.f / direction;
+    // Entry distance of the ray into a node, or tMax if it misses
+    const auto entry = [&](const BvhNode& node){
+        const auto t0 = (node.lo - origin) * invDirection;
+        const auto t1 = (node.hi - origin) * invDirection;
+        const auto tNear = glm::min(t0, t1), tFar = glm::max(t0, t1);
+        const float enter = glm::max(glm::max(tNear.x, tNear.y), glm::max(tNear.z, 0.f));
+        const float exit = glm::min(glm::min(tFar.x, tFar.y), glm::min(tFar.z, tMax));
+        return enter <= exit ? enter : tMax;
+    };
+
+    const float a = glm::dot(direction, direction);
+    std::optional<RayHit> hit;
+    // Nodes with their entry distance, so the ones behind a closer hit are skipped when popped
+    std::pair<glm::uint, float> stack[MAX_DEPTH + 32];
+    std::size_t size{0};
+    if (const float t = entry(nodes[0]); t < tMax)
+        stack[size++] = {0, t};
+    while (0 < size) {
+        const auto [index, t] = stack[--size];
+        if (tMax <= t)
+            continue;
+        const auto& node = nodes[index];
+        if (node.count == 0) {
+            // Nearer child on top
+            const float tLeft = entry(nodes[node.first]), tRight = entry(nodes[node.first + 1]);
+            const bool bLeftFirst = tLeft <= tRight;
+            const float tFirst = bLeftFirst ? tLeft : tRight, tSecond = bLeftFirst ? tRight : tLeft;
+            if (tSecond < tMax)
+                stack[size++] = {node.first + (bLeftFirst ? 1 : 0), tSecond};
+            if (tFirst < tMax)
+                stack[size++] = {node.first + (bLeftFirst ? 0 : 1), tFirst};
+            continue;
+        }
+
+        for (auto i{node.first}; i < node.first + node.count; ++i) {
+            const float t = sphereHit(origin, direction, a, spheres[indices[i]]);
+            if (0.f <= t && t < tMax) {
+                tMax = t;
+                hit = RayHit{indices[i], t};
+            }
+        }
+    }
+    return hit;
+}
+
+void WideBvh::collapse(const Bvh& bvh, std::span<const glm::vec4> spheres) {
+    const auto& binary = bvh.getNodes();
+    indices = bvh.getIndices();
+    leafSpheres.resize(indices.size());
+    for (std::size_t i{0}; i < indices.size(); ++i)
+        leafSpheres[i] = spheres[indices[i]];
+    nodes.clear();
+    if (binary.empty())
+        return;
+
+    // Every wide node but a leaf root replaces at least one interior binary node
+    nodes.reserve(binary.size() / 2 + 1);
+    collapseNode(binary, 0);
+}
+
+glm::uint WideBvh::collapseNode(const std::vector<BvhNode>& binary, glm::uint index) {
+    constexpr auto WIDTH = WideBvhNode::WIDTH;
+
+    // Replaces the interior child with the largest surface, the one most rays enter, by its children until the node is full
+    std::array<glm::uint, WIDTH> slots{index};
+    std::size_t slotCount{1};
+    while (slotCount < WIDTH) {
+        std::size_t largest{WIDTH};
+        float largestArea{-1.f};
+        for (std::size_t k{0}; k < slotCount; ++k) {
+            const auto& child = binary[slots[k]];
+            if (const float area = Aabb{child.lo, child.hi}.halfArea(); child.count == 0 && largestArea < area) {
+                largest = k;
+                largestArea = area;
+            }
+        }
+        if (largest == WIDTH)
+            break;
+        const auto first = binary[slots[largest]].first;
+        slots[largest] = first;
+        slots[slotCount++] = first + 1;
+    }
+
+    WideBvhNode node;
+    for (std::size_t k{0}; k < WIDTH; ++k) {
+        if (slotCount <= k) {
+            node.setBox(k, {glm::vec3{std::numeric_limits<float>::infinity()}, glm::vec3{std::numeric_limits<float>::infinity()}});
+            node.child[k] = 0;
+            node.count[k] = 0;
+            continue;
+        }
+        const auto& child = binary[slots[k]];
+        node.setBox(k, {child.lo, child.hi});
+        node.child[k] = child.first;
+        node.count[k] = child.count;
+    }
+
+    const auto n = static_cast<glm::uint>(nodes.size());
+    nodes.push_back(node);
+    // Interior children are collapsed after their parent, which then points at them
+    for (std::size_t k{0}; k < slotCount; ++k)
+        if (binary[slots[k]].count == 0) {
+            const auto child = collapseNode(binary, slots[k]);
+            nodes[n].child[k] = child;
+        }
+    return n;
+}
+
+void WideBvh::refit(std::span<const glm::vec4> spheres) {
+    constexpr auto WIDTH = WideBvhNode::WIDTH;
+    util::parallelFor(indices.size(), [&](std::size_t begin, std::size_t end){
+        for (auto i{begin}; i < end; ++i)
+            leafSpheres[i] = spheres[indices[i]];
+    });
+
+    // Leaf children in parallel, then the interior ones backwards, so children are done before their parents
+    util::parallelFor(nodes.size(), [&](std::size_t begin, std::size_t end){
+        for (auto n{begin}; n < end; ++n) {
+            auto& node = nodes[n];
+            for (std::size_t k{0}; k < WIDTH; ++k) {
+                if (node.count[k] == 0)
+                    continue;
+                Aabb bounds;
+                for (auto i{node.child[k]}; i < node.child[k] + node.count[k]; ++i)
+                    bounds.grow(Aabb::sphere(leafSpheres[i]));
+                node.setBox(k, bounds);
+            }
+        }
+    }, 1024);
+
+    for (auto n{nodes.size()}; 0 < n--;) {
+        auto& node = nodes[n];
+        for (std::size_t k{0}; k < WIDTH; ++k)
+            if (node.count[k] == 0 && node.used(k))
+                node.setBox(k, nodes[node.child[k]].bounds());
+    }
+}
+
+float WideBvh::cost() const {
+    constexpr auto WIDTH = WideBvhNode::WIDTH;
+    if (nodes.empty())
+        return 0.f;
+    // The root is always visited, every other node when its slot in the parent is entered
+    const float rootArea = nodes[0].bounds().halfArea();
+    float cost{TRAVERSAL_COST * rootArea};
+    for (const auto& node : nodes)
+        for (std::size_t k{0}; k < WIDTH; ++k) {
+            if (!node.used(k))
+                continue;
+            const float area = node.box(k).halfArea();
+            cost += node.count[k] == 0 ? TRAVERSAL_COST * area : static_cast<float>(node.count[k]) * area;
+        }
+    return cost / std::max(rootArea, 1e-30f);
+}
+
+std::optional<RayHit> WideBvh::intersect(const glm::vec3& origin, const glm::vec3& direction, float tMax, std::size_t* nodeVisits) const {
+    constexpr auto WIDTH = WideBvhNode::WIDTH;
+    if (nodes.empty())
+        return std::nullopt;
+
+    // Children are entered through their lo planes on the axes the ray goes up, and their hi planes on the others,
+    // which saves sorting each pair of planes. Distances are plane * inverse - origin * inverse, one FMA where there is
+    // one, so axis-aligned directions are nudged off the axis to keep them finite.
+    glm::vec3 invDirection, scaledOrigin;
+    bool bNegative[3];
+    for (int axis{0}; axis < 3; ++axis) {
+        const float d = direction[axis];
+        invDirection[axis] = 1.f / (std::abs(d) < 1e-20f ? std::copysign(1e-20f, d) : d);
+        scaledOrigin[axis] = origin[axis] * invDirection[axis];
+        bNegative[axis] = invDirection[axis] < 0.f;
+    }
+#ifdef BVH_SSE
+    static_assert(WIDTH == 4, "the SSE traversal tests four children at once");
+    const __m128 inv[3]{_mm_set1_ps(invDirection.x), _mm_set1_ps(invDirection.y), _mm_set1_ps(invDirection.z)};
+    const __m128 o[3]{_mm_set1_ps(scaledOrigin.x), _mm_set1_ps(scaledOrigin.y), _mm_set1_ps(scaledOrigin.z)};
+    const auto distance = [&](const float* planes, int axis){
+#ifdef BVH_FMA
+        return _mm_fmsub_ps(_mm_load_ps(planes), inv[axis], o[axis]);
+#else
+        return _mm_sub_ps(_mm_mul_ps(_mm_load_ps(planes), inv[axis]), o[axis]);
+#endif
+    };
+#endif
+
+    const float a = glm::dot(direction, direction);
+    std::optional<RayHit> hit;
+    std::size_t visits{0};
+    // Children with their entry distance, a node pushes at most WIDTH - 1 more than it pops per level
+    struct Entry {
+        glm::uint child;
+        glm::uint count;
+        float t;
+    };
+    Entry stack[(Bvh::MAX_DEPTH + 32) * (WIDTH - 1) + 1];
+    std::size_t size{0};
+    stack[size++] = {0, 0, 0.f};
+    while (0 < size) {
+        const auto entry = stack[--size];
+        if (tMax <= entry.t)
+            continue;
+
+        if (entry.count != 0) {
+            for (auto i{entry.child}; i < entry.child + entry.count; ++i) {
+                const float t = sphereHit(origin, direction, a, leafSpheres[i]);
+                if (0.f <= t && t < tMax) {
+                    tMax = t;
+                    hit = RayHit{indices[i], t};
+                }
+            }
+            continue;
+        }
+
+        const auto& node = nodes[entry.child];
+        ++visits;
+        alignas(16) float tEnter[WIDTH];
+        unsigned int mask{0};
+#ifdef BVH_SSE
+        __m128 tNear = _mm_setzero_ps(), tFar = _mm_set1_ps(tMax);
+        for (int axis{0}; axis < 3; ++axis) {
+            tNear = _mm_max_ps(tNear, distance(bNegative[axis] ? node.hi[axis] : node.lo[axis], axis));
+            tFar = _mm_min_ps(tFar, distance(bNegative[axis] ? node.lo[axis] : node.hi[axis], axis));
+        }
+        mask = static_cast<unsigned int>(_mm_movemask_ps(_mm_cmple_ps(tNear, tFar)));
+        _mm_store_ps(tEnter, tNear);
+#else
+        for (std::size_t k{0}; k < WIDTH; ++k) {
+            float tNear{0.f}, tFar{tMax};
+            for (int axis{0}; axis < 3; ++axis) {
+                const float near = bNegative[axis] ? node.hi[axis][k] : node.lo[axis][k];
+                const float far = bNegative[axis] ? node.lo[axis][k] : node.hi[axis][k];
+                tNear = std::max(tNear, near * invDirection[axis] - scaledOrigin[axis]);
+                tFar = std::min(tFar, far * invDirection[axis] - scaledOrigin[axis]);
+            }
+            tEnter[k] = tNear;
+            mask |= (tNear <= tFar ? 1u : 0u) << k;
+        }
+#endif
+
+        // Children entered, straight onto the stack in order of decreasing distance so the nearest is popped next.
+        // Only the entered ones are visited, mostly one or two.
+        const auto first = size;
+        for (; mask != 0; mask &= mask - 1) {
+            const auto k = static_cast<std::size_t>(std::countr_zero(mask));
+            auto i{size++};
+            for (; first < i && stack[i - 1].t < tEnter[k]; --i)
+                stack[i] = stack[i - 1];
+            stack[i] = {node.child[k], node.count[k], tEnter[k]};
+        }
+    }
+
+    if (nodeVisits)
+        *nodeVisits += visits;
+    return hit;
+}
+
+}
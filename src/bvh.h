@@ -0,0 +1,172 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <span>
+#include <optional>
+#include <limits>
+#include <cstddef>
+
+// Spatial acceleration structures over the scene spheres
+namespace accel {
+
+struct Aabb {
+    glm::vec3 lo{std::numeric_limits<float>::max()};
+    glm::vec3 hi{std::numeric_limits<float>::lowest()};
+
+    void grow(const glm::vec3& p) { lo = glm::min(lo, p); hi = glm::max(hi, p); }
+    void grow(const Aabb& box) { lo = glm::min(lo, box.lo); hi = glm::max(hi, box.hi); }
+    bool overlaps(const Aabb& box) const { return glm::all(glm::lessThanEqual(lo, box.hi)) && glm::all(glm::lessThanEqual(box.lo, hi)); }
+    // Half the surface area, which is all the SAH needs. Empty boxes have none.
+    float halfArea() const {
+        const auto d = glm::max(hi - lo, glm::vec3{0.f});
+        return d.x * d.y + d.y * d.z + d.z * d.x;
+    }
+
+    static Aabb sphere(const glm::vec4& s) { return {glm::vec3{s} - s.w, glm::vec3{s} + s.w}; }
+};
+
+struct BvhNode {
+    glm::vec3 lo;
+    // First entry of a leaf in the index list, or the left child of an interior node. The right child follows the left one.
+    glm::uint first;
+    glm::vec3 hi;
+    // Spheres in a leaf, 0 for interior nodes
+    glm::uint count;
+};
+static_assert(sizeof(BvhNode) == 32);
+
+struct RayHit {
+    glm::uint sphere;
+    float t;
+};
+
+/**
+ * @brief Bounding volume hierarchy over spheres, built top-down with a binned surface area heuristic.
+ * Large nodes are binned and partitioned in parallel, and their subtrees are built as separate tasks.
+ * Children are always stored after their parent, so a refit is a single backwards sweep. Refitting keeps
+ * the topology, which stays valid for animated spheres but degrades as they move apart (see cost()).
+ */
+class Bvh {
+private:
+    std::vector<BvhNode> nodes;
+    std::vector<glm::uint> indices;
+
+public:
+    // Deeper nodes are split at the median, which bounds the depth, and so the traversal stacks, to MAX_DEPTH + 32
+    static constexpr std::size_t MAX_DEPTH = 64;
+    static constexpr std::size_t MAX_LEAF_SIZE = 8;
+
+    void build(std::span<const glm::vec4> spheres);
+    // Recomputes the bounds for moved spheres. Expects the spheres the hierarchy was built for, in the same order.
+    void refit(std::span<const glm::vec4> spheres);
+
+    // Expected cost of a random ray relative to the root, in node visits plus sphere tests
+    float cost() const;
+    bool empty() const { return nodes.empty(); }
+    std::size_t sphereCount() const { return indices.size(); }
+
+    // Closest sphere hit by the ray within tMax. The direction doesn't have to be normalized, t is in units of it.
+    std::optional<RayHit> intersect(const glm::vec3& origin, const glm::vec3& direction, std::span<const glm::vec4> spheres,
+        float tMax = std::numeric_limits<float>::max()) const;
+
+    // Calls f(sphere index) for every sphere whose bounding box overlaps the box
+    template <typename F>
+    void forEachOverlap(const Aabb& box, std::span<const glm::vec4> spheres, F&& f) const {
+        if (nodes.empty())
+            return;
+        glm::uint stack[MAX_DEPTH + 32];
+        std::size_t size{0};
+        stack[size++] = 0;
+        while (0 < size) {
+            const auto& node = nodes[stack[--size]];
+            if (!box.overlaps({node.lo, node.hi}))
+                continue;
+            if (node.count == 0) {
+                stack[size++] = node.first;
+                stack[size++] = node.first + 1;
+                continue;
+            }
+            for (auto i{node.first}; i < node.first + node.count; ++i)
+                if (box.overlaps(Aabb::sphere(spheres[indices[i]])))
+                    f(indices[i]);
+        }
+    }
+
+    const std::vector<BvhNode>& getNodes() const { return nodes; }
+    // Sphere indices in leaf order
+    const std::vector<glm::uint>& getIndices() const { return indices; }
+};
+
+// Children of a wide node, stored per coordinate so the boxes of all of them are tested at once with SIMD
+struct alignas(64) WideBvhNode {
+    static constexpr std::size_t WIDTH = 4;
+
+    // lo[axis][child]. Unused slots are a point at infinity, which no ray enters.
+    float lo[3][WIDTH];
+    float hi[3][WIDTH];
+    // Child node, or the first entry of a leaf in the index list
+    glm::uint child[WIDTH];
+    // Spheres in a leaf child, 0 for interior nodes and unused slots
+    glm::uint count[WIDTH];
+
+    // Unused slots have neither spheres nor a child node, the root never is one
+    bool used(std::size_t k) const { return count[k] != 0 || child[k] != 0; }
+    Aabb box(std::size_t k) const { return {{lo[0][k], lo[1][k], lo[2][k]}, {hi[0][k], hi[1][k], hi[2][k]}}; }
+    void setBox(std::size_t k, const Aabb& b) {
+        for (int axis{0}; axis < 3; ++axis) {
+            lo[axis][k] = b.lo[axis];
+            hi[axis][k] = b.hi[axis];
+        }
+    }
+    // Union of the used slots
+    Aabb bounds() const {
+        Aabb b;
+        for (std::size_t k{0}; k < WIDTH; ++k)
+            if (used(k))
+                b.grow(box(k));
+        return b;
+    }
+};
+static_assert(sizeof(WideBvhNode) == 128);
+
+/**
+ * @brief Bounding volume hierarchy with WideBvhNode::WIDTH children per node, collapsed from a binary Bvh.
+ * A ray tests all children of a node in one SIMD instruction stream (SSE, or scalar code elsewhere), visiting
+ * about half as many nodes as in the binary tree. The tree keeps its own copy of the spheres in leaf order,
+ * so leaves are tested without gathering through the index list. Children are stored after their parents here too,
+ * so a refit is again a single backwards sweep, and a moving scene only needs to collapse after a rebuild.
+ */
+class WideBvh {
+private:
+    std::vector<WideBvhNode> nodes;
+    std::vector<glm::uint> indices;
+    std::vector<glm::vec4> leafSpheres;
+
+    glm::uint collapseNode(const std::vector<BvhNode>& binary, glm::uint index);
+
+public:
+    // Expects the spheres the binary tree was built for
+    void collapse(const Bvh& bvh, std::span<const glm::vec4> spheres);
+    // Recomputes the child bounds for moved spheres. Expects the spheres the tree was collapsed for, in the same order.
+    void refit(std::span<const glm::vec4> spheres);
+
+    // Same as Bvh::cost
+    float cost() const;
+    bool empty() const { return nodes.empty(); }
+    std::size_t sphereCount() const { return indices.size(); }
+
+    // Same as Bvh::intersect, against the spheres of the last collapse or refit. Adds the nodes it visited to nodeVisits
+    // if given, each of which tests WideBvhNode::WIDTH boxes.
+    std::optional<RayHit> intersect(const glm::vec3& origin, const glm::vec3& direction,
+        float tMax = std::numeric_limits<float>::max(), std::size_t* nodeVisits = nullptr) const;
+
+    const std::vector<WideBvhNode>& getNodes() const { return nodes; }
+    const std::vector<glm::uint>& getIndices() const { return indices; }
+};
+
+}
+
+#endif // BVH_H
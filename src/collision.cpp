@@ -0,0 +1,136 @@
+#include "collision.h"
+#include "utils.h"
+#include "jobs.h"
+
+#include <algorithm>
+#include <numeric>
+#include <atomic>
+#include <bit>
+
+namespace sim {
+
+void SpatialGrid::build(std::span<const glm::vec4> spheres) {
+    const auto n = static_cast<std::uint32_t>(spheres.size());
+
+    const float maxRadius = jobs::transformReduce(spheres.size(), 0.f,
+        [](float a, float b){ return std::max(a, b); },
+        [&](std::size_t i){ return spheres[i].w; }
+    );
+    cellSize = std::max(2.f * maxRadius, 1e-6f);
+    invCellSize = 1.f / cellSize;
+
+    const std::uint32_t tableSize = std::bit_ceil(std::max(2u * n, 1u));
+    tableMask = tableSize - 1;
+
+    cellIds.resize(n);
+    util::parallelFor(n, [&](std::size_t begin, std::size_t end){
+        for (auto i{begin}; i < end; ++i)
+            cellIds[i] = bucket(cellOf(glm::vec3{spheres[i]}));
+    });
+
+    // Counting sort by bucket:
+    cellStart.assign(tableSize + 1, 0u);
+    for (auto id : cellIds)
+        ++cellStart[id + 1];
+    std::inclusive_scan(cellStart.begin(), cellStart.end(), cellStart.begin());
+
+    order.resize(n);
+    std::vector<std::uint32_t> cursor(cellStart.begin(), cellStart.end() - 1);
+    for (std::uint32_t i{0}; i < n; ++i)
+        order[cursor[cellIds[i]]++] = i;
+
+    sorted.resize(n);
+    util::parallelFor(n, [&](std::size_t begin, std::size_t end){
+        for (auto i{begin}; i < end; ++i)
+            sorted[i] = spheres[order[i]];
+    });
+}
+
+// Response of sphere a to an overlap with sphere b. Only a is moved, b handles its side of the contact itself.
+// Position correction and impulse are split by mass, so the pair's momentum is conserved.
+static bool respond(const glm::vec4& a, const glm::vec4& va, const glm::vec4& b, const glm::vec4& vb,
+    const CollisionParams& params, glm::vec3& deltaPos, glm::vec3& deltaVelocity) {
+    const auto d = glm::vec3{a} - glm::vec3{b};
+    const float distSq = glm::dot(d, d);
+    const float radii = a.w + b.w;
+    if (radii * radii <= distSq)
+        return false;
+
+    // Coincident centers have no contact normal
+    const float dist = std::sqrt(distSq);
+    if (dist < 1e-8f)
+        return true;
+
+    const auto normal = d / dist;
+    const float totalMass = va.w + vb.w;
+    const float share = 0.f < totalMass ? vb.w / totalMass : 0.5f;
+
+    deltaPos += normal * ((radii - dist) * params.correction * share);
+
+    const float approach = glm::dot(glm::vec3{va} - glm::vec3{vb}, normal);
+    if (approach < 0.f)
+        deltaVelocity -= normal * ((1.f + params.restitution) * approach * share);
+
+    return true;
+}
+
+std::size_t resolveCollisions(const SpatialGrid& grid, std::span<glm::vec4> spheres, std::span<glm::vec4> velocities, const CollisionParams& params) {
+    const auto& sorted = grid.getSpheres();
+    const auto& order = grid.getOrder();
+    const auto n = sorted.size();
+
+    // Velocities in the same order as the grid, so the inner loop only reads contiguous ranges
+    std::vector<glm::vec4> sortedVelocities(n);
+    util::parallelFor(n, [&](std::size_t begin, std::size_t end){
+        for (auto i{begin}; i < end; ++i)
+            sortedVelocities[i] = velocities[order[i]];
+    });
+
+    std::atomic<std::size_t> contacts{0};
+    util::parallelFor(n, [&](std::size_t begin, std::size_t end){
+        std::size_t localContacts{0};
+        for (auto k{begin}; k < end; ++k) {
+            const auto& sphere = sorted[k];
+            const auto& velocity = sortedVelocities[k];
+            glm::vec3 deltaPos{0.f}, deltaVelocity{0.f};
+
+            grid.forEachNeighbour(glm::vec3{sphere}, [&](std::uint32_t j){
+                if (j != k && respond(sphere, velocity, sorted[j], sortedVelocities[j], params, deltaPos, deltaVelocity))
+                    ++localContacts;
+            });
+
+            const auto i = order[k];
+            spheres[i] += glm::vec4{deltaPos, 0.f};
+            velocities[i] += glm::vec4{deltaVelocity, 0.f};
+        }
+        contacts.fetch_add(localContacts, std::memory_order_relaxed);
+    }, 256);
+
+    // Every contact was seen from both sides
+    return contacts.load() / 2;
+}
+
+std::size_t resolveCollisionsBruteForce(std::span<glm::vec4> spheres, std::span<glm::vec4> velocities, const CollisionParams& params) {
+    const std::vector<glm::vec4> startSpheres{spheres.begin(), spheres.end()};
+    const std::vector<glm::vec4> startVelocities{velocities.begin(), velocities.end()};
+    const auto n = spheres.size();
+
+    std::atomic<std::size_t> contacts{0};
+    util::parallelFor(n, [&](std::size_t begin, std::size_t end){
+        std::size_t localContacts{0};
+        for (auto i{begin}; i < end; ++i) {
+            glm::vec3 deltaPos{0.f}, deltaVelocity{0.f};
+            for (std::size_t j{0}; j < n; ++j)
+                if (j != i && respond(startSpheres[i], startVelocities[i], startSpheres[j], startVelocities[j], params, deltaPos, deltaVelocity))
+                    ++localContacts;
+
+            spheres[i] += glm::vec4{deltaPos, 0.f};
+            velocities[i] += glm::vec4{deltaVelocity, 0.f};
+        }
+        contacts.fetch_add(localContacts, std::memory_order_relaxed);
+    }, 64);
+
+    return contacts.load() / 2;
+}
+
+}
@@ -0,0 +1,84 @@
+#ifndef COLLISION_H
+#define COLLISION_H
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <span>
+#include <array>
+#include <algorithm>
+#include <cstdint>
+
+namespace sim {
+
+struct CollisionParams {
+    // Fraction of the normal velocity kept after a collision
+    float restitution = 0.5f;
+    // Fraction of the overlap removed per step
+    float correction = 0.8f;
+};
+
+/**
+ * @brief Uniform grid over a set of spheres (xyz = position, w = radius), stored as a spatial hash.
+ * Cells are as large as the largest sphere's diameter, so overlapping spheres are always in neighbouring cells.
+ * Spheres are counting sorted by cell into a contiguous array, so a cell is a range of sorted spheres
+ * and neighbour queries read memory mostly sequentially. Cells are hashed into a table of about 2n entries,
+ * so memory use doesn't depend on how spread out the spheres are.
+ */
+class SpatialGrid {
+private:
+    float cellSize{1.f}, invCellSize{1.f};
+    std::uint32_t tableMask{0};
+    // Range of sorted spheres in each hash bucket: [cellStart[b], cellStart[b + 1])
+    std::vector<std::uint32_t> cellStart;
+    std::vector<std::uint32_t> cellIds;
+    // Sorted index -> original index
+    std::vector<std::uint32_t> order;
+    std::vector<glm::vec4> sorted;
+
+public:
+    void build(std::span<const glm::vec4> spheres);
+
+    glm::ivec3 cellOf(glm::vec3 pos) const { return glm::ivec3{glm::floor(pos * invCellSize)}; }
+
+    std::uint32_t bucket(glm::ivec3 cell) const {
+        return (static_cast<std::uint32_t>(cell.x) * 73856093u ^ static_cast<std::uint32_t>(cell.y) * 19349663u
+            ^ static_cast<std::uint32_t>(cell.z) * 83492791u) & tableMask;
+    }
+
+    // Calls f(sortedIndex) for every sphere in the 27 cells around pos.
+    // Distinct cells can share a bucket, so buckets are deduplicated first.
+    template <typename F>
+    void forEachNeighbour(glm::vec3 pos, F&& f) const {
+        std::array<std::uint32_t, 27> buckets;
+        std::size_t count{0};
+        const auto center = cellOf(pos);
+        for (int z{-1}; z <= 1; ++z)
+            for (int y{-1}; y <= 1; ++y)
+                for (int x{-1}; x <= 1; ++x)
+                    buckets[count++] = bucket(center + glm::ivec3{x, y, z});
+        std::sort(buckets.begin(), buckets.end());
+        const auto last = std::unique(buckets.begin(), buckets.end());
+
+        for (auto b = buckets.begin(); b != last; ++b)
+            for (auto i{cellStart[*b]}; i < cellStart[*b + 1]; ++i)
+                f(i);
+    }
+
+    float getCellSize() const { return cellSize; }
+    const std::vector<std::uint32_t>& getOrder() const { return order; }
+    // Spheres passed to the last build(), in cell order
+    const std::vector<glm::vec4>& getSpheres() const { return sorted; }
+};
+
+// Resolves sphere overlaps in one Jacobi-style pass: every sphere computes its own response against the state
+// at the start of the pass, so spheres can be processed in parallel without synchronization.
+// Spheres are xyz = position, w = radius, velocities are xyz = velocity, w = mass. Returns the number of contacts.
+std::size_t resolveCollisions(const SpatialGrid& grid, std::span<glm::vec4> spheres, std::span<glm::vec4> velocities, const CollisionParams& params);
+
+// O(n^2) reference with the same response. Used to validate and benchmark the grid.
+std::size_t resolveCollisionsBruteForce(std::span<glm::vec4> spheres, std::span<glm::vec4> velocities, const CollisionParams& params);
+
+}
+
+#endif // COLLISION_H
@@ -0,0 +1,95 @@
+#ifndef DIRTYRANGES_H
+#define DIRTYRANGES_H
+
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <cstddef>
+
+/**
+ * @brief Collects modified element indices and merges them into a few contiguous ranges for partial uploads.
+ * Ranges closer together than the gap tolerance are merged, as are the closest ranges if there are more
+ * than maxRanges, so the number of upload calls stays small at the cost of re-uploading some clean elements.
+ */
+class DirtyRanges {
+public:
+    struct Range {
+        std::uint32_t first{0}, count{0};
+
+        std::uint32_t end() const { return first + count; }
+    };
+
+private:
+    std::vector<Range> ranges;
+    bool bMerged{true};
+
+public:
+    std::size_t maxRanges;
+    std::uint32_t gapTolerance;
+
+    explicit DirtyRanges(std::size_t maxRangeCount = 16, std::uint32_t mergeGap = 8)
+        : maxRanges{maxRangeCount}, gapTolerance{mergeGap} {}
+
+    void mark(std::uint32_t index, std::uint32_t count = 1) {
+        if (count == 0)
+            return;
+        // Extend the last range for the common case of sequential edits
+        if (!ranges.empty() && ranges.back().first <= index && index <= ranges.back().end()) {
+            ranges.back().count = std::max(ranges.back().end(), index + count) - ranges.back().first;
+            return;
+        }
+        ranges.push_back({index, count});
+        bMerged = false;
+    }
+
+    // Sorted, non-overlapping ranges covering every marked index
+    const std::vector<Range>& merged() {
+        if (bMerged)
+            return ranges;
+        bMerged = true;
+
+        std::sort(ranges.begin(), ranges.end(), [](const Range& lhs, const Range& rhs){ return lhs.first < rhs.first; });
+        mergeGaps(gapTolerance);
+
+        if (maxRanges < ranges.size()) {
+            // Merge every gap up to the one that brings the count down to maxRanges
+            std::vector<std::uint32_t> gaps(ranges.size() - 1);
+            for (std::size_t i{1}; i < ranges.size(); ++i)
+                gaps[i - 1] = ranges[i].first - ranges[i - 1].end();
+            const auto nth = gaps.begin() + static_cast<std::ptrdiff_t>(ranges.size() - std::max<std::size_t>(maxRanges, 1));
+            std::nth_element(gaps.begin(), nth - 1, gaps.end());
+            mergeGaps(*(nth - 1));
+        }
+        return ranges;
+    }
+
+    // Number of elements covered by the merged ranges
+    std::size_t elementCount() {
+        std::size_t count{0};
+        for (const auto& range : merged())
+            count += range.count;
+        return count;
+    }
+
+    bool empty() const { return ranges.empty(); }
+    void clear() { ranges.clear(); bMerged = true; }
+
+private:
+    // Expects ranges sorted by first index
+    void mergeGaps(std::uint32_t maxGap) {
+        if (ranges.empty())
+            return;
+
+        std::size_t last{0};
+        for (std::size_t i{1}; i < ranges.size(); ++i) {
+            auto& current = ranges[last];
+            if (ranges[i].first <= current.end() + maxGap)
+                current.count = std::max(current.end(), ranges[i].end()) - current.first;
+            else
+                ranges[++last] = ranges[i];
+        }
+        ranges.resize(last + 1);
+    }
+};
+
+#endif // DIRTYRANGES_H
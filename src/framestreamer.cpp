@@ -0,0 +1,141 @@
+#include "framestreamer.h"
+
+#include <iostream>
+#include <format>
+#include <algorithm>
+
+namespace io {
+
+FrameStreamer::FrameStreamer(FrameReader frameReader, std::size_t frames, const std::vector<std::span<glm::vec4>>& slotData, std::size_t start)
+    : reader{std::move(frameReader)}, frameCount{frames}, playhead{frames ? start % frames : 0}
+{
+    for (const auto data : slotData)
+        slots.push_back({data});
+    thread = std::jthread{[this](std::stop_token stopToken){ run(stopToken); }};
+}
+
+bool FrameStreamer::inWindow(std::size_t frame) const {
+    const auto distance = bBackward ? playhead + frameCount - frame : frame + frameCount - playhead;
+    return distance % frameCount < slots.size();
+}
+
+// First frame of the window that isn't in any slot yet
+std::optional<std::size_t> FrameStreamer::nextFrame() const {
+    for (std::size_t k{0}; k < std::min(slots.size(), frameCount); ++k) {
+        const auto frame = bBackward ? (playhead + frameCount - k) % frameCount : (playhead + k) % frameCount;
+        const bool bLoaded = std::any_of(slots.begin(), slots.end(), [frame](const Slot& slot){
+            return slot.state != SlotState::Free && slot.frame == frame;
+        });
+        if (!bLoaded)
+            return frame;
+    }
+    return std::nullopt;
+}
+
+std::optional<std::size_t> FrameStreamer::freeSlot() const {
+    const auto it = std::find_if(slots.begin(), slots.end(), [](const Slot& slot){ return slot.state == SlotState::Free; });
+    return it != slots.end() ? std::optional{static_cast<std::size_t>(it - slots.begin())} : std::nullopt;
+}
+
+void FrameStreamer::run(std::stop_token stopToken) {
+    std::unique_lock lock{mutex};
+    while (!stopToken.stop_requested()) {
+        std::optional<std::size_t> frame, slotIndex;
+        const bool bWork = wakeUp.wait(lock, stopToken, [&]{
+            frame = nextFrame();
+            slotIndex = freeSlot();
+            return !bFailed && frame && slotIndex;
+        });
+        if (!bWork)
+            break;
+
+        auto& slot = slots[*slotIndex];
+        slot.state = SlotState::Loading;
+        slot.frame = *frame;
+
+        // Read without holding the lock, so the render thread can keep presenting meanwhile
+        lock.unlock();
+        const bool bRead = reader(*frame, slot.data);
+        lock.lock();
+
+        if (!bRead) {
+            std::cout << std::format("TRAJECTORY ERROR: Could not read frame {}, stopped streaming.", *frame) << std::endl;
+            slot.state = SlotState::Free;
+            bFailed = true;
+        } else if (inWindow(*frame)) {
+            slot.state = SlotState::Ready;
+            ++loadedCount;
+        } else {
+            // The playhead moved on while the frame was loading
+            slot.state = SlotState::Free;
+            ++droppedCount;
+        }
+    }
+}
+
+void FrameStreamer::seek(std::size_t frame, bool bBackwardPlayback) {
+    if (frameCount == 0)
+        return;
+    {
+        std::lock_guard lock{mutex};
+        frame %= frameCount;
+        if (frame == playhead && bBackwardPlayback == bBackward)
+            return;
+        playhead = frame;
+        bBackward = bBackwardPlayback;
+
+        for (auto& slot : slots) {
+            if (slot.state == SlotState::Ready && !inWindow(slot.frame)) {
+                slot.state = SlotState::Free;
+                ++droppedCount;
+            }
+        }
+    }
+    wakeUp.notify_one();
+}
+
+std::optional<std::size_t> FrameStreamer::present(std::size_t frame) {
+    std::lock_guard lock{mutex};
+    for (std::size_t i{0}; i < slots.size(); ++i) {
+        if (slots[i].state == SlotState::Ready && slots[i].frame == frame) {
+            slots[i].state = SlotState::InUse;
+            return i;
+        }
+    }
+    const bool bShown = std::any_of(slots.begin(), slots.end(), [frame](const Slot& slot){
+        return slot.state == SlotState::InUse && slot.frame == frame;
+    });
+    if (!bShown)
+        ++missCount;
+    return std::nullopt;
+}
+
+void FrameStreamer::release(std::size_t slot) {
+    {
+        std::lock_guard lock{mutex};
+        slots[slot].state = SlotState::Free;
+    }
+    wakeUp.notify_one();
+}
+
+std::uint64_t FrameStreamer::getLoadedCount() {
+    std::lock_guard lock{mutex};
+    return loadedCount;
+}
+
+std::uint64_t FrameStreamer::getDroppedCount() {
+    std::lock_guard lock{mutex};
+    return droppedCount;
+}
+
+std::uint64_t FrameStreamer::getMissCount() {
+    std::lock_guard lock{mutex};
+    return missCount;
+}
+
+std::size_t FrameStreamer::getReadyCount() {
+    std::lock_guard lock{mutex};
+    return static_cast<std::size_t>(std::count_if(slots.begin(), slots.end(), [](const Slot& slot){ return slot.state == SlotState::Ready; }));
+}
+
+}
@@ -0,0 +1,78 @@
+#ifndef FRAMESTREAMER_H
+#define FRAMESTREAMER_H
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <span>
+#include <optional>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+
+namespace io {
+
+/**
+ * @brief Loads trajectory frames on a background thread into a fixed set of slots ahead of the playhead, in the direction of playback.
+ * The slots are owned by the caller, e.g. regions of a persistently mapped buffer.
+ * A slot is free, loading, ready (holds a prefetched frame) or in use (presented, and possibly still read by the GPU).
+ * The caller never waits for the loader: present() only hands out frames that are already loaded,
+ * and seek() re-targets the prefetch window, dropping prefetched frames that fall outside of it.
+ */
+class FrameStreamer {
+public:
+    // Reads a frame into a slot. Called on the streaming thread.
+    using FrameReader = std::function<bool(std::size_t, std::span<glm::vec4>)>;
+
+private:
+    enum class SlotState { Free, Loading, Ready, InUse };
+
+    struct Slot {
+        std::span<glm::vec4> data;
+        SlotState state{SlotState::Free};
+        std::size_t frame{0};
+    };
+
+    FrameReader reader;
+    const std::size_t frameCount;
+    std::vector<Slot> slots;
+    // Frames from the playhead up to slots.size() frames ahead (behind when playing backwards, wrapping around) are prefetched
+    std::size_t playhead{0};
+    bool bBackward = false;
+    bool bFailed = false;
+    std::uint64_t loadedCount{0}, droppedCount{0}, missCount{0};
+
+    std::mutex mutex;
+    std::condition_variable_any wakeUp;
+    // Declared last so the thread is stopped before the state it uses is destroyed
+    std::jthread thread;
+
+    bool inWindow(std::size_t frame) const;
+    std::optional<std::size_t> nextFrame() const;
+    std::optional<std::size_t> freeSlot() const;
+    void run(std::stop_token stopToken);
+
+public:
+    FrameStreamer(FrameReader frameReader, std::size_t frames, const std::vector<std::span<glm::vec4>>& slotData, std::size_t start = 0);
+    FrameStreamer(const FrameStreamer&) = delete;
+    FrameStreamer& operator=(const FrameStreamer&) = delete;
+
+    // Moves the prefetch window to start at frame and extend in the direction of playback
+    void seek(std::size_t frame, bool bBackwardPlayback = false);
+    // Returns the slot holding frame and marks it as in use, or nothing if the frame isn't loaded yet.
+    std::optional<std::size_t> present(std::size_t frame);
+    // Hands an in-use slot back for loading, once nothing reads it anymore
+    void release(std::size_t slot);
+
+    std::uint64_t getLoadedCount();
+    std::uint64_t getDroppedCount();
+    // Frames asked for by present() that weren't loaded in time
+    std::uint64_t getMissCount();
+    std::size_t getReadyCount();
+};
+
+}
+
+#endif // FRAMESTREAMER_H
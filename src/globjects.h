@@ -10,6 +10,8 @@
 #include <vector>
 #include <set>
 #include <ranges>
+#include <span>
+#include <cstring>
 
 #include "utils.h"
 
@@ -60,6 +62,39 @@ public:
         assert(bufferSize == sizeof(T) * data.size());
         glBufferSubData(BufferType, offset, sizeof(T) * data.size(), data.data());
     }
+
+    // Overwrites data.size() elements starting at element index first
+    template <typename T>
+    void updateBufferRange(std::span<const T> data, std::size_t first) {
+        auto g = guard();
+        assert(sizeof(T) * (first + data.size()) <= bufferSize);
+        glBufferSubData(BufferType, sizeof(T) * first, sizeof(T) * data.size(), data.data());
+    }
+
+    // Allocates immutable storage. The buffer can't be resized or reallocated afterwards.
+    void bufferStorage(std::size_t byteSize, GLbitfield flags, const void* data = nullptr) {
+        auto g = guard();
+        bufferSize = byteSize;
+        glBufferStorage(BufferType, byteSize, data, flags);
+    }
+
+    template <typename T>
+    std::vector<T> getBufferData(std::size_t count, GLintptr offset = 0) {
+        auto g = guard();
+        std::vector<T> data(count);
+        glGetBufferSubData(BufferType, offset, sizeof(T) * count, data.data());
+        return data;
+    }
+
+    void* mapRange(GLintptr offset, GLsizeiptr length, GLbitfield access) {
+        auto g = guard();
+        return glMapBufferRange(BufferType, offset, length, access);
+    }
+
+    bool unmap() {
+        auto g = guard();
+        return glUnmapBuffer(BufferType) == GL_TRUE;
+    }
     
     Buffer() {
         glGenBuffers(1, &id);
@@ -92,6 +127,11 @@ public:
         glBindBufferBase(BufferType, binding, id);
     }
 
+    // Binds the buffer to an indexed target other than its own (e.g. a vertex buffer as a shader storage buffer)
+    void bindBase(unsigned int binding, GLenum target) {
+        glBindBufferBase(target, binding, id);
+    }
+
     // Same as bindBase, but also let's you specify range of bound buffer (glBindBufferRange)
     void bindRange(GLsizeiptr size, unsigned int binding = 0, GLintptr offset = 0) {
         glBindBufferRange(BufferType, binding, id, offset, size);
@@ -102,6 +142,112 @@ public:
     }
 };
 
+// Layout of the commands read by glDrawElementsIndirect
+struct DrawElementsIndirectCommand {
+    GLuint count;
+    GLuint instanceCount;
+    GLuint firstIndex;
+    GLint baseVertex;
+    GLuint baseInstance;
+};
+
+/**
+ * @brief Immutable buffer storage that is persistently mapped and split into equally sized regions.
+ * Regions are written round robin: acquire() waits until the GPU is done with the next region,
+ * and fence() marks the current region as in use by the commands submitted so far.
+ */
+template <GLenum BufferType>
+class RingBuffer {
+private:
+    Buffer<BufferType>& buffer;
+    std::size_t regionSize;
+    std::byte* mappedPtr{nullptr};
+    std::vector<GLsync> fences;
+    std::size_t current{0};
+
+public:
+    static constexpr GLbitfield MAP_FLAGS = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+    // Fences the current region when going out of scope
+    class FenceGuard {
+    private:
+        RingBuffer* mPtr;
+    public:
+        FenceGuard(RingBuffer* ptr) : mPtr{ptr} {}
+        ~FenceGuard() { mPtr->fence(); }
+    };
+
+    // Allocates regionCount * regionByteSize bytes of immutable storage in buffer, with every region initialized to data (if given).
+    RingBuffer(Buffer<BufferType>& buf, std::size_t regionByteSize, std::size_t regionCount = 3, const void* data = nullptr)
+        : buffer{buf}, regionSize{regionByteSize}, fences(regionCount, nullptr) {
+        buffer.bufferStorage(regionSize * regionCount, MAP_FLAGS | GL_DYNAMIC_STORAGE_BIT);
+        mappedPtr = static_cast<std::byte*>(buffer.mapRange(0, regionSize * regionCount, MAP_FLAGS));
+        if (data)
+            for (std::size_t i{0}; i < regionCount; ++i)
+                std::memcpy(mappedPtr + i * regionSize, data, regionSize);
+    }
+
+    RingBuffer(const RingBuffer&) = delete;
+    RingBuffer& operator=(const RingBuffer&) = delete;
+
+    // Moves on to the next region, blocking until the GPU is done reading it. Returns the region index.
+    std::size_t acquire() {
+        current = (current + 1) % fences.size();
+        if (auto& sync = fences[current]) {
+            GLbitfield flags = 0;
+            while (glClientWaitSync(sync, flags, 1'000'000) == GL_TIMEOUT_EXPIRED)
+                flags = GL_SYNC_FLUSH_COMMANDS_BIT;
+            glDeleteSync(sync);
+            sync = nullptr;
+        }
+        return current;
+    }
+
+    // Guards the current region until the GPU has executed all commands submitted so far.
+    void fence() { fence(current); }
+
+    // Same for any region, for regions that aren't used in ring order.
+    void fence(std::size_t index) {
+        auto& sync = fences[index];
+        if (sync)
+            glDeleteSync(sync);
+        sync = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+
+    // True once the GPU is done with a region. Never blocks.
+    bool isIdle(std::size_t index) {
+        auto& sync = fences[index];
+        if (!sync)
+            return true;
+        if (glClientWaitSync(sync, GL_SYNC_FLUSH_COMMANDS_BIT, 0) == GL_TIMEOUT_EXPIRED)
+            return false;
+        glDeleteSync(sync);
+        sync = nullptr;
+        return true;
+    }
+
+    auto fenceGuard() { return FenceGuard{this}; }
+
+    template <typename T>
+    std::span<T> region(std::size_t index) {
+        return {reinterpret_cast<T*>(mappedPtr + index * regionSize), regionSize / sizeof(T)};
+    }
+
+    template <typename T>
+    std::span<T> currentRegion() { return region<T>(current); }
+
+    std::size_t currentIndex() const { return current; }
+    std::size_t size() const { return fences.size(); }
+    std::size_t getRegionSize() const { return regionSize; }
+
+    ~RingBuffer() {
+        for (auto sync : fences)
+            if (sync)
+                glDeleteSync(sync);
+        buffer.unmap();
+    }
+};
+
 template <GLenum TextureType, typename DimType>
 class TextureBase {
 public:
@@ -153,6 +299,9 @@ class Texture : public TextureBase<TextureType, void> {};
 
 template <>
 class Texture<GL_TEXTURE_2D> : public TextureBase<GL_TEXTURE_2D, glm::ivec2> {
+private:
+    GLsizei mipLevels{1};
+
 public:
     void data(GLint level, GLint internalformat, glm::ivec2 size, GLint border, GLenum format, GLenum type, const void * data) final {
         glTexImage2D(GL_TEXTURE_2D, level, internalformat, size.x, size.y, border, format, type, data);
@@ -170,6 +319,21 @@ public:
         data(0, internalformat, size, 0, format, GL_UNSIGNED_BYTE, nullptr);
     }
 
+    // Immutable storage with a mip chain of the given length, for reading with texelFetch and writing as images
+    void storage(GLsizei levels, GLenum internalformat, glm::ivec2 size) {
+        bind();
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexStorage2D(GL_TEXTURE_2D, levels, internalformat, size.x, size.y);
+        texSize = size;
+        texInternalFormat = static_cast<GLint>(internalformat);
+        mipLevels = levels;
+    }
+
+    GLsizei levels() const { return mipLevels; }
+
     Texture() : TextureBase<GL_TEXTURE_2D, glm::ivec2>{} {}
     Texture(glm::ivec2 size, GLenum internalformat = GL_RGBA16F, GLenum format = GL_RGBA) : TextureBase<GL_TEXTURE_2D, glm::ivec2>{} {
         init(size, internalformat, format);
@@ -255,6 +419,15 @@ public:
         vertexBuffer->bind();
     }
 
+    // Vertex buffer without storage, for buffers allocated later (e.g. by a RingBuffer)
+    VertexArray() : bInit{true} {
+        glGenVertexArrays(1, &id);
+        glBindVertexArray(id);
+
+        vertexBuffer = std::make_unique<Buffer<GL_ARRAY_BUFFER>>();
+        vertexBuffer->bind();
+    }
+
     template <typename T, std::size_t I>
     VertexArray(T (&& vertices)[I]) : VertexArray{std::vector{vertices}} {}
 
@@ -275,11 +448,22 @@ public:
         indexBuffer->bind();
     }
 
+    // Binds the vertex array and its vertex buffer first, since creating buffer storage (e.g. for a RingBuffer) unbinds the buffer.
     void vertexAttribute(GLuint index, GLint size, GLenum type, GLboolean normalized, GLsizei stride = 0, const void * pointer = nullptr) {
+        glBindVertexArray(id);
+        vertexBuffer->bind();
         glVertexAttribPointer(index, size, type, normalized, stride, pointer);
         glEnableVertexAttribArray(index);
     }
 
+    // Integer attribute, read as ivec/uvec in the shader instead of being converted to float
+    void vertexAttributeInteger(GLuint index, GLint size, GLenum type, GLsizei stride = 0, const void * pointer = nullptr) {
+        glBindVertexArray(id);
+        vertexBuffer->bind();
+        glVertexAttribIPointer(index, size, type, stride, pointer);
+        glEnableVertexAttribArray(index);
+    }
+
     void bind() {
         glBindVertexArray(id);
     }
@@ -0,0 +1,173 @@
+#include "jobs.h"
+
+namespace jobs {
+
+namespace {
+
+// Scheduler the current thread works for and its deque there, if it is a worker
+thread_local Scheduler* currentScheduler{nullptr};
+thread_local std::size_t currentWorker{0};
+
+}
+
+Scheduler::Scheduler(std::size_t workerCount) {
+    for (std::size_t i{0}; i < workerCount + 1; ++i)
+        workers.push_back(std::make_unique<Worker>());
+    for (std::size_t i{0}; i < workerCount; ++i)
+        threads.emplace_back([this, i]{ run(i); });
+}
+
+Scheduler::~Scheduler() {
+    {
+        std::lock_guard lock{sleepMutex};
+        bStopping = true;
+    }
+    wake.notify_all();
+    threads.clear();
+}
+
+Scheduler& Scheduler::global() {
+    static Scheduler scheduler;
+    return scheduler;
+}
+
+void Scheduler::run(std::size_t index) {
+    currentScheduler = this;
+    currentWorker = index;
+    while (true) {
+        // Background tasks only once there's nothing else, so they don't hold up anyone waiting
+        if (runOne())
+            continue;
+        if (const auto task = take(true)) {
+            execute(task);
+            continue;
+        }
+
+        std::unique_lock lock{sleepMutex};
+        sleeping.fetch_add(1);
+        wake.wait(lock, [this]{ return bStopping || 0 < queued.load(); });
+        sleeping.fetch_sub(1);
+        if (bStopping)
+            return;
+    }
+}
+
+void Scheduler::push(std::shared_ptr<detail::Task> task) {
+    // Workers push to their own deque, everyone else to the shared one
+    auto& worker = currentScheduler == this ? *workers[currentWorker] : *workers.back();
+    {
+        std::lock_guard lock{worker.mutex};
+        worker.tasks.push_back(std::move(task));
+    }
+    queued.fetch_add(1);
+    wakeOne();
+}
+
+void Scheduler::wakeOne() {
+    if (0 < sleeping.load()) {
+        // Taking the mutex orders this after a sleeper's check of queued, so the notification can't be missed
+        { std::lock_guard lock{sleepMutex}; }
+        wake.notify_one();
+    }
+}
+
+std::shared_ptr<detail::Task> Scheduler::take(bool bBackground) {
+    if (queued.load() == 0)
+        return {};
+
+    if (bBackground) {
+        std::lock_guard lock{background.mutex};
+        if (background.tasks.empty())
+            return {};
+        auto task = std::move(background.tasks.front());
+        background.tasks.pop_front();
+        queued.fetch_sub(1);
+        return task;
+    }
+
+    const auto own = currentScheduler == this ? currentWorker : workers.size() - 1;
+    {
+        auto& worker = *workers[own];
+        std::lock_guard lock{worker.mutex};
+        if (!worker.tasks.empty()) {
+            auto task = std::move(worker.tasks.back());
+            worker.tasks.pop_back();
+            queued.fetch_sub(1);
+            return task;
+        }
+    }
+    // Steal the oldest task of the next worker that has one
+    for (std::size_t offset{1}; offset < workers.size(); ++offset) {
+        auto& victim = *workers[(own + offset) % workers.size()];
+        std::lock_guard lock{victim.mutex};
+        if (!victim.tasks.empty()) {
+            auto task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            queued.fetch_sub(1);
+            return task;
+        }
+    }
+    return {};
+}
+
+void Scheduler::execute(const std::shared_ptr<detail::Task>& task) {
+    task->work();
+    task->work = nullptr;
+
+    std::vector<std::shared_ptr<detail::Task>> dependents;
+    {
+        std::lock_guard lock{task->mutex};
+        task->bFinished.store(true, std::memory_order_release);
+        dependents.swap(task->dependents);
+    }
+    for (auto& dependent : dependents)
+        if (dependent->blockers.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            push(std::move(dependent));
+}
+
+bool Scheduler::runOne() {
+    const auto task = take(false);
+    if (!task)
+        return false;
+    execute(task);
+    return true;
+}
+
+void Scheduler::submitBackground(std::function<void()> f) {
+    auto task = std::make_shared<detail::Task>();
+    task->work = std::move(f);
+    {
+        std::lock_guard lock{background.mutex};
+        background.tasks.push_back(std::move(task));
+    }
+    queued.fetch_add(1);
+    wakeOne();
+}
+
+TaskHandle Scheduler::submit(std::function<void()> f, std::span<const TaskHandle> dependencies) {
+    auto task = std::make_shared<detail::Task>();
+    task->work = std::move(f);
+    for (const auto& dependency : dependencies) {
+        if (!dependency.task)
+            continue;
+        std::lock_guard lock{dependency.task->mutex};
+        if (dependency.task->bFinished.load(std::memory_order_relaxed))
+            continue;
+        task->blockers.fetch_add(1, std::memory_order_relaxed);
+        dependency.task->dependents.push_back(task);
+    }
+
+    TaskHandle handle;
+    handle.task = task;
+    if (task->blockers.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        push(std::move(task));
+    return handle;
+}
+
+void Scheduler::wait(const TaskHandle& handle) {
+    while (!handle.done())
+        if (!runOne())
+            std::this_thread::yield();
+}
+
+}
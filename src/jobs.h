@@ -0,0 +1,246 @@
+#ifndef JOBS_H
+#define JOBS_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// Work-stealing job system shared by every CPU heavy part of the project
+namespace jobs {
+
+class Scheduler;
+
+namespace detail {
+
+struct Task {
+    std::function<void()> work;
+    // Unfinished dependencies, plus one held by submit() until they're all registered
+    std::atomic<std::size_t> blockers{1};
+    std::atomic<bool> bFinished{false};
+    // Guards the dependents and, when finishing, bFinished
+    std::mutex mutex;
+    std::vector<std::shared_ptr<Task>> dependents;
+};
+
+}
+
+// Submitted task, to wait for or to make other tasks depend on. A default constructed handle counts as done.
+class TaskHandle {
+private:
+    std::shared_ptr<detail::Task> task;
+    friend class Scheduler;
+
+public:
+    TaskHandle() = default;
+
+    bool done() const { return !task || task->bFinished.load(std::memory_order_acquire); }
+};
+
+/**
+ * @brief Pool of worker threads that run tasks, each worker from a deque of its own.
+ * Workers push and pop at the back of their deque, so they work depth first on what they spawned last, and idle workers
+ * steal from the front of the others, which holds the oldest and usually largest pieces of work. Tasks submitted by other
+ * threads go to a shared deque that is only stolen from. Waiting for a task runs other tasks meanwhile, so tasks can wait
+ * for the tasks they spawn (nested parallelFor calls, recursive builds) without tying up a thread. Long running background
+ * tasks have a deque of their own that only idle workers take from, so no wait ever runs one inline.
+ */
+class Scheduler {
+private:
+    struct Worker {
+        std::mutex mutex;
+        std::deque<std::shared_ptr<detail::Task>> tasks;
+    };
+
+    // One per thread, then the one outside threads submit to
+    std::vector<std::unique_ptr<Worker>> workers;
+    Worker background;
+    std::vector<std::jthread> threads;
+    // Tasks in all deques, and workers asleep because there were none
+    std::atomic<std::size_t> queued{0};
+    std::atomic<std::size_t> sleeping{0};
+    std::mutex sleepMutex;
+    std::condition_variable wake;
+    std::atomic<bool> bStopping{false};
+
+    void run(std::size_t index);
+    void push(std::shared_ptr<detail::Task> task);
+    // Wakes a sleeping worker, if any, after a task was queued
+    void wakeOne();
+    std::shared_ptr<detail::Task> take(bool bBackground);
+    void execute(const std::shared_ptr<detail::Task>& task);
+
+    template <typename F>
+    void split(std::size_t begin, std::size_t end, std::size_t chunk, F& f, class TaskGroup& group);
+
+public:
+    // Defaults to a worker for every hardware thread but the one calling into it. Without workers, tasks only run
+    // while some thread waits for them, which futures returned by async() don't do.
+    explicit Scheduler(std::size_t workerCount = std::max(2u, std::thread::hardware_concurrency()) - 1);
+    Scheduler(const Scheduler&) = delete;
+    Scheduler& operator=(const Scheduler&) = delete;
+    ~Scheduler();
+
+    static Scheduler& global();
+
+    // Workers, plus the thread waiting for them
+    std::size_t threadCount() const { return threads.size() + 1; }
+
+    // Runs f once all dependencies are done
+    TaskHandle submit(std::function<void()> f, std::span<const TaskHandle> dependencies = {});
+    // Runs other tasks until the task is done
+    void wait(const TaskHandle& handle);
+    // Runs f on a worker once one is idle, for long tasks that nothing should wait for inline
+    void submitBackground(std::function<void()> f);
+    // Runs a queued task if there is one, but no background task. Returns false if there was none.
+    bool runOne();
+
+    // Runs f(begin, end) over chunks that cover [0, n). Chunks are sized to give every thread several, but hold at least
+    // grainSize items. Ranges are split in halves, so thieves take large pieces and split them further themselves.
+    template <typename F>
+    void parallelFor(std::size_t n, F&& f, std::size_t grainSize = 1024);
+};
+
+/**
+ * @brief Set of tasks to wait for together, without a handle per task.
+ * Waits for its tasks when destroyed.
+ */
+class TaskGroup {
+private:
+    Scheduler& scheduler;
+    std::atomic<std::size_t> pending{0};
+
+public:
+    explicit TaskGroup(Scheduler& scheduler = Scheduler::global()) : scheduler{scheduler} {}
+    TaskGroup(const TaskGroup&) = delete;
+    TaskGroup& operator=(const TaskGroup&) = delete;
+    ~TaskGroup() { wait(); }
+
+    template <typename F>
+    void run(F&& f) {
+        pending.fetch_add(1, std::memory_order_relaxed);
+        scheduler.submit([this, f = std::forward<F>(f)]() mutable {
+            f();
+            pending.fetch_sub(1, std::memory_order_acq_rel);
+        });
+    }
+
+    void wait() {
+        while (0 < pending.load(std::memory_order_acquire))
+            if (!scheduler.runOne())
+                std::this_thread::yield();
+    }
+};
+
+template <typename F>
+void Scheduler::split(std::size_t begin, std::size_t end, std::size_t chunk, F& f, TaskGroup& group) {
+    while (chunk < end - begin) {
+        const auto mid = begin + (end - begin) / 2;
+        group.run([this, mid, end, chunk, &f, &group]{ split(mid, end, chunk, f, group); });
+        end = mid;
+    }
+    f(begin, end);
+}
+
+template <typename F>
+void Scheduler::parallelFor(std::size_t n, F&& f, std::size_t grainSize) {
+    constexpr std::size_t CHUNKS_PER_THREAD = 8;
+    if (n == 0)
+        return;
+
+    const auto chunks = threadCount() * CHUNKS_PER_THREAD;
+    const auto chunk = std::max(std::max<std::size_t>(grainSize, 1), (n + chunks - 1) / chunks);
+    if (n <= chunk || threads.empty()) {
+        f(std::size_t{0}, n);
+        return;
+    }
+    TaskGroup group{*this};
+    split(0, n, chunk, f, group);
+    group.wait();
+}
+
+// The same on the global scheduler:
+
+inline TaskHandle submit(std::function<void()> f, std::span<const TaskHandle> dependencies = {}) {
+    return Scheduler::global().submit(std::move(f), dependencies);
+}
+
+inline void wait(const TaskHandle& handle) {
+    Scheduler::global().wait(handle);
+}
+
+template <typename F>
+void parallelFor(std::size_t n, F&& f, std::size_t grainSize = 1024) {
+    Scheduler::global().parallelFor(n, std::forward<F>(f), grainSize);
+}
+
+// Runs f as a background task, for results polled through a future. Unlike std::async, no thread is started for it.
+template <typename F>
+auto async(F&& f) -> std::future<std::invoke_result_t<F>> {
+    auto task = std::make_shared<std::packaged_task<std::invoke_result_t<F>()>>(std::forward<F>(f));
+    auto future = task->get_future();
+    Scheduler::global().submitBackground([task]{ (*task)(); });
+    return future;
+}
+
+// Reduces init and transform(i) for every i in [0, n). The chunks are fixed by n and grainSize and reduced in order,
+// so floating point results don't depend on the thread count.
+template <typename T, typename Reduce, typename Transform>
+T transformReduce(std::size_t n, T init, Reduce&& reduce, Transform&& transform, std::size_t grainSize = 4096) {
+    constexpr std::size_t MAX_CHUNKS = 256;
+    if (n == 0)
+        return init;
+
+    // Never more chunks than items, so every chunk starts from its first item and init is reduced only once
+    const auto chunkCount = std::clamp<std::size_t>((n + grainSize - 1) / grainSize, 1, MAX_CHUNKS);
+    std::vector<std::optional<T>> partial(chunkCount);
+    parallelFor(chunkCount, [&](std::size_t begin, std::size_t end){
+        for (auto c{begin}; c < end; ++c) {
+            const auto first = c * n / chunkCount, last = (c + 1) * n / chunkCount;
+            T value = transform(first);
+            for (auto i{first + 1}; i < last; ++i)
+                value = reduce(value, transform(i));
+            partial[c] = std::move(value);
+        }
+    }, 1);
+
+    T result{init};
+    for (auto& value : partial)
+        result = reduce(result, *value);
+    return result;
+}
+
+// Sorts chunks in parallel, then merges them pairwise, each round of merges in parallel
+template <typename It, typename Compare = std::less<>>
+void parallelSort(It first, It last, Compare compare = {}) {
+    constexpr std::size_t MIN_CHUNK = 1 << 14;
+    const auto n = static_cast<std::size_t>(last - first);
+    std::size_t chunkCount{1};
+    while (chunkCount < Scheduler::global().threadCount() && MIN_CHUNK * 2 * chunkCount <= n)
+        chunkCount *= 2;
+    const auto bound = [&](std::size_t c){ return first + static_cast<std::ptrdiff_t>(c * n / chunkCount); };
+
+    parallelFor(chunkCount, [&](std::size_t begin, std::size_t end){
+        for (auto c{begin}; c < end; ++c)
+            std::sort(bound(c), bound(c + 1), compare);
+    }, 1);
+    for (std::size_t width{2}; width <= chunkCount; width *= 2)
+        parallelFor(chunkCount / width, [&](std::size_t begin, std::size_t end){
+            for (auto m{begin}; m < end; ++m)
+                std::inplace_merge(bound(m * width), bound(m * width + width / 2), bound(m * width + width), compare);
+        }, 1);
+}
+
+}
+
+#endif // JOBS_H
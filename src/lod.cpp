@@ -0,0 +1,171 @@
+#include "lod.h"
+#include "morton.h"
+#include "utils.h"
+#include "jobs.h"
+
+#include <algorithm>
+#include <numeric>
+#include <limits>
+#include <cmath>
+
+namespace util {
+
+static_assert(LOD_LEVELS == 4, "LodCluster stores a uvec4 per level");
+static_assert(sizeof(LodCluster) == 64, "LodCluster has to match the std430 layout in lod.comp.glsl");
+
+namespace {
+
+// Base cells are a few radii wide, so level 1 merges small groups of touching spheres
+constexpr float BASE_CELL_RADII = 4.f;
+// Cells in each direction are stored in 21 bits of a Morton code
+constexpr float MAX_CELL = static_cast<float>((1u << 21) - 1);
+
+struct KeyedSphere {
+    std::uint64_t key;
+    glm::uint index;
+};
+
+// Level of a Morton code of base cells, where the cells of level l are 2^(l-1) base cells wide
+std::uint64_t levelKey(std::uint64_t key, std::size_t level) {
+    return key >> (3 * (level - 1));
+}
+
+// Volume preserving merge of the keyed spheres
+glm::vec4 mergeSpheres(std::span<const glm::vec4> spheres, std::span<const KeyedSphere> keyed) {
+    glm::vec3 center{0.f};
+    float volume{0.f};
+    for (const auto& k : keyed) {
+        const auto& s = spheres[k.index];
+        const float v = s.w * s.w * s.w;
+        center += glm::vec3{s} * v;
+        volume += v;
+    }
+    if (volume <= 0.f)
+        return glm::vec4{glm::vec3{spheres[keyed.front().index]}, 0.f};
+    return glm::vec4{center / volume, std::cbrt(volume)};
+}
+
+// Number of runs of equal keys at a level
+std::size_t countRuns(std::span<const KeyedSphere> keyed, std::size_t level) {
+    std::size_t runs{0};
+    for (std::size_t i{0}; i < keyed.size(); ++i)
+        if (i == 0 || levelKey(keyed[i].key, level) != levelKey(keyed[i - 1].key, level))
+            ++runs;
+    return runs;
+}
+
+}
+
+LodHierarchy buildLodHierarchy(std::span<const glm::vec4> spheres, std::span<const glm::uvec2> groups) {
+    LodHierarchy hierarchy;
+    if (spheres.empty())
+        return hierarchy;
+
+    const float meanRadius = jobs::transformReduce(spheres.size(), 0.f, std::plus<>{},
+        [&](std::size_t i){ return spheres[i].w; }) / static_cast<float>(spheres.size());
+    const float baseCell = std::max(meanRadius * BASE_CELL_RADII, 1e-6f);
+    for (std::size_t level{1}; level < LOD_LEVELS; ++level)
+        hierarchy.cellSizes[static_cast<int>(level)] = baseCell * static_cast<float>(1u << (level - 1));
+
+    std::vector<KeyedSphere> keyed;
+    for (const auto& group : groups) {
+        const auto groupSpheres = spheres.subspan(group.x, group.y);
+        const auto firstCluster = static_cast<glm::uint>(hierarchy.clusters.size());
+        if (groupSpheres.empty()) {
+            hierarchy.groupClusters.emplace_back(firstCluster, 0u);
+            continue;
+        }
+
+        // Sort by the Morton code of the base cell, which groups the spheres of every cell of every level
+        constexpr auto inf = std::numeric_limits<float>::max();
+        glm::vec3 lo{inf};
+        for (const auto& s : groupSpheres)
+            lo = glm::min(lo, glm::vec3{s});
+        keyed.resize(groupSpheres.size());
+        parallelFor(groupSpheres.size(), [&](std::size_t begin, std::size_t end){
+            for (auto i{begin}; i < end; ++i) {
+                const auto cell = glm::clamp((glm::vec3{groupSpheres[i]} - lo) / baseCell, glm::vec3{0.f}, glm::vec3{MAX_CELL});
+                keyed[i] = {mortonCode(glm::uvec3{cell}), group.x + static_cast<glm::uint>(i)};
+            }
+        });
+        jobs::parallelSort(keyed.begin(), keyed.end(), [](const KeyedSphere& a, const KeyedSphere& b){
+            return a.key < b.key || (a.key == b.key && a.index < b.index);
+        });
+
+        // Clusters are runs of equal coarsest level keys. Their sphere counts per level give the output offsets.
+        std::vector<std::size_t> clusterStarts;
+        for (std::size_t i{0}; i < keyed.size(); ++i)
+            if (i == 0 || levelKey(keyed[i].key, LOD_LEVELS - 1) != levelKey(keyed[i - 1].key, LOD_LEVELS - 1))
+                clusterStarts.push_back(i);
+        clusterStarts.push_back(keyed.size());
+        const auto clusterCount = clusterStarts.size() - 1;
+
+        std::vector<LodCluster> clusters(clusterCount);
+        parallelFor(clusterCount, [&](std::size_t begin, std::size_t end){
+            for (auto c{begin}; c < end; ++c) {
+                const auto cluster = std::span{keyed}.subspan(clusterStarts[c], clusterStarts[c + 1] - clusterStarts[c]);
+                clusters[c].count[0] = static_cast<glm::uint>(cluster.size());
+                for (std::size_t level{1}; level < LOD_LEVELS; ++level)
+                    clusters[c].count[static_cast<int>(level)] = static_cast<glm::uint>(countRuns(cluster, level));
+            }
+        }, 64);
+
+        auto sphereOffset = static_cast<glm::uint>(hierarchy.spheres.size());
+        for (std::size_t c{0}; c < clusterCount; ++c) {
+            clusters[c].first[0] = static_cast<glm::uint>(hierarchy.leafIndices.size() + clusterStarts[c]);
+            for (std::size_t level{1}; level < LOD_LEVELS; ++level) {
+                clusters[c].first[static_cast<int>(level)] = sphereOffset;
+                sphereOffset += clusters[c].count[static_cast<int>(level)];
+            }
+        }
+        const auto leafOffset = hierarchy.leafIndices.size();
+        hierarchy.leafIndices.resize(leafOffset + keyed.size());
+        hierarchy.spheres.resize(sphereOffset);
+
+        parallelFor(clusterCount, [&](std::size_t begin, std::size_t end){
+            for (auto c{begin}; c < end; ++c) {
+                const auto cluster = std::span{keyed}.subspan(clusterStarts[c], clusterStarts[c + 1] - clusterStarts[c]);
+                auto& out = clusters[c];
+
+                glm::vec3 boxLo{inf}, boxHi{-inf};
+                float maxRadius{0.f};
+                for (std::size_t i{0}; i < cluster.size(); ++i) {
+                    const auto& s = spheres[cluster[i].index];
+                    hierarchy.leafIndices[leafOffset + clusterStarts[c] + i] = cluster[i].index;
+                    boxLo = glm::min(boxLo, glm::vec3{s});
+                    boxHi = glm::max(boxHi, glm::vec3{s});
+                    maxRadius = std::max(maxRadius, s.w);
+                }
+
+                // Merge every run of equal keys of every level
+                for (std::size_t level{1}; level < LOD_LEVELS; ++level) {
+                    auto next = out.first[static_cast<int>(level)];
+                    std::size_t runStart{0};
+                    for (std::size_t i{1}; i <= cluster.size(); ++i) {
+                        if (i < cluster.size() && levelKey(cluster[i].key, level) == levelKey(cluster[runStart].key, level))
+                            continue;
+                        const auto merged = mergeSpheres(spheres, cluster.subspan(runStart, i - runStart));
+                        hierarchy.spheres[next++] = merged;
+                        maxRadius = std::max(maxRadius, merged.w);
+                        runStart = i;
+                    }
+                }
+
+                // Merged centers are weighted averages, so they stay within the sphere around the leaf centers
+                const auto center = (boxLo + boxHi) * 0.5f;
+                float centerDistance{0.f};
+                for (const auto& k : cluster)
+                    centerDistance = std::max(centerDistance, glm::distance(center, glm::vec3{spheres[k.index]}));
+                out.bounds = glm::vec4{center, centerDistance};
+                out.maxRadius = maxRadius;
+            }
+        }, 64);
+
+        hierarchy.groupClusters.emplace_back(firstCluster, static_cast<glm::uint>(clusterCount));
+        hierarchy.clusters.insert(hierarchy.clusters.end(), clusters.begin(), clusters.end());
+    }
+
+    return hierarchy;
+}
+
+}
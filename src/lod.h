@@ -0,0 +1,48 @@
+#ifndef LOD_H
+#define LOD_H
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <span>
+#include <cstddef>
+
+namespace util {
+
+// Levels of detail, including the scene spheres themselves as level 0. Matches the uvec4s of LodCluster.
+constexpr std::size_t LOD_LEVELS = 4;
+
+// Layout read by lod.comp.glsl. Level 0 ranges index LodHierarchy::leafIndices, the coarser levels LodHierarchy::spheres.
+struct LodCluster {
+    // xyz = center, w = distance to the farthest sphere center
+    glm::vec4 bounds;
+    glm::uvec4 first;
+    glm::uvec4 count;
+    // Largest radius in the cluster at any level, so bounds.w plus this bounds every sphere
+    float maxRadius;
+    float padding[3];
+};
+
+/**
+ * @brief Coarser versions of the scene, made by merging the spheres in the cells of an octree into one sphere per cell.
+ * Cells of level l are 2^(l-1) base cells wide, and the cells of the coarsest level are the clusters a level is picked for,
+ * so every cluster is a single sphere at the coarsest level. Clusters never span render groups.
+ */
+struct LodHierarchy {
+    std::vector<glm::vec4> spheres;
+    std::vector<LodCluster> clusters;
+    // Scene indices of the spheres of every cluster
+    std::vector<glm::uint> leafIndices;
+    // First cluster and cluster count of every render group
+    std::vector<glm::uvec2> groupClusters;
+    // Cell size of every level (level 0 has no cells)
+    glm::vec4 cellSizes{0.f};
+};
+
+// Builds the hierarchy of the given spheres, with render groups given as (first, count) ranges.
+// Merged spheres keep the volume of the spheres they replace and sit at their volume weighted center.
+LodHierarchy buildLodHierarchy(std::span<const glm::vec4> spheres, std::span<const glm::uvec2> groups);
+
+}
+
+#endif // LOD_H
@@ -21,6 +21,7 @@
 #include "scene.h"
 #include "settings.h"
 #include "camera.h"
+#include "benchmarks.h"
 
 template <std::size_t I>
 std::string enumToString(GLenum arg, const std::array<std::pair<GLenum, std::string>, I>& params)
@@ -69,7 +70,7 @@ void showFPS(GLFWwindow* window)
 using namespace util;
 using namespace comp;
 
-int main()
+int main(int argc, char* argv[])
 {
     Timer appTimer{};
     std::srand(std::time(nullptr));
@@ -186,7 +187,11 @@ int main()
     {
         // uncomment this call to draw in wireframe polygons.
         //glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-        auto scene = Scene{};
+        // Optional scene file as first argument
+        auto scene = Scene{
+            1 < argc ? std::filesystem::path{argv[1]} : std::filesystem::path{},
+            2 < argc ? std::filesystem::path{argv[2]} : std::filesystem::path{}
+        };
 
         // Static wrapper ptr to scene, to get around static functions
         static auto scenePtr = &scene;
@@ -257,6 +262,7 @@ int main()
             // render
             // ------
             scene.render(deltaTime);
+            bench::menu();
 
             // ImGui render UI:
             ImGui::EndMainMenuBar();
@@ -0,0 +1,444 @@
+#include "molecule.h"
+#include "utils.h"
+#include "jobs.h"
+
+#include <iostream>
+#include <format>
+#include <algorithm>
+#include <numeric>
+#include <unordered_map>
+#include <charconv>
+#include <cctype>
+#include <limits>
+
+namespace io {
+
+namespace {
+
+enum class Format { PDB, CIF, XYZ };
+
+// Consecutive atoms of one chain
+struct ChainRun {
+    std::string chain;
+    std::uint32_t count{0};
+};
+
+// Atoms parsed from one chunk of the file, in file order
+struct Chunk {
+    std::vector<glm::vec4> atoms;
+    std::vector<ChainRun> runs;
+
+    void add(const glm::vec4& atom, std::string_view chain) {
+        if (runs.empty() || runs.back().chain != chain)
+            runs.push_back({std::string{chain}, 0});
+        ++runs.back().count;
+        atoms.push_back(atom);
+    }
+};
+
+// Bondi (1964), with the usual additions for metals found in structure files: Mantina et al. (2009) for Ca,
+// Alvarez (2013) for Mn, Fe and Co
+const std::unordered_map<std::string_view, float> BONDI_RADII{
+    {"H", 1.20f}, {"He", 1.40f}, {"Li", 1.82f}, {"C", 1.70f}, {"N", 1.55f}, {"O", 1.52f}, {"F", 1.47f}, {"Ne", 1.54f},
+    {"Na", 2.27f}, {"Mg", 1.73f}, {"Si", 2.10f}, {"P", 1.80f}, {"S", 1.80f}, {"Cl", 1.75f}, {"Ar", 1.88f},
+    {"K", 2.75f}, {"Ca", 2.31f}, {"Mn", 2.45f}, {"Fe", 2.44f}, {"Co", 2.40f}, {"Ni", 1.63f}, {"Cu", 1.40f}, {"Zn", 1.39f}, {"Ga", 1.87f}, {"As", 1.85f}, {"Se", 1.90f},
+    {"Br", 1.85f}, {"Kr", 2.02f}, {"Pd", 1.63f}, {"Ag", 1.72f}, {"Cd", 1.58f}, {"In", 1.93f}, {"Sn", 2.17f},
+    {"Te", 2.06f}, {"I", 1.98f}, {"Xe", 2.16f}, {"Pt", 1.72f}, {"Au", 1.66f}, {"Hg", 1.55f}, {"Tl", 1.96f},
+    {"Pb", 2.02f}, {"U", 1.86f}
+};
+constexpr float DEFAULT_RADIUS = 1.80f;
+
+// Aim for chunks of about this many bytes, so small files don't pay for threads
+constexpr std::size_t CHUNK_BYTES = 1u << 20;
+
+std::string_view trim(std::string_view s) {
+    const auto first = s.find_first_not_of(" \t\r");
+    if (first == std::string_view::npos)
+        return {};
+    return s.substr(first, s.find_last_not_of(" \t\r") - first + 1);
+}
+
+bool parseFloat(std::string_view s, float& value) {
+    s = trim(s);
+    if (!s.empty() && s.front() == '+')
+        s.remove_prefix(1);
+    const auto [end, error] = std::from_chars(s.data(), s.data() + s.size(), value);
+    return error == std::errc{} && end == s.data() + s.size();
+}
+
+// "CL", "cl" and "Cl" are all chlorine
+std::optional<float> findRadius(std::string_view element) {
+    element = trim(element);
+    if (element.empty() || 2 < element.size())
+        return std::nullopt;
+    char symbol[2]{static_cast<char>(std::toupper(static_cast<unsigned char>(element[0]))), 0};
+    if (element.size() == 2)
+        symbol[1] = static_cast<char>(std::tolower(static_cast<unsigned char>(element[1])));
+    const auto it = BONDI_RADII.find(std::string_view{symbol, element.size()});
+    return it != BONDI_RADII.end() ? std::optional{it->second} : std::nullopt;
+}
+
+template<typename F>
+void forEachLine(std::string_view text, F&& f) {
+    while (!text.empty()) {
+        const auto end = text.find('\n');
+        f(text.substr(0, end));
+        if (end == std::string_view::npos)
+            break;
+        text.remove_prefix(end + 1);
+    }
+}
+
+// Splits text into about text.size() / CHUNK_BYTES pieces that start and end on line boundaries
+std::vector<std::string_view> splitLines(std::string_view text) {
+    const std::size_t maxChunks = jobs::Scheduler::global().threadCount() * 4;
+    const std::size_t chunkCount = std::clamp<std::size_t>(text.size() / CHUNK_BYTES, 1, maxChunks);
+
+    std::vector<std::string_view> chunks;
+    std::size_t begin{0};
+    for (std::size_t c{1}; c <= chunkCount && begin < text.size(); ++c) {
+        auto end = c == chunkCount ? text.size() : std::max(begin, c * text.size() / chunkCount);
+        if (end < text.size()) {
+            end = text.find('\n', end);
+            end = end == std::string_view::npos ? text.size() : end + 1;
+        }
+        chunks.push_back(text.substr(begin, end - begin));
+        begin = end;
+    }
+    return chunks;
+}
+
+// Parses the chunks of text in parallel
+template<typename F>
+std::vector<Chunk> parseChunks(std::string_view text, F&& parseLine) {
+    const auto pieces = splitLines(text);
+    std::vector<Chunk> chunks(pieces.size());
+    util::parallelFor(pieces.size(), [&](std::size_t begin, std::size_t end){
+        for (auto c{begin}; c < end; ++c)
+            forEachLine(pieces[c], [&](std::string_view line){ parseLine(line, chunks[c]); });
+    }, 1);
+    return chunks;
+}
+
+// PDB atom names are aligned so that one letter elements start in the second column,
+// which tells them apart from two letter elements when the element columns are missing.
+// Four character names can't be aligned that way, and are almost always hydrogens (e.g. HG21, HD11).
+// Anything else starting in the first column is a two letter element, unknown ones get the default radius
+// rather than that of their first letter ("FE" isn't fluorine).
+std::string_view elementFromAtomName(std::string_view name) {
+    if (name.size() < 2)
+        return name;
+    if (name[0] == ' ' || std::isdigit(static_cast<unsigned char>(name[0])))
+        return name.substr(1, 1);
+    if (name.size() == 4 && name[0] == 'H' && name.find(' ') == std::string_view::npos)
+        return name.substr(0, 1);
+    return name.substr(0, 2);
+}
+
+std::optional<std::vector<Chunk>> parsePdb(std::string_view text) {
+    // Only the first model of multi-model (e.g. NMR) files
+    if (const auto end = text.find("\nENDMDL"); end != std::string_view::npos)
+        text = text.substr(0, end + 1);
+
+    return parseChunks(text, [](std::string_view line, Chunk& chunk){
+        // Columns from the PDB format 3.3 specification, 0-based
+        if (line.size() < 54 || !(line.starts_with("ATOM  ") || line.starts_with("HETATM")))
+            return;
+        // Keep only the first alternate location
+        if (line[16] != ' ' && line[16] != 'A')
+            return;
+
+        glm::vec4 atom;
+        if (!parseFloat(line.substr(30, 8), atom.x) || !parseFloat(line.substr(38, 8), atom.y) || !parseFloat(line.substr(46, 8), atom.z))
+            return;
+
+        auto element = 78 <= line.size() ? trim(line.substr(76, 2)) : std::string_view{};
+        if (element.empty())
+            element = elementFromAtomName(line.substr(12, 4));
+        atom.w = vdwRadius(element);
+
+        chunk.add(atom, line.substr(21, 1));
+    });
+}
+
+// Whitespace separated mmCIF value, possibly quoted. Quotes only end when followed by whitespace, as in "O5'".
+std::string_view nextToken(std::string_view& line) {
+    const auto first = line.find_first_not_of(" \t\r");
+    if (first == std::string_view::npos) {
+        line = {};
+        return {};
+    }
+    line.remove_prefix(first);
+
+    if (line[0] == '\'' || line[0] == '"') {
+        const char quote = line[0];
+        for (std::size_t i{1}; i < line.size(); ++i) {
+            if (line[i] == quote && (i + 1 == line.size() || std::isspace(static_cast<unsigned char>(line[i + 1])))) {
+                const auto token = line.substr(1, i - 1);
+                line.remove_prefix(i + 1);
+                return token;
+            }
+        }
+    }
+
+    const auto end = std::min(line.find_first_of(" \t\r"), line.size());
+    const auto token = line.substr(0, end);
+    line.remove_prefix(end);
+    return token;
+}
+
+std::optional<std::vector<Chunk>> parseCif(std::string_view text) {
+    // Find the _atom_site loop and its column layout
+    std::size_t position = 0;
+    std::vector<std::string_view> columns;
+    for (;;) {
+        position = text.find("\nloop_", position);
+        if (position == std::string_view::npos)
+            return std::nullopt;
+        position = text.find('\n', position + 1);
+        if (position == std::string_view::npos)
+            return std::nullopt;
+        if (text.substr(++position).starts_with("_atom_site."))
+            break;
+    }
+    while (position < text.size() && text.substr(position).starts_with("_atom_site.")) {
+        const auto end = std::min(text.find('\n', position), text.size());
+        columns.push_back(trim(text.substr(position + 11, end - position - 11)));
+        position = end + 1;
+    }
+
+    const auto column = [&](std::string_view name){
+        const auto it = std::find(columns.begin(), columns.end(), name);
+        return it != columns.end() ? static_cast<int>(it - columns.begin()) : -1;
+    };
+    const int x = column("Cartn_x"), y = column("Cartn_y"), z = column("Cartn_z");
+    const int element = column("type_symbol");
+    const int chain = column("auth_asym_id") != -1 ? column("auth_asym_id") : column("label_asym_id");
+    const int model = column("pdbx_PDB_model_num");
+    const int altLoc = column("label_alt_id");
+    if (x == -1 || y == -1 || z == -1 || element == -1)
+        return std::nullopt;
+
+    // The loop's rows end at the next category, loop or data block
+    auto end = text.size();
+    for (const auto terminator : {"\n#", "\nloop_", "\n_", "\ndata_"})
+        end = std::min(end, text.find(terminator, position));
+    const auto rows = text.substr(std::min(position, text.size()), end - std::min(position, end));
+
+    // Split a row into its values. Atom site rows always fit on one line.
+    const auto columnCount = columns.size();
+    const auto tokenize = [columnCount](std::string_view line, std::vector<std::string_view>& values){
+        values.clear();
+        while (values.size() < columnCount) {
+            const auto token = nextToken(line);
+            if (token.empty() && line.empty())
+                break;
+            values.push_back(token);
+        }
+        return values.size() == columnCount;
+    };
+
+    // Only the first model of multi-model files
+    std::string firstModel;
+    if (model != -1) {
+        std::vector<std::string_view> values;
+        if (tokenize(rows.substr(0, rows.find('\n')), values))
+            firstModel = values[model];
+    }
+
+    return parseChunks(rows, [&](std::string_view line, Chunk& chunk){
+        thread_local std::vector<std::string_view> values;
+        if (!tokenize(line, values))
+            return;
+        if (model != -1 && values[model] != firstModel)
+            return;
+        if (altLoc != -1 && values[altLoc] != "." && values[altLoc] != "A")
+            return;
+
+        glm::vec4 atom;
+        if (!parseFloat(values[x], atom.x) || !parseFloat(values[y], atom.y) || !parseFloat(values[z], atom.z))
+            return;
+        atom.w = vdwRadius(values[element]);
+
+        chunk.add(atom, chain != -1 ? values[chain] : std::string_view{});
+    });
+}
+
+std::optional<std::vector<Chunk>> parseXyz(std::string_view text) {
+    // Atom count, comment line, then one atom per line. Later frames are ignored.
+    std::size_t atomCount{0};
+    const auto countLine = trim(text.substr(0, text.find('\n')));
+    if (std::from_chars(countLine.data(), countLine.data() + countLine.size(), atomCount).ec != std::errc{})
+        return std::nullopt;
+
+    std::size_t begin{0};
+    for (int i = 0; i < 2; ++i) {
+        begin = text.find('\n', begin);
+        if (begin == std::string_view::npos)
+            return std::nullopt;
+        ++begin;
+    }
+    auto end = begin;
+    for (std::size_t i{0}; i < atomCount && end < text.size(); ++i) {
+        end = text.find('\n', end);
+        end = end == std::string_view::npos ? text.size() : end + 1;
+    }
+
+    return parseChunks(text.substr(begin, end - begin), [](std::string_view line, Chunk& chunk){
+        const auto element = nextToken(line);
+        glm::vec4 atom;
+        if (!parseFloat(nextToken(line), atom.x) || !parseFloat(nextToken(line), atom.y) || !parseFloat(nextToken(line), atom.z))
+            return;
+        atom.w = vdwRadius(element);
+        chunk.add(atom, {});
+    });
+}
+
+// Concatenates the chunks into one array grouped by chain. Chains are numbered in order of first appearance
+// and alternate between LOD 0 and 1, then groups are laid out by LOD, so each render group stays one range.
+Molecule assemble(std::vector<Chunk>& chunks) {
+    Molecule molecule;
+
+    std::unordered_map<std::string, std::uint32_t> chainIds;
+    std::vector<std::uint32_t> chainSizes;
+    std::vector<std::vector<std::uint32_t>> runChains(chunks.size());
+    for (std::size_t c{0}; c < chunks.size(); ++c) {
+        for (const auto& run : chunks[c].runs) {
+            const auto [it, bNew] = chainIds.try_emplace(run.chain, static_cast<std::uint32_t>(chainSizes.size()));
+            if (bNew) {
+                chainSizes.push_back(0);
+                molecule.groupNames.push_back(run.chain);
+            }
+            chainSizes[it->second] += run.count;
+            runChains[c].push_back(it->second);
+        }
+    }
+
+    std::vector<std::uint32_t> layout(chainSizes.size());
+    std::iota(layout.begin(), layout.end(), 0u);
+    std::stable_partition(layout.begin(), layout.end(), [](std::uint32_t chain){ return chain % 2 == 0; });
+
+    std::vector<std::uint32_t> chainStart(chainSizes.size());
+    std::uint32_t offset{0};
+    std::vector<std::string> names;
+    for (const auto chain : layout) {
+        chainStart[chain] = offset;
+        molecule.groups.push_back({offset, chainSizes[chain], chain % 2, 0u});
+        names.push_back(molecule.groupNames[chain]);
+        offset += chainSizes[chain];
+    }
+    molecule.groupNames = std::move(names);
+
+    // Destination of every run, so chunks can be copied independently
+    std::vector<std::vector<std::uint32_t>> runStart(chunks.size());
+    auto cursor = chainStart;
+    for (std::size_t c{0}; c < chunks.size(); ++c) {
+        for (std::size_t r{0}; r < chunks[c].runs.size(); ++r) {
+            runStart[c].push_back(cursor[runChains[c][r]]);
+            cursor[runChains[c][r]] += chunks[c].runs[r].count;
+        }
+    }
+
+    molecule.spheres.resize(offset);
+    util::parallelFor(chunks.size(), [&](std::size_t begin, std::size_t end){
+        for (auto c{begin}; c < end; ++c) {
+            auto source = chunks[c].atoms.begin();
+            for (std::size_t r{0}; r < chunks[c].runs.size(); ++r) {
+                const auto count = chunks[c].runs[r].count;
+                std::copy(source, source + count, molecule.spheres.begin() + runStart[c][r]);
+                source += count;
+            }
+            chunks[c] = {};
+        }
+    }, 1);
+
+    return molecule;
+}
+
+}
+
+float vdwRadius(std::string_view element) {
+    return findRadius(element).value_or(DEFAULT_RADIUS);
+}
+
+bool isMoleculeFile(const std::filesystem::path& path) {
+    const auto extension = path.extension();
+    for (const auto* known : {".pdb", ".ent", ".cif", ".mmcif", ".xyz"})
+        if (extension == known)
+            return true;
+    return false;
+}
+
+std::optional<Molecule> loadMolecule(const std::filesystem::path& path) {
+    const auto extension = path.extension();
+    Format format;
+    if (extension == ".pdb" || extension == ".ent")
+        format = Format::PDB;
+    else if (extension == ".cif" || extension == ".mmcif")
+        format = Format::CIF;
+    else if (extension == ".xyz")
+        format = Format::XYZ;
+    else {
+        std::cout << std::format("MOLECULE ERROR: \"{}\": unknown extension", path.string()) << std::endl;
+        return std::nullopt;
+    }
+
+    const auto mapped = MappedFile::open(path);
+    if (!mapped) {
+        std::cout << std::format("MOLECULE ERROR: Could not map \"{}\".", path.string()) << std::endl;
+        return std::nullopt;
+    }
+    const std::string_view text{reinterpret_cast<const char*>(mapped->data()), mapped->size()};
+
+    std::optional<std::vector<Chunk>> chunks;
+    switch (format) {
+        case Format::PDB: chunks = parsePdb(text); break;
+        case Format::CIF: chunks = parseCif(text); break;
+        case Format::XYZ: chunks = parseXyz(text); break;
+    }
+    if (!chunks) {
+        std::cout << std::format("MOLECULE ERROR: \"{}\": malformed file", path.string()) << std::endl;
+        return std::nullopt;
+    }
+
+    std::size_t atomCount{0};
+    for (const auto& chunk : *chunks)
+        atomCount += chunk.atoms.size();
+    if (atomCount == 0) {
+        std::cout << std::format("MOLECULE ERROR: \"{}\": no atoms", path.string()) << std::endl;
+        return std::nullopt;
+    }
+    if (std::numeric_limits<std::uint32_t>::max() < atomCount) {
+        std::cout << std::format("MOLECULE ERROR: \"{}\": too many atoms", path.string()) << std::endl;
+        return std::nullopt;
+    }
+
+    return assemble(*chunks);
+}
+
+void normalizeMolecule(Molecule& molecule, float radius) {
+    auto& spheres = molecule.spheres;
+    if (spheres.empty())
+        return;
+
+    using Bounds = std::pair<glm::vec3, glm::vec3>;
+    const auto [lo, hi] = jobs::transformReduce(spheres.size(),
+        Bounds{glm::vec3{std::numeric_limits<float>::max()}, glm::vec3{std::numeric_limits<float>::lowest()}},
+        [](const Bounds& a, const Bounds& b){ return Bounds{glm::min(a.first, b.first), glm::max(a.second, b.second)}; },
+        [&](std::size_t i){ return Bounds{glm::vec3{spheres[i]} - spheres[i].w, glm::vec3{spheres[i]} + spheres[i].w}; }
+    );
+    const auto center = 0.5f * (lo + hi);
+
+    const float extent = jobs::transformReduce(spheres.size(), 0.f,
+        [](float a, float b){ return std::max(a, b); },
+        [&](std::size_t i){ return glm::length(glm::vec3{spheres[i]} - center) + spheres[i].w; }
+    );
+    const float scale = radius / std::max(extent, 1e-6f);
+
+    util::parallelFor(spheres.size(), [&](std::size_t begin, std::size_t end){
+        for (auto i{begin}; i < end; ++i)
+            spheres[i] = glm::vec4{(glm::vec3{spheres[i]} - center) * scale, spheres[i].w * scale};
+    });
+}
+
+}
@@ -0,0 +1,44 @@
+#ifndef MOLECULE_H
+#define MOLECULE_H
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <string>
+#include <string_view>
+#include <optional>
+#include <filesystem>
+
+#include "scenefile.h"
+
+namespace io {
+
+/**
+ * @brief Atoms of a molecule as spheres, in scene buffer order.
+ * Every chain becomes one group. Chains alternate between the two render groups (LOD 0 and 1),
+ * so neighbouring chains are blended as separate surfaces.
+ */
+struct Molecule {
+    // xyz = position, w = van der Waals radius, in Ångström or normalized scene units
+    std::vector<glm::vec4> spheres;
+    std::vector<SceneGroup> groups;
+    // Chain identifier of each group
+    std::vector<std::string> groupNames;
+};
+
+// Bondi van der Waals radius in Ångström. Element symbols are case insensitive.
+float vdwRadius(std::string_view element);
+
+// True for the extensions loadMolecule understands
+bool isMoleculeFile(const std::filesystem::path& path);
+
+// Parses a PDB (.pdb, .ent), mmCIF (.cif, .mmcif) or XYZ (.xyz) file, picked by extension. Only the first model is read.
+// The file is parsed in parallel, in chunks split on line boundaries.
+std::optional<Molecule> loadMolecule(const std::filesystem::path& path);
+
+// Centers the molecule on its bounding box and scales it (radii included) to fit in a sphere of the given radius.
+void normalizeMolecule(Molecule& molecule, float radius = 0.5f);
+
+}
+
+#endif // MOLECULE_H
@@ -0,0 +1,28 @@
+#ifndef MORTON_H
+#define MORTON_H
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+
+namespace util {
+
+// Spreads the lower 21 bits of v so that there are two zero bits between each bit.
+inline std::uint64_t expandBits(std::uint64_t v) {
+    v &= 0x1fffff;
+    v = (v | v << 32) & 0x1f00000000ffff;
+    v = (v | v << 16) & 0x1f0000ff0000ff;
+    v = (v | v << 8) & 0x100f00f00f00f00f;
+    v = (v | v << 4) & 0x10c30c30c30c30c3;
+    v = (v | v << 2) & 0x1249249249249249;
+    return v;
+}
+
+// Interleaves the lower 21 bits of the cell coordinates (x highest). Dropping the lowest 3n bits gives the code of the cell n levels up.
+inline std::uint64_t mortonCode(glm::uvec3 cell) {
+    return expandBits(cell.x) << 2 | expandBits(cell.y) << 1 | expandBits(cell.z);
+}
+
+}
+
+#endif // MORTON_H
@@ -0,0 +1,274 @@
+#include "nbody.h"
+#include "utils.h"
+#include "morton.h"
+#include "jobs.h"
+
+#include <algorithm>
+#include <numeric>
+#include <limits>
+
+namespace sim {
+
+static std::uint64_t mortonCode(glm::vec3 p, glm::vec3 min, float invSize) {
+    constexpr float cells = static_cast<float>(1u << Octree::MAX_DEPTH);
+    const auto c = glm::clamp((p - min) * invSize * cells, glm::vec3{0.f}, glm::vec3{cells - 1.f});
+    return util::mortonCode(glm::uvec3{c});
+}
+
+// Octant of a code at a given tree level (level 0 is the root split)
+static std::uint32_t octant(std::uint64_t code, std::uint32_t level) {
+    return static_cast<std::uint32_t>(code >> (3 * (Octree::MAX_DEPTH - 1 - level))) & 7u;
+}
+
+void Octree::build(std::span<const glm::vec4> points) {
+    const auto n = static_cast<std::uint32_t>(points.size());
+    nodes.clear();
+    if (n == 0)
+        return;
+
+    // Bounding cube:
+    constexpr auto inf = std::numeric_limits<float>::max();
+    using Bounds = std::pair<glm::vec3, glm::vec3>;
+    const auto [bmin, bmax] = jobs::transformReduce(points.size(), Bounds{glm::vec3{inf}, glm::vec3{-inf}},
+        [](const Bounds& a, const Bounds& b){ return Bounds{glm::min(a.first, b.first), glm::max(a.second, b.second)}; },
+        [&](std::size_t i){ return Bounds{glm::vec3{points[i]}, glm::vec3{points[i]}}; }
+    );
+    const auto extent = bmax - bmin;
+    const float size = std::max(std::max(extent.x, extent.y), std::max(extent.z, 1e-6f)) * 1.0001f;
+    const float invSize = 1.f / size;
+
+    // Sort bodies along Morton curve:
+    codes.resize(n);
+    order.resize(n);
+    bodies.resize(n);
+    util::parallelFor(n, [&](std::size_t begin, std::size_t end){
+        for (auto i{begin}; i < end; ++i)
+            codes[i] = mortonCode(glm::vec3{points[i]}, bmin, invSize);
+    });
+    std::iota(order.begin(), order.end(), 0u);
+    jobs::parallelSort(order.begin(), order.end(), [&](auto a, auto b){ return codes[a] < codes[b]; });
+
+    // Reorder codes along with the bodies
+    std::vector<std::uint64_t> sortedCodes(n);
+    util::parallelFor(n, [&](std::size_t begin, std::size_t end){
+        for (auto i{begin}; i < end; ++i) {
+            bodies[i] = points[order[i]];
+            sortedCodes[i] = codes[order[i]];
+        }
+    });
+    codes = std::move(sortedCodes);
+
+    nodes = buildSubtree(0, n, 0, bmin + glm::vec3{size * 0.5f}, size * 0.5f);
+}
+
+std::vector<Octree::Node> Octree::buildSubtree(std::uint32_t first, std::uint32_t count, std::uint32_t level, glm::vec3 center, float halfSize) const {
+    // Subtrees below this body count (or depth) are built serially in one task
+    constexpr std::uint32_t PARALLEL_THRESHOLD = 8192;
+    constexpr std::uint32_t PARALLEL_DEPTH = 2;
+
+    std::vector<Node> list;
+    list.push_back(Node{.center = center, .halfSize = halfSize, .first = first, .count = count});
+
+    if (count <= PARALLEL_THRESHOLD || PARALLEL_DEPTH <= level || count <= LEAF_SIZE) {
+        buildNode(list, 0, level);
+        return list;
+    }
+
+    // Split into octants and build each child subtree as a separate task:
+    const auto codeBegin = codes.begin() + first;
+    const auto codeEnd = codeBegin + count;
+    std::array<std::vector<Node>, 8> subtrees;
+    std::array<std::pair<std::uint32_t, std::uint32_t>, 8> ranges;
+    auto it = codeBegin;
+    for (std::uint32_t o{0}; o < 8; ++o) {
+        auto next = std::partition_point(it, codeEnd, [&](std::uint64_t c){ return octant(c, level) <= o; });
+        ranges[o] = {static_cast<std::uint32_t>(it - codes.begin()), static_cast<std::uint32_t>(next - it)};
+        it = next;
+    }
+
+    jobs::parallelFor(8, [&](std::size_t begin, std::size_t end){
+        for (auto o{begin}; o < end; ++o) {
+            const auto [childFirst, childCount] = ranges[o];
+            if (childCount == 0)
+                continue;
+            const auto offset = glm::vec3{o & 4u ? 1.f : -1.f, o & 2u ? 1.f : -1.f, o & 1u ? 1.f : -1.f} * (halfSize * 0.5f);
+            subtrees[o] = buildSubtree(childFirst, childCount, level + 1, center + offset, halfSize * 0.5f);
+        }
+    }, 1);
+
+    // Merge: children roots first (contiguous), then the rest of each subtree
+    const auto childCount = static_cast<std::uint32_t>(std::ranges::count_if(subtrees, [](const auto& s){ return !s.empty(); }));
+    list[0].firstChild = 1;
+    list[0].childCount = childCount;
+    list.resize(1 + childCount);
+    std::uint32_t slot{1};
+    for (auto& subtree : subtrees) {
+        if (subtree.empty())
+            continue;
+        // Local indices of the subtree (except root, index 0) are moved to the end of the list
+        const auto offset = static_cast<std::uint32_t>(list.size()) - 1;
+        for (auto& node : subtree)
+            if (!node.leaf())
+                node.firstChild += offset;
+        list[slot++] = subtree.front();
+        list.insert(list.end(), subtree.begin() + 1, subtree.end());
+    }
+
+    computeMoments(list, 0, bodies);
+    return list;
+}
+
+void Octree::buildNode(std::vector<Node>& list, std::uint32_t index, std::uint32_t level) const {
+    const auto [first, count] = std::make_pair(list[index].first, list[index].count);
+
+    if (LEAF_SIZE < count && level < MAX_DEPTH) {
+        const auto center = list[index].center;
+        const auto halfSize = list[index].halfSize;
+        const auto firstChild = static_cast<std::uint32_t>(list.size());
+        const auto codeEnd = codes.begin() + first + count;
+        auto it = codes.begin() + first;
+
+        for (std::uint32_t o{0}; o < 8 && it != codeEnd; ++o) {
+            auto next = std::partition_point(it, codeEnd, [&](std::uint64_t c){ return octant(c, level) <= o; });
+            if (next == it)
+                continue;
+            const auto offset = glm::vec3{o & 4u ? 1.f : -1.f, o & 2u ? 1.f : -1.f, o & 1u ? 1.f : -1.f} * (halfSize * 0.5f);
+            list.push_back(Node{
+                .center = center + offset,
+                .halfSize = halfSize * 0.5f,
+                .first = static_cast<std::uint32_t>(it - codes.begin()),
+                .count = static_cast<std::uint32_t>(next - it)
+            });
+            it = next;
+        }
+
+        const auto childCount = static_cast<std::uint32_t>(list.size()) - firstChild;
+        list[index].firstChild = firstChild;
+        list[index].childCount = childCount;
+        for (std::uint32_t c{0}; c < childCount; ++c)
+            buildNode(list, firstChild + c, level + 1);
+    }
+
+    computeMoments(list, index, bodies);
+}
+
+// Adds the quadrupole contribution of a point mass at offset d to q
+static void addQuadrupole(std::array<float, 6>& q, glm::vec3 d, float m) {
+    const float d2 = glm::dot(d, d);
+    q[0] += m * (3.f * d.x * d.x - d2);
+    q[1] += m * (3.f * d.y * d.y - d2);
+    q[2] += m * (3.f * d.z * d.z - d2);
+    q[3] += m * 3.f * d.x * d.y;
+    q[4] += m * 3.f * d.x * d.z;
+    q[5] += m * 3.f * d.y * d.z;
+}
+
+void Octree::computeMoments(std::vector<Node>& list, std::uint32_t index, std::span<const glm::vec4> sortedBodies) {
+    auto& node = list[index];
+    node.mass = 0.f;
+    node.quadrupole = {};
+    glm::vec3 weighted{0.f};
+
+    if (node.leaf()) {
+        for (auto i{node.first}; i < node.first + node.count; ++i) {
+            weighted += glm::vec3{sortedBodies[i]} * sortedBodies[i].w;
+            node.mass += sortedBodies[i].w;
+        }
+        node.centerOfMass = 0.f < node.mass ? weighted / node.mass : node.center;
+        for (auto i{node.first}; i < node.first + node.count; ++i)
+            addQuadrupole(node.quadrupole, glm::vec3{sortedBodies[i]} - node.centerOfMass, sortedBodies[i].w);
+        return;
+    }
+
+    for (auto c{node.firstChild}; c < node.firstChild + node.childCount; ++c) {
+        weighted += list[c].centerOfMass * list[c].mass;
+        node.mass += list[c].mass;
+    }
+    node.centerOfMass = 0.f < node.mass ? weighted / node.mass : node.center;
+    // Parallel axis theorem for the children moments:
+    for (auto c{node.firstChild}; c < node.firstChild + node.childCount; ++c) {
+        for (std::size_t k{0}; k < 6; ++k)
+            node.quadrupole[k] += list[c].quadrupole[k];
+        addQuadrupole(node.quadrupole, list[c].centerOfMass - node.centerOfMass, list[c].mass);
+    }
+}
+
+// Softened point mass acceleration on a body at r (relative to the mass)
+static glm::vec3 pointAcceleration(glm::vec3 r, float m, float softening2) {
+    const float r2 = glm::dot(r, r) + softening2;
+    const float invR = 1.f / std::sqrt(r2);
+    return -r * (m * invR * invR * invR);
+}
+
+glm::vec3 Octree::acceleration(glm::vec3 pos, const GravityParams& params) const {
+    glm::vec3 acc{0.f};
+    if (nodes.empty())
+        return acc;
+
+    const float softening2 = params.softening * params.softening;
+    const float theta2 = params.theta * params.theta;
+
+    std::array<std::uint32_t, 8 * MAX_DEPTH + 8> stack;
+    std::size_t stackSize{0};
+    stack[stackSize++] = 0;
+
+    while (0 < stackSize) {
+        const auto& node = nodes[stack[--stackSize]];
+        const auto r = pos - node.centerOfMass;
+        const float d2 = glm::dot(r, r);
+        const float size = 2.f * node.halfSize;
+
+        if (size * size < theta2 * d2) {
+            // Far enough away: use multipole expansion
+            const float r2 = d2 + softening2;
+            const float invR = 1.f / std::sqrt(r2);
+            const float invR2 = invR * invR;
+            const float invR5 = invR2 * invR2 * invR;
+            const auto& q = node.quadrupole;
+            const glm::vec3 Qr{
+                q[0] * r.x + q[3] * r.y + q[4] * r.z,
+                q[3] * r.x + q[1] * r.y + q[5] * r.z,
+                q[4] * r.x + q[5] * r.y + q[2] * r.z
+            };
+            const float rQr = glm::dot(r, Qr);
+            acc += -r * (node.mass * invR2 * invR) + Qr * invR5 - r * (2.5f * rQr * invR5 * invR2);
+        } else if (node.leaf()) {
+            for (auto i{node.first}; i < node.first + node.count; ++i)
+                acc += pointAcceleration(pos - glm::vec3{bodies[i]}, bodies[i].w, softening2);
+        } else {
+            for (auto c{node.firstChild}; c < node.firstChild + node.childCount; ++c)
+                stack[stackSize++] = c;
+        }
+    }
+
+    return acc * params.G;
+}
+
+void Octree::accelerations(std::span<glm::vec3> out, const GravityParams& params) const {
+    // Traverse in Morton order so neighbouring tasks touch the same nodes
+    util::parallelFor(bodies.size(), [&](std::size_t begin, std::size_t end){
+        for (auto i{begin}; i < end; ++i)
+            out[order[i]] = acceleration(glm::vec3{bodies[i]}, params);
+    }, 256);
+}
+
+glm::vec3 centerAcceleration(glm::vec3 pos, const GravityParams& params) {
+    if (params.centerMass <= 0.f)
+        return glm::vec3{0.f};
+    return pointAcceleration(pos, params.centerMass, params.softening * params.softening) * params.G;
+}
+
+void directSum(std::span<const glm::vec4> points, std::span<glm::vec3> out, const GravityParams& params) {
+    const float softening2 = params.softening * params.softening;
+    util::parallelFor(points.size(), [&](std::size_t begin, std::size_t end){
+        for (auto i{begin}; i < end; ++i) {
+            glm::vec3 acc{0.f};
+            const glm::vec3 pos{points[i]};
+            for (const auto& p : points)
+                acc += pointAcceleration(pos - glm::vec3{p}, p.w, softening2);
+            out[i] = acc * params.G;
+        }
+    }, 64);
+}
+
+}
@@ -0,0 +1,81 @@
+#ifndef NBODY_H
+#define NBODY_H
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <span>
+#include <array>
+#include <cstdint>
+
+namespace sim {
+
+struct GravityParams {
+    float G;
+    // Barnes-Hut opening angle. A node is approximated when size / distance < theta.
+    float theta = 0.5f;
+    float softening = 0.01f;
+    // Optional fixed point mass in origin (0 to disable)
+    float centerMass = 0.f;
+};
+
+/**
+ * @brief Barnes-Hut octree over a set of point masses (xyz = position, w = mass).
+ * Bodies are sorted along a Morton curve so that every node covers a contiguous range,
+ * which lets the top levels of the tree be built in parallel and keeps traversal cache friendly.
+ * Nodes store monopole + quadrupole moments around their center of mass.
+ */
+class Octree {
+public:
+    struct Node {
+        glm::vec3 centerOfMass{0.f};
+        float mass{0.f};
+        // Traceless quadrupole tensor, symmetric: xx, yy, zz, xy, xz, yz
+        std::array<float, 6> quadrupole{};
+        glm::vec3 center{0.f};
+        float halfSize{0.f};
+        // Index of first child in node list. Children are stored contiguously. 0 means leaf.
+        std::uint32_t firstChild{0};
+        std::uint32_t childCount{0};
+        // Range into sorted body list
+        std::uint32_t first{0};
+        std::uint32_t count{0};
+
+        bool leaf() const { return childCount == 0; }
+    };
+
+    static constexpr std::uint32_t LEAF_SIZE = 16;
+    static constexpr std::uint32_t MAX_DEPTH = 21;
+
+private:
+    std::vector<Node> nodes;
+    std::vector<glm::vec4> bodies;
+    std::vector<std::uint64_t> codes;
+    std::vector<std::uint32_t> order;
+
+    std::vector<Node> buildSubtree(std::uint32_t first, std::uint32_t count, std::uint32_t level, glm::vec3 center, float halfSize) const;
+    void buildNode(std::vector<Node>& list, std::uint32_t index, std::uint32_t level) const;
+    static void computeMoments(std::vector<Node>& list, std::uint32_t index, std::span<const glm::vec4> sortedBodies);
+
+public:
+    // Rebuilds the tree from scratch.
+    void build(std::span<const glm::vec4> points);
+
+    // Acceleration on a point in space from all bodies in the tree (excluding the fixed center mass).
+    glm::vec3 acceleration(glm::vec3 pos, const GravityParams& params) const;
+
+    // Computes accelerations for all points passed to the last build(), in original order.
+    void accelerations(std::span<glm::vec3> out, const GravityParams& params) const;
+
+    const std::vector<Node>& getNodes() const { return nodes; }
+};
+
+// Acceleration towards the fixed center mass (if any).
+glm::vec3 centerAcceleration(glm::vec3 pos, const GravityParams& params);
+
+// O(n^2) reference kernel. Used to validate the Barnes-Hut approximation.
+void directSum(std::span<const glm::vec4> points, std::span<glm::vec3> out, const GravityParams& params);
+
+}
+
+#endif // NBODY_H
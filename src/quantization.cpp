@@ -0,0 +1,73 @@
+#include "quantization.h"
+#include "utils.h"
+#include "jobs.h"
+
+#include <algorithm>
+#include <limits>
+
+namespace util {
+
+void RadiusTable::build(std::span<const glm::vec4> spheres) {
+    std::vector<float> distinct(spheres.size());
+    parallelFor(spheres.size(), [&](std::size_t begin, std::size_t end){
+        for (auto i{begin}; i < end; ++i)
+            distinct[i] = spheres[i].w;
+    });
+    jobs::parallelSort(distinct.begin(), distinct.end());
+    distinct.erase(std::unique(distinct.begin(), distinct.end()), distinct.end());
+
+    distinctCount = distinct.size();
+    bExact = distinctCount <= RADIUS_TABLE_SIZE;
+    if (distinct.empty()) {
+        std::fill(radii.begin(), radii.end(), 0.f);
+    } else if (bExact) {
+        // Padded with the largest radius, so the table stays sorted
+        std::copy(distinct.begin(), distinct.end(), radii.begin());
+        std::fill(radii.begin() + distinctCount, radii.end(), distinct.back());
+    } else {
+        const float lo = distinct.front(), hi = distinct.back();
+        for (std::size_t i{0}; i < RADIUS_TABLE_SIZE; ++i)
+            radii[i] = lo + (hi - lo) * static_cast<float>(i) / static_cast<float>(RADIUS_TABLE_SIZE - 1);
+    }
+}
+
+glm::uint RadiusTable::index(float radius) const {
+    const auto end = radii.begin() + (bExact ? std::max<std::size_t>(distinctCount, 1) : RADIUS_TABLE_SIZE);
+    const auto it = std::lower_bound(radii.begin(), end, radius);
+    if (it == radii.begin())
+        return 0;
+    if (it == end)
+        return static_cast<glm::uint>(end - radii.begin() - 1);
+    // Closer of the two neighbours
+    const auto i = static_cast<glm::uint>(it - radii.begin());
+    return radius - radii[i - 1] < *it - radius ? i - 1 : i;
+}
+
+void quantizeSpheres(std::span<const glm::vec4> spheres, const RadiusTable& radii,
+    std::span<glm::uvec2> out, std::span<QuantizedCluster> clusters) {
+    constexpr float MAX_VALUE = 65535.f;
+
+    parallelFor(clusters.size(), [&](std::size_t begin, std::size_t end){
+        for (auto c{begin}; c < end; ++c) {
+            const auto first = c * QUANTIZATION_CLUSTER_SIZE;
+            const auto last = std::min(first + QUANTIZATION_CLUSTER_SIZE, spheres.size());
+
+            glm::vec3 lo{std::numeric_limits<float>::max()}, hi{std::numeric_limits<float>::lowest()};
+            for (auto i{first}; i < last; ++i) {
+                lo = glm::min(lo, glm::vec3{spheres[i]});
+                hi = glm::max(hi, glm::vec3{spheres[i]});
+            }
+            // Flat clusters still need a step the shader can multiply with
+            const auto step = glm::max((hi - lo) / MAX_VALUE, glm::vec3{1e-12f});
+            clusters[c] = {glm::vec4{lo, 0.f}, glm::vec4{step, 0.f}};
+
+            const auto invStep = 1.f / step;
+            for (auto i{first}; i < last; ++i) {
+                const auto q = glm::uvec3{glm::clamp(glm::round((glm::vec3{spheres[i]} - lo) * invStep), 0.f, MAX_VALUE)};
+                out[i] = glm::uvec2{q.x | (q.y << 16), q.z | (radii.index(spheres[i].w) << 16)};
+            }
+        }
+    }, 4);
+}
+
+}
@@ -0,0 +1,50 @@
+#ifndef QUANTIZATION_H
+#define QUANTIZATION_H
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <span>
+#include <cstddef>
+
+namespace util {
+
+// Spheres per cluster of the quantized representation. Every cluster has its own origin and step.
+constexpr std::size_t QUANTIZATION_CLUSTER_SIZE = 256;
+// Radii are stored as 8-bit indices into a table of this many values
+constexpr std::size_t RADIUS_TABLE_SIZE = 256;
+
+/**
+ * @brief Maps radii to 8-bit indices. Scenes with at most 256 distinct radii (e.g. molecules, where the radius
+ * only depends on the element) are stored exactly, others are rounded to evenly spaced values between the smallest and largest radius.
+ */
+class RadiusTable {
+private:
+    // Always RADIUS_TABLE_SIZE values, so it can be uploaded as is
+    std::vector<float> radii = std::vector<float>(RADIUS_TABLE_SIZE, 0.f);
+    bool bExact = true;
+    std::size_t distinctCount{0};
+
+public:
+    void build(std::span<const glm::vec4> spheres);
+    // Index of the closest radius in the table
+    glm::uint index(float radius) const;
+
+    const std::vector<float>& values() const { return radii; }
+    bool isExact() const { return bExact; }
+};
+
+// Layout of a cluster as read by sphere.vert.glsl: position = origin + step * quantized position
+struct QuantizedCluster {
+    glm::vec4 origin;
+    glm::vec4 step;
+};
+
+// Packs every sphere into a uvec2 of 16-bit fixed point positions relative to its cluster's bounding box
+// and an 8-bit radius index: (x | y << 16, z | radiusIndex << 16). Both spans are filled, in parallel.
+void quantizeSpheres(std::span<const glm::vec4> spheres, const RadiusTable& radii,
+    std::span<glm::uvec2> out, std::span<QuantizedCluster> clusters);
+
+}
+
+#endif // QUANTIZATION_H
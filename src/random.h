@@ -0,0 +1,72 @@
+#ifndef RANDOM_H
+#define RANDOM_H
+
+#include <glm/glm.hpp>
+#include <glm/gtc/constants.hpp>
+
+#include <cstdint>
+
+namespace util {
+
+// Philox4x32-10 (Salmon et al., "Parallel random numbers: as easy as 1, 2, 3"): a keyed bijection of 128 bit counters
+inline glm::uvec4 philox(glm::uvec4 counter, glm::uvec2 key) {
+    constexpr std::uint32_t M0 = 0xD2511F53, M1 = 0xCD9E8D57;
+    constexpr std::uint32_t W0 = 0x9E3779B9, W1 = 0xBB67AE85;
+    for (int round{0}; round < 10; ++round) {
+        const auto p0 = static_cast<std::uint64_t>(M0) * counter.x;
+        const auto p1 = static_cast<std::uint64_t>(M1) * counter.z;
+        counter = glm::uvec4{
+            static_cast<std::uint32_t>(p1 >> 32) ^ counter.y ^ key.x, static_cast<std::uint32_t>(p1),
+            static_cast<std::uint32_t>(p0 >> 32) ^ counter.w ^ key.y, static_cast<std::uint32_t>(p0)
+        };
+        key += glm::uvec2{W0, W1};
+    }
+    return counter;
+}
+
+/**
+ * @brief Random numbers of one stream, such as one per entity, with nothing shared between streams.
+ * The numbers are a function of seed, stream and how many were drawn before, so they are the same whichever thread draws
+ * them and in whichever order the streams are used. Floats are made from integers without library distributions,
+ * whose results differ between standard libraries.
+ */
+class Random {
+private:
+    glm::uvec2 key;
+    glm::uvec4 counter;
+    glm::uvec4 block{};
+    int used{4};
+
+public:
+    Random(std::uint64_t seed, std::uint64_t stream)
+        : key{static_cast<std::uint32_t>(seed), static_cast<std::uint32_t>(seed >> 32)},
+          counter{0u, 0u, static_cast<std::uint32_t>(stream), static_cast<std::uint32_t>(stream >> 32)} {}
+
+    std::uint32_t next() {
+        if (used == 4) {
+            block = philox(counter, key);
+            used = 0;
+            if (++counter.x == 0)
+                ++counter.y;
+        }
+        return block[used++];
+    }
+
+    // In [0, 1), from the upper 24 bits, which a float represents exactly
+    float uniform() { return static_cast<float>(next() >> 8) * 0x1p-24f; }
+    float uniform(float lo, float hi) { return lo + (hi - lo) * uniform(); }
+    float angle() { return uniform(0.f, glm::two_pi<float>()); }
+
+    // Uniform in the ball, by rejection from the enclosing cube
+    glm::vec3 ballPoint(float radius) {
+        glm::vec3 p;
+        do
+            p = glm::vec3{uniform(-1.f, 1.f), uniform(-1.f, 1.f), uniform(-1.f, 1.f)};
+        while (1.f < glm::dot(p, p));
+        return p * radius;
+    }
+};
+
+}
+
+#endif // RANDOM_H
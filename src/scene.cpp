@@ -3,26 +3,65 @@
 #include "settings.h"
 #include "camera.h"
 #include "constants.h"
+#include "timer.h"
+#include "molecule.h"
+#include "spatialsort.h"
+#include "jobs.h"
+#include "random.h"
 
 #include <format>
 #include <vector>
 #include <iostream>
+#include <chrono>
+#include <array>
 #include <glm/gtc/random.hpp>
 #include <glm/glm.hpp>
 #include <glm/gtx/quaternion.hpp>
 #include <imgui.h>
+#include <ranges>
+#include <bit>
 
 using namespace comp;
 using namespace globjects;
 using namespace util;
 
+// Stable sort algorithm for entt::basic_group::sort. Skips sorting if already in order.
+struct StableSort {
+    template <typename It, typename Compare>
+    void operator()(It first, It last, Compare compare) const {
+        if (!std::is_sorted(first, last, compare))
+            std::stable_sort(first, last, std::move(compare));
+    }
+};
+
+// Sort algorithm for entt::basic_group::sort that moves every entity straight to its rank, indexed by entity, instead of comparing
+struct RankSort {
+    std::span<const glm::uint> ranks;
+
+    template <typename It, typename Compare>
+    void operator()(It first, It last, Compare) const {
+        std::vector<entt::entity> sorted(static_cast<std::size_t>(last - first));
+        for (auto it{first}; it != last; ++it)
+            sorted[ranks[entt::to_entity(*it)]] = *it;
+        std::copy(sorted.begin(), sorted.end(), first);
+    }
+};
+
 constexpr glm::uint SCENE_SIZE = 1000;
 constexpr glm::uint SCENE_SIZE2 = SCENE_SIZE / 7;
+// Generated scenes are the same for the same seed
+constexpr std::uint64_t SCENE_SEED = 1;
 constexpr std::size_t MAX_ENTRIES = 32u;
 constexpr std::size_t LIST_MAX_ENTRIES = MAX_ENTRIES * 800 * 600;
 constexpr float FAR_DIST = 1000.f;
+constexpr float SIMULATION_TIMESTEP = 1.f / 120.f;
+// Number of frames of scene buffer data in flight
+constexpr std::size_t SCENE_BUFFER_REGIONS = 3;
+// Frames prefetched ahead of the trajectory playhead, plus the ones being drawn
+constexpr std::size_t TRAJECTORY_SLOTS = 8;
 
-Scene::Scene()
+Scene::Scene(const std::filesystem::path& scenePath, const std::filesystem::path& trajectoryPath)
+    : gravity{.G = G, .centerMass = PHYSICS_CENTER_MASS}
 {
     const auto SCR_SIZE = Settings::get().SCR_SIZE;
 
@@ -53,6 +92,113 @@ Scene::Scene()
         }
     }));
 
+    // Same programs reading the quantized scene buffer
+    shaders.insert(std::make_pair("sphereQuantized", Shader{
+        {
+            {GL_VERTEX_SHADER, "sphere.vert.glsl"},
+            {GL_GEOMETRY_SHADER, "sphere.geom.glsl"},
+            {GL_FRAGMENT_SHADER, "sphere.frag.glsl"}
+        }, {
+            "QUANTIZED",
+            std::format("CLUSTER_SIZE {}u", util::QUANTIZATION_CLUSTER_SIZE)
+        }
+    }));
+
+    shaders.insert(std::make_pair("listQuantized", Shader{
+        {
+            {GL_VERTEX_SHADER, "sphere.vert.glsl"},
+            {GL_GEOMETRY_SHADER, "sphere.geom.glsl"},
+            {GL_FRAGMENT_SHADER, "list.frag.glsl"}
+        }, {
+            "QUANTIZED",
+            std::format("CLUSTER_SIZE {}u", util::QUANTIZATION_CLUSTER_SIZE),
+            std::format("MAX_ENTRIES {}u", MAX_ENTRIES),
+            std::format("LIST_MAX_ENTRIES {}u", LIST_MAX_ENTRIES),
+            std::format("SCREEN_SIZE uvec2({},{})", SCR_SIZE.x, SCR_SIZE.y)
+        }
+    }));
+
+    // Sub-pixel spheres
+    shaders.insert(std::make_pair("splat", Shader{
+        {
+            {GL_VERTEX_SHADER, "splat.vert.glsl"},
+            {GL_FRAGMENT_SHADER, "splat.frag.glsl"}
+        }
+    }));
+
+    shaders.insert(std::make_pair("splatQuantized", Shader{
+        {
+            {GL_VERTEX_SHADER, "splat.vert.glsl"},
+            {GL_FRAGMENT_SHADER, "splat.frag.glsl"}
+        }, {
+            "QUANTIZED",
+            std::format("CLUSTER_SIZE {}u", util::QUANTIZATION_CLUSTER_SIZE)
+        }
+    }));
+
+    shaders.insert(std::make_pair("animate", Shader{
+        {
+            {GL_COMPUTE_SHADER, "animate.comp.glsl"}
+        }
+    }));
+
+    shaders.insert(std::make_pair("cull", Shader{
+        {
+            {GL_COMPUTE_SHADER, "cull.comp.glsl"}
+        }
+    }));
+
+    shaders.insert(std::make_pair("cullQuantized", Shader{
+        {
+            {GL_COMPUTE_SHADER, "cull.comp.glsl"}
+        }, {
+            "QUANTIZED",
+            std::format("CLUSTER_SIZE {}u", util::QUANTIZATION_CLUSTER_SIZE)
+        }
+    }));
+
+    shaders.insert(std::make_pair("lod", Shader{
+        {
+            {GL_COMPUTE_SHADER, "lod.comp.glsl"}
+        }
+    }));
+
+    shaders.insert(std::make_pair("hiZ", Shader{
+        {
+            {GL_COMPUTE_SHADER, "hiz.comp.glsl"}
+        }
+    }));
+
+    shaders.insert(std::make_pair("lbvh", Shader{
+        {
+            {GL_COMPUTE_SHADER, "lbvh.comp.glsl"}
+        }
+    }));
+
+    shaders.insert(std::make_pair("lbvhQuantized", Shader{
+        {
+            {GL_COMPUTE_SHADER, "lbvh.comp.glsl"}
+        }, {
+            "QUANTIZED",
+            std::format("CLUSTER_SIZE {}u", util::QUANTIZATION_CLUSTER_SIZE)
+        }
+    }));
+
+    shaders.insert(std::make_pair("radixSort", Shader{
+        {
+            {GL_COMPUTE_SHADER, "radixsort.comp.glsl"}
+        }
+    }));
+
+    shaders.insert(std::make_pair("trace", Shader{
+        {
+            {GL_VERTEX_SHADER, "screen.vert.glsl"},
+            {GL_FRAGMENT_SHADER, "trace.frag.glsl"}
+        }, {
+            std::format("MAX_ENTRIES {}u", MAX_ENTRIES)
+        }
+    }));
+
     shaders.insert(std::make_pair("surface", Shader{
         {
             {GL_VERTEX_SHADER, "screen.vert.glsl"},
@@ -87,43 +233,57 @@ Scene::Scene()
 
 
     // Setup scene
-    positions.reserve(SCENE_SIZE);
-
-    for (glm::uint i = 0; i < SCENE_SIZE; ++i) {
-        auto entity = EM.create();
-
-        const auto pos = glm::ballRand(0.5f);
-        const auto radius = glm::linearRand(0.01f, 0.1f);
-        const auto mass = 10.f * radius * radius;
-        auto velocity = glm::normalize(randomDiskPoint(pos, 1.f) - pos) * glm::linearRand(0.1f, 0.5f);
-        // Multiply with mean orbital speed (https://en.wikipedia.org/wiki/Orbital_speed#Mean_orbital_speed):
-        // velocity *= std::sqrt((G * PHYSICS_CENTER_MASS) / glm::length(pos));
-
-        EM.emplace<Sphere>(entity, pos, radius, 0u);
-        EM.emplace<Physics>(entity, velocity, mass);
-        positions.emplace_back(pos, radius);
+    // A loaded scene is already in buffer order, so it's uploaded straight from the mapped file.
+    // Generated scenes and molecules are sorted spatially first, unless they come with a trajectory.
+    // Molecules are imported in buffer order too, scaled to the size of a generated scene.
+    std::vector<glm::vec4> generated;
+    std::span<const glm::vec4> positions;
+    std::optional<io::SceneFile> file;
+    std::optional<io::Molecule> molecule;
+    if (!scenePath.empty()) {
+        if (io::isMoleculeFile(scenePath)) {
+            Timer<std::chrono::high_resolution_clock> timer{};
+            molecule = io::loadMolecule(scenePath);
+            if (molecule) {
+                std::cout << std::format("Imported {} atoms in {} chains in {}ms", molecule->spheres.size(), molecule->groups.size(), timer.elapsed<std::chrono::milliseconds>()) << std::endl;
+                io::normalizeMolecule(*molecule);
+            }
+        } else {
+            file = io::SceneFile::open(scenePath);
+        }
+    }
+    if (file) {
+        loadScene(file->groups(), file->spheres(), file->velocities());
+        positions = file->spheres();
+    } else if (molecule) {
+        loadScene(molecule->groups, molecule->spheres, {});
+        // Atoms come in chain order. A trajectory given along with them would be in that order too.
+        if (trajectoryPath.empty()) {
+            generated = sortGroups(bSpatialOrder);
+            positions = generated;
+        } else {
+            positions = molecule->spheres;
+        }
+    } else {
+        generateScene(SCENE_SEED);
+        generated = sortGroups(bSpatialOrder && trajectoryPath.empty());
+        positions = generated;
     }
 
-    sceneBuffer = std::make_shared<VertexArray>(positions, GL_DYNAMIC_DRAW);
+    sceneSize = positions.size();
+    sceneBuffer = std::make_shared<VertexArray>();
+    sceneRing = std::make_unique<RingBuffer<GL_ARRAY_BUFFER>>(*sceneBuffer->vertexBuffer, sizeof(glm::vec4) * sceneSize, SCENE_BUFFER_REGIONS, positions.data());
     sceneBuffer->vertexAttribute(0, 4, GL_FLOAT, GL_FALSE);
 
+    regionChanges.resize(SCENE_BUFFER_REGIONS);
 
-    positions2.reserve(SCENE_SIZE2);
-    for (glm::uint i = 0; i < SCENE_SIZE2; ++i) {
-        auto entity = EM.create();
-
-        const auto pos = glm::ballRand(0.4f);
-        const auto radius = glm::linearRand(0.01f, 0.2f);
-        const auto mass = 10.f * radius * radius;
-        auto velocity = glm::normalize(randomDiskPoint(pos, 1.f) - pos) * glm::linearRand(1.f, 2.f);
-
-        EM.emplace<Sphere>(entity, pos, radius, 1u);
-        EM.emplace<Physics>(entity, velocity, mass);
-        positions2.emplace_back(pos, radius);
-    }
-
-    sceneBuffer2 = std::make_shared<VertexArray>(positions2, GL_DYNAMIC_DRAW);
-    sceneBuffer2->vertexAttribute(0, 4, GL_FLOAT, GL_FALSE);
+    // Culling output: the visible spheres of every group, compacted into the group's range of the index buffer
+    constexpr auto drawLists = static_cast<std::size_t>(DrawList::Count);
+    cullIndexBuffer = std::make_shared<Buffer<GL_ELEMENT_ARRAY_BUFFER>>(sizeof(glm::uint) * sceneSize * drawLists, GL_DYNAMIC_COPY);
+    cullCommandBuffer = std::make_shared<Buffer<GL_DRAW_INDIRECT_BUFFER>>(sizeof(DrawElementsIndirectCommand) * groups.size() * drawLists, GL_DYNAMIC_COPY);
+    // Nothing counts as visible at first, so the first frame draws everything in the second phase
+    visibilityBuffer = std::make_shared<Buffer<GL_SHADER_STORAGE_BUFFER>>(std::vector<glm::uint>(sceneSize, 0u), GL_DYNAMIC_COPY);
+    EM.on_update<Sphere>().connect<&Scene::onSphereUpdate>(*this);
 
     // Framebuffers:
     positionTexture = std::make_shared<Tex2D>(SCR_SIZE);
@@ -147,6 +307,10 @@ Scene::Scene()
     assert(sphereFramebuffer2->completeness() == "GL_FRAMEBUFFER_COMPLETE");
 
 
+    // Full mip chain, down to a single texel
+    hiZTexture = std::make_shared<Tex2D>();
+    hiZTexture->storage(static_cast<GLsizei>(std::bit_width(static_cast<unsigned int>(std::max(SCR_SIZE.x, SCR_SIZE.y)))), GL_R32F, SCR_SIZE);
+
     listIndexTexture = std::make_shared<Tex2D>(SCR_SIZE, GL_R32UI, GL_RED_INTEGER);
     listIndexTexture2 = std::make_shared<Tex2D>(SCR_SIZE, GL_R32UI, GL_RED_INTEGER);
 
@@ -154,6 +318,17 @@ Scene::Scene()
     const std::size_t entrySize = sizeof(glm::vec4);
     const std::size_t bufferSize = entrySize * MAX_ENTRIES * 2 * SCR_SIZE.x * SCR_SIZE.y;
     listBuffer = std::make_shared<Buffer<GL_SHADER_STORAGE_BUFFER>>(bufferSize, GL_DYNAMIC_DRAW);
+
+    // Simulation thread (starts paused). The scene buffer already holds the initial state,
+    // so the snapshots start out empty instead of holding copies of it.
+    simulation = std::make_unique<sim::Simulation>(
+        [this](float deltaTime, sim::Snapshot& out){ animate(deltaTime, out); },
+        SIMULATION_TIMESTEP,
+        snapshots
+    );
+
+    if (!trajectoryPath.empty())
+        loadTrajectory(trajectoryPath);
 }
 
 void Scene::reloadShaders() {
@@ -184,16 +359,168 @@ void Scene::render(float deltaTime) {
 
     // Gui:
     if (ImGui::BeginMenu("Scene")) {
+        // The menu touches simulation state, so keep the simulation from stepping meanwhile
+        auto simulationLock = simulation->lock();
+
         ImGui::SliderFloat("Radius", &outerRadiusScale, 0.f, 10.f);
         ImGui::SliderFloat("Smoothing Factor", &smoothing, 0.f, 4.f);
         ImGui::SliderFloat("Interpolation", &interpolation, 0.f, 1.f);
         ImGui::Checkbox("Animation", &animation);
-        if (animation)
+        if (animation) {
             ImGui::DragFloat("Animation speed", &animationSpeed, 0.1f, 0.1f, 10.f);
+            ImGui::Text("Snapshot %llu, %llu dropped", static_cast<unsigned long long>(snapshots.sequence()),
+                static_cast<unsigned long long>(snapshots.droppedCount()));
+        }
+
+        const auto lastMode = simulationMode;
+        ImGui::Combo("Simulation", reinterpret_cast<int*>(&simulationMode), "Orbit\0N-body\0Fluid\0");
+        if (simulationMode == SimulationMode::Orbit) {
+            if (ImGui::Checkbox("GPU animation", &bGpuAnimation))
+                bGpuAnimation ? uploadGpuState() : downloadGpuState();
+            if (ImGui::Button("Validate GPU animation"))
+                validateGpuAnimation();
+        } else if (bGpuAnimation) {
+            // The compute path only implements the orbit animation
+            bGpuAnimation = false;
+            downloadGpuState();
+        }
+        if (simulationMode == SimulationMode::NBody) {
+            if (lastMode != simulationMode)
+                resetOrbitalVelocities();
+            ImGui::SliderFloat("Theta", &gravity.theta, 0.f, 1.5f);
+            ImGui::DragFloat("Softening", &gravity.softening, 0.001f, 0.f, 0.1f);
+            ImGui::DragFloat("Mass scale", &massScale, 1e4f, 0.f, 1e8f, "%.0f");
+            if (ImGui::Button("Compare with direct sum"))
+                compareGravity();
+        }
+        if (simulationMode == SimulationMode::Fluid) {
+            if (lastMode != simulationMode)
+                resetFluid();
+            ImGui::SliderFloat("Smoothing radius", &fluidParams.smoothingRadius, 0.02f, 0.3f);
+            ImGui::DragFloat("Stiffness", &fluidParams.stiffness, 1.f, 1.f, 1000.f);
+            ImGui::DragFloat("Viscosity", &fluidParams.viscosity, 0.1f, 0.f, 50.f);
+            ImGui::DragFloat("Particle mass", &fluidParams.particleMass, 0.01f, 0.001f, 10.f);
+            ImGui::DragFloat3("Gravity", &fluidParams.gravity.x, 0.1f);
+            ImGui::Text("Neighbours per particle: %.1f", static_cast<float>(fluid.getNeighbourCount()) / static_cast<float>(sceneSize));
+            ImGui::Text("Neighbour list rebuilds: %llu / %llu steps",
+                static_cast<unsigned long long>(fluid.getRebuildCount()), static_cast<unsigned long long>(fluid.getStepCount()));
+        }
+        ImGui::Checkbox("Collisions", &bCollisions);
+        if (bCollisions) {
+            ImGui::SliderFloat("Restitution", &collision.restitution, 0.f, 1.f);
+            ImGui::SliderFloat("Overlap correction", &collision.correction, 0.f, 1.f);
+            ImGui::Text("Contacts: %zu", contactCount);
+        }
+        editSpheres();
+        trajectoryMenu();
+
+        bool quantized = bQuantized;
+        if (ImGui::Checkbox("Quantized spheres", &quantized))
+            setQuantized(quantized);
+        if (bQuantized)
+            ImGui::Text("%zu bytes per sphere, %s radii", sizeof(glm::uvec2), radiusTable.isExact() ? "exact" : "rounded");
+        ImGui::Checkbox("Spatial order", &bSpatialOrder);
+        if (bSpatialOrder)
+            ImGui::SliderFloat("Resort interval (s)", &sortInterval, 0.1f, 10.f);
+        ImGui::Checkbox("Ray traced", &bTracing);
+        ImGui::Checkbox("Culling", &bCulling);
+        if (bCulling) {
+            ImGui::Checkbox("Occlusion culling", &bOcclusionCulling);
+            ImGui::Checkbox("Splats", &bSplats);
+            if (bSplats)
+                ImGui::SliderFloat("Splat radius (px)", &splatPixels, 0.1f, 4.f);
+            if (ImGui::Checkbox("Level of detail", &bLod) && bLod)
+                bLodStale = true;
+            if (bLod) {
+                ImGui::SliderFloat("LOD cell size (px)", &lodPixels, 0.5f, 16.f);
+                ImGui::Text("%zu LOD spheres%s", lodSphereCount, lodBuild.valid() ? ", rebuilding" : "");
+            }
+            // Reads back last frame's counts, which waits for the GPU. Only done while the menu is open.
+            const auto commands = cullCommandBuffer->getBufferData<DrawElementsIndirectCommand>(groups.size() * static_cast<std::size_t>(DrawList::Count));
+            std::array<glm::uint, static_cast<std::size_t>(DrawList::Count)> counts{};
+            for (std::size_t i{0}; i < commands.size(); ++i)
+                counts[i % counts.size()] += commands[i].count;
+            ImGui::Text("Sphere pass: %u + %u / %zu", counts[0], counts[1], sceneSize);
+            ImGui::Text("List pass: %u / %zu", counts[2], sceneSize);
+            if (bLod)
+                ImGui::Text("Drawn as LOD spheres: %u", counts[3]);
+            if (bSplats)
+                ImGui::Text("Splats: %u", counts[4]);
+        }
+
+        static char scenePath[256] = "scene.bsph";
+        ImGui::InputText("Scene file", scenePath, sizeof(scenePath));
+        if (ImGui::Button("Save scene"))
+            std::cout << (saveScene(scenePath) ? std::format("Saved scene to \"{}\"", scenePath) : std::string{"Saving scene failed!"}) << std::endl;
 
         ImGui::EndMenu();
     }
 
+    // Clicking the scene selects the sphere under the cursor for editing
+    if (ImGui::IsMouseClicked(ImGuiMouseButton_Left) && !ImGui::GetIO().WantCaptureMouse) {
+        const auto& mousePos = Settings::get().mousePos;
+        if (const auto picked = pickSphere(MVPInverse, glm::vec2{static_cast<float>(mousePos.x), static_cast<float>(-mousePos.y)}))
+            selectedSphere = static_cast<int>(*picked);
+    }
+
+    // Trajectory frames are in the order of the file
+    if (bSpatialOrder && animation && !trajectoryStreamer) {
+        sortTimer += deltaTime;
+        if (sortInterval <= sortTimer) {
+            sortTimer = 0.f;
+            reorderSpheres();
+        }
+    }
+
+    simulation->setPaused(!animation || bGpuAnimation || trajectoryStreamer);
+    simulation->setSpeed(animationSpeed);
+    if (trajectoryStreamer) {
+        updateTrajectory(deltaTime);
+    } else if (bGpuAnimation) {
+        if (animation)
+            animateGpu(deltaTime * animationSpeed);
+    } else {
+        interpolatePositions();
+    }
+    uploadChanges();
+    updateLod();
+    // Mark the current scene buffer regions as in use once this frame's draws are submitted
+    const auto sceneFence = sceneRing->fenceGuard();
+    std::optional<RingBuffer<GL_ARRAY_BUFFER>::FenceGuard> quantizedFence;
+    std::optional<RingBuffer<GL_SHADER_STORAGE_BUFFER>::FenceGuard> clusterFence;
+    if (bQuantized) {
+        quantizedFence.emplace(quantizedRing.get());
+        clusterFence.emplace(clusterRing.get());
+    }
+    // The trajectory and GPU animation buffers are never quantized
+    const bool bDrawQuantized = bQuantized && !trajectorySlot && !bGpuAnimation;
+    const auto sphereShader = bDrawQuantized ? "sphereQuantized" : "sphere";
+    const auto listShader = bDrawQuantized ? "listQuantized" : "list";
+    const auto splatShader = bDrawQuantized ? "splatQuantized" : "splat";
+    // Ray tracing replaces all of the passes below
+    if (bTracing && buildLbvh(outerRadiusScale, bDrawQuantized)) {
+        traceScene(MVP, MVPInverse, outerRadiusScale, smoothing, interpolation);
+        return;
+    }
+    // Without occlusion culling, both passes are culled up front. Otherwise only the first phase of the sphere pass is,
+    // the rest is culled in between the draws of the sphere pass.
+    // Level of detail replaces per-sphere culling for the scene buffer. Both passes draw the same selection.
+    // Splats are classified by the cull pass, so they are only drawn when culling. The LOD selection produces none.
+    const bool bCulled = bCulling && beginCulling(MVP, vMat, pMat, bDrawQuantized, outerRadiusScale);
+    const bool bLodActive = bCulled && bLod && lodBuffer && !bDrawQuantized && !trajectorySlot && !bGpuAnimation && shaders.contains("lod");
+    const bool bOccluded = bCulled && !bLodActive && bOcclusionCulling && shaders.contains("hiZ");
+    if (bLodActive) {
+        selectLod(MVP, vMat, pMat, outerRadiusScale);
+        glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_ELEMENT_ARRAY_BARRIER_BIT);
+    } else if (bCulled) {
+        for (glm::uint i{0}; i < groups.size(); ++i) {
+            cullGroup(i, bOccluded ? CullMode::History : CullMode::Frustum, DrawList::Spheres, innerRadiusScale);
+            if (!bOccluded)
+                cullGroup(i, CullMode::Frustum, DrawList::List, outerRadiusScale, true);
+        }
+        glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_ELEMENT_ARRAY_BARRIER_BIT);
+    }
+
     // Clear buffers:
     {
         listBuffer->bind();
@@ -213,11 +540,12 @@ void Scene::render(float deltaTime) {
         glClearColor(0.f, 0.f, 0.f, FAR_DIST);
         glEnable(GL_DEPTH_TEST);
 
-        if (!shaders.contains("sphere"))
+        if (!shaders.contains(sphereShader))
             return;
         
-        const auto shaderId = *shaders.at("sphere");
+        const auto shaderId = *shaders.at(sphereShader);
         glUseProgram(shaderId);
+        uniform(shaderId, "sceneSize", static_cast<glm::uint>(sceneSize));
         uniform(shaderId, "MVP", MVP);
         uniform(shaderId, "MVPInverse", MVPInverse);
         uniform(shaderId, "modelViewMatrix", vMat);
@@ -229,8 +557,28 @@ void Scene::render(float deltaTime) {
             auto g = (i == 0 ? sphereFramebuffer : sphereFramebuffer2)->guard();
             glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-            auto g2 = (i == 0 ? sceneBuffer : sceneBuffer2)->guard();
-            glDrawArrays(GL_POINTS, 0, static_cast<GLsizei>(i == 0 ? SCENE_SIZE : SCENE_SIZE2));
+            if (bLodActive) {
+                drawScene(i, DrawList::Spheres);
+                drawScene(i, DrawList::Lod);
+                continue;
+            }
+            if (!bOccluded) {
+                drawScene(i, bCulled ? std::optional{DrawList::Spheres} : std::nullopt);
+                continue;
+            }
+
+            auto& positions = i == 0 ? *positionTexture : *positionTexture2;
+            glUseProgram(shaderId);
+            drawScene(i, DrawList::Spheres);
+            buildHiZ(positions);
+            cullGroup(i, CullMode::Refine, DrawList::SpheresLate, innerRadiusScale);
+            glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_ELEMENT_ARRAY_BARRIER_BIT);
+
+            glUseProgram(shaderId);
+            drawScene(i, DrawList::SpheresLate);
+            buildHiZ(positions);
+            cullGroup(i, CullMode::Occlusion, DrawList::List, outerRadiusScale, true);
+            glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_ELEMENT_ARRAY_BARRIER_BIT);
         }
     }
 
@@ -239,11 +587,12 @@ void Scene::render(float deltaTime) {
     {
         glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
         
-        if (!shaders.contains("list"))
+        if (!shaders.contains(listShader))
             return;
             
-        const auto shaderId = *shaders.at("list");
+        const auto shaderId = *shaders.at(listShader);
         glUseProgram(shaderId);
+        uniform(shaderId, "sceneSize", static_cast<glm::uint>(sceneSize));
         uniform(shaderId, "modelViewMatrix", vMat);
         uniform(shaderId, "projectionMatrix", pMat);
         uniform(shaderId, "MVP", MVP);
@@ -260,8 +609,12 @@ void Scene::render(float deltaTime) {
 
             glBindImageTexture(1, (i == 0 ? listIndexTexture : listIndexTexture2)->id, 0, GL_FALSE, 0, GL_READ_WRITE, GL_R32UI);
 
-            auto g2 = (i == 0 ? sceneBuffer : sceneBuffer2)->guard();
-            glDrawArrays(GL_POINTS, 0, static_cast<GLsizei>(i == 0 ? SCENE_SIZE : SCENE_SIZE2));
+            if (bLodActive) {
+                drawScene(i, DrawList::Spheres);
+                drawScene(i, DrawList::Lod);
+            } else {
+                drawScene(i, bCulled ? std::optional{DrawList::List} : std::nullopt);
+            }
         }
     }
 
@@ -272,63 +625,1142 @@ void Scene::render(float deltaTime) {
 
         glClearColor(0.2f, 0.3f, 0.3f, 1.0f);
         glDisable(GL_DEPTH_TEST);
-        glClear(GL_COLOR_BUFFER_BIT);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
         if (!shaders.contains("surface"))
             return;
             
         const auto shaderId = *shaders.at("surface");
         glUseProgram(shaderId);
+        // Writes the depth of the surface for the splats, without testing it
+        glEnable(GL_DEPTH_TEST);
+        glDepthFunc(GL_ALWAYS);
 
         // positionTexture->bind(0);
         listIndexTexture->bind(1);
         // positionTexture2->bind(2);
         listIndexTexture2->bind(3);
         listBuffer->bindBase(0);
+        uniform(shaderId, "MVP", MVP);
         uniform(shaderId, "MVPInverse", MVPInverse);
         uniform(shaderId, "time", runningTime);
         uniform(shaderId, "smoothing", smoothing);
         uniform(shaderId, "interpolation", interpolation);
 
         screenMesh.draw();
+        glDepthFunc(GL_LESS);
     }
 
-    if (animation)
-        animate(deltaTime * animationSpeed);
+
+    // Splat pass
+    if (bCulled && !bLodActive && bSplats && shaders.contains(splatShader)) {
+        const auto shaderId = *shaders.at(splatShader);
+        glUseProgram(shaderId);
+        uniform(shaderId, "sceneSize", static_cast<glm::uint>(sceneSize));
+        uniform(shaderId, "MVP", MVP);
+        uniform(shaderId, "radiusScale", outerRadiusScale);
+        uniform(shaderId, "projectionScale", 0.5f * static_cast<float>(Settings::get().SCR_SIZE.y) * pMat[1][1]);
+
+        // The groups are alternative representations the surface blends, so splats come from the dominant one
+        glm::uint group = interpolation < 0.5f ? 0 : 1;
+        if (groups[group].count == 0)
+            group = 1 - group;
+
+        glEnable(GL_PROGRAM_POINT_SIZE);
+        drawScene(group, DrawList::Splats);
+        glDisable(GL_PROGRAM_POINT_SIZE);
+    }
+    glDisable(GL_DEPTH_TEST);
 }
 
-void Scene::animate(float deltaTime) {
-    std::size_t i{0}, j{0};
-    const auto view = EM.view<Sphere, Physics>();
+void Scene::generateScene(std::uint64_t seed) {
+    struct Cloud {
+        glm::uint count, lod;
+        float extent, minRadius, maxRadius, minSpeed, maxSpeed;
+    };
+    constexpr std::array<Cloud, 2> clouds{{
+        {SCENE_SIZE, 0u, 0.5f, 0.01f, 0.1f, 0.1f, 0.5f},
+        {SCENE_SIZE2, 1u, 0.4f, 0.01f, 0.2f, 1.f, 2.f}
+    }};
 
-    for (auto entity : view) {
-        auto [trans, phys] = view.get<Sphere, Physics>(entity);
+    std::vector<Sphere> spheres(SCENE_SIZE + SCENE_SIZE2);
+    std::vector<Physics> physics(spheres.size());
+    std::size_t first{0};
+    for (const auto& cloud : clouds) {
+        util::parallelFor(cloud.count, [&](std::size_t begin, std::size_t end){
+            for (auto i{first + begin}; i < first + end; ++i) {
+                // A stream per sphere, so every sphere is the same however the spheres are split between threads
+                Random random{seed, i};
+                const auto pos = random.ballPoint(cloud.extent);
+                const auto radius = random.uniform(cloud.minRadius, cloud.maxRadius);
+                const auto velocity = glm::normalize(diskPoint(pos, 1.f, random.angle()) - pos) * random.uniform(cloud.minSpeed, cloud.maxSpeed);
 
-        /// "Faking" gravity
-        const auto dir = phys.velocity;
-        const auto rotDir = glm::normalize(glm::cross(dir, trans.pos));
-        const auto rotAmount = glm::length(dir) * deltaTime;
-        const auto rotation = glm::angleAxis(rotAmount, rotDir);
-        
-        trans.pos = rotation * trans.pos;
-        phys.velocity = rotation * phys.velocity;
+                spheres[i] = Sphere{pos, radius, cloud.lod};
+                physics[i] = Physics{velocity, 10.f * radius * radius};
+            }
+        });
+        first += cloud.count;
+    }
 
-        // const float radius = glm::length(trans.pos);
-        // const auto dir = (trans.pos / radius);
-        // const auto F = dir * ((G * phys.mass * PHYSICS_CENTER_MASS) / (radius * radius));
-        
-        // phys.velocity += (F / phys.mass) * deltaTime;
-        // trans.pos += phys.velocity * deltaTime;
+    std::vector<entt::entity> entities(spheres.size());
+    EM.create(entities.begin(), entities.end());
+    EM.insert<Sphere>(entities.begin(), entities.end(), spheres.begin());
+    EM.insert<Physics>(entities.begin(), entities.end(), physics.begin());
+}
 
-        if (trans.LOD == 0u) {
-            positions[i] = glm::vec4{trans.pos, trans.radius};
-            ++i;
-        } else {
-            positions2[j] = glm::vec4{trans.pos, trans.radius};
-            ++j;
+void Scene::loadScene(std::span<const io::SceneGroup> sceneGroups, std::span<const glm::vec4> spheres, std::span<const glm::vec4> velocities) {
+    // Bulk create and insert, reading components straight from the mapping
+    std::vector<entt::entity> entities(spheres.size());
+    EM.create(entities.begin(), entities.end());
+
+    for (const auto& group : sceneGroups) {
+        const auto first = entities.begin() + group.first;
+        const auto last = first + group.count;
+        const auto lod = group.LOD;
+        auto toSphere = std::views::transform(spheres.subspan(group.first, group.count),
+            [lod](const glm::vec4& s){ return Sphere{glm::vec3{s}, s.w, lod}; });
+        EM.insert<Sphere>(first, last, toSphere.begin());
+    }
+
+    if (!velocities.empty()) {
+        auto toPhysics = std::views::transform(velocities, [](const glm::vec4& v){ return Physics{glm::vec3{v}, v.w}; });
+        EM.insert<Physics>(entities.begin(), entities.end(), toPhysics.begin());
+    } else {
+        auto toPhysics = std::views::transform(spheres, [](const glm::vec4& s){ return Physics{glm::vec3{0.f}, 10.f * s.w * s.w}; });
+        EM.insert<Physics>(entities.begin(), entities.end(), toPhysics.begin());
+    }
+
+    // Put the group in file order. Entities were created in file order, so this is a sort by entity,
+    // which the sort functor skips if the group is already in that order.
+    auto group = EM.group<Sphere, Physics>();
+    group.sort([](const entt::entity lhs, const entt::entity rhs){ return lhs < rhs; }, StableSort{});
+
+    groups = {};
+    for (const auto& fileGroup : sceneGroups) {
+        auto& range = groups[std::min(fileGroup.LOD, 1u)];
+        if (range.count == 0)
+            range.first = fileGroup.first;
+        range.count += fileGroup.count;
+    }
+}
+
+// Expects the simulation to be locked
+bool Scene::saveScene(const std::filesystem::path& path) {
+    if (bGpuAnimation)
+        downloadGpuState();
+    std::vector<glm::vec4> spheres, velocities;
+    gatherState(spheres, velocities);
+
+    std::vector<io::SceneGroup> fileGroups;
+    for (glm::uint lod{0}; lod < groups.size(); ++lod)
+        if (0 < groups[lod].count)
+            fileGroups.push_back({groups[lod].first, groups[lod].count, lod});
+
+    return io::saveScene(path, fileGroups, spheres, velocities);
+}
+
+std::vector<glm::vec4> Scene::sortGroups(bool bSpatial) {
+    // Owning group, so Sphere and Physics are packed in the same order. Sorting it by render group
+    // (stable, to keep creation order within a group) makes iteration order match scene buffer order.
+    auto group = EM.group<Sphere, Physics>();
+    group.sort<Sphere>([](const Sphere& lhs, const Sphere& rhs){ return lhs.LOD < rhs.LOD; }, StableSort{});
+
+    groups = {};
+    glm::uint index{0};
+    for (auto [entity, trans, phys] : group.each()) {
+        auto& range = groups[std::min(trans.LOD, 1u)];
+        if (range.count == 0)
+            range.first = index;
+        ++range.count;
+        ++index;
+    }
+    if (bSpatial)
+        sortSpatially();
+
+    std::vector<glm::vec4> positions;
+    positions.reserve(group.size());
+    for (auto [entity, trans, phys] : group.each())
+        positions.emplace_back(trans.pos, trans.radius);
+    return positions;
+}
+
+std::vector<glm::uint> Scene::sortSpatially() {
+    auto group = EM.group<Sphere, Physics>();
+    std::vector<glm::vec4> spheres(group.size());
+    parallelFor(spheres.size(), [&](std::size_t begin, std::size_t end){
+        for (auto i{begin}; i < end; ++i) {
+            const auto& sphere = group.get<Sphere>(group[i]);
+            spheres[i] = glm::vec4{sphere.pos, sphere.radius};
+        }
+    });
+    std::vector<glm::uvec2> ranges;
+    for (const auto& range : groups)
+        ranges.emplace_back(range.first, range.count);
+    const auto order = util::mortonOrder(spheres, ranges);
+
+    // New index of every sphere, and the same by entity for the sort
+    std::vector<glm::uint> newIndices(order.size());
+    for (std::size_t i{0}; i < order.size(); ++i)
+        newIndices[order[i]] = static_cast<glm::uint>(i);
+    std::vector<glm::uint> ranks;
+    for (std::size_t i{0}; i < spheres.size(); ++i) {
+        const auto entity = entt::to_entity(group[i]);
+        if (ranks.size() <= entity)
+            ranks.resize(entity + 1);
+        ranks[entity] = newIndices[i];
+    }
+    group.sort([](const entt::entity, const entt::entity){ return false; }, RankSort{ranks});
+    return newIndices;
+}
+
+void Scene::reorderSpheres() {
+    auto simulationLock = simulation->lock();
+    // A recording has to stay in the order it started in
+    if (recorder || sceneSize == 0)
+        return;
+
+    if (bGpuAnimation)
+        downloadGpuState();
+    const auto newIndices = sortSpatially();
+    ++reorderCount;
+    reorderStep = simulation->getStepCount();
+    // The snapshots in flight are in the old order, the scene buffer is brought up to date from the entities instead
+    bInterpolating = false;
+    markSceneChanged(0, static_cast<glm::uint>(sceneSize));
+    if (bGpuAnimation)
+        uploadGpuState();
+
+    selectedSphere = static_cast<int>(newIndices[static_cast<std::size_t>(selectedSphere)]);
+    auto visibility = visibilityBuffer->getBufferData<glm::uint>(sceneSize);
+    std::vector<glm::uint> remapped(sceneSize);
+    for (std::size_t i{0}; i < sceneSize; ++i)
+        remapped[newIndices[i]] = visibility[i];
+    visibilityBuffer->updateBuffer(remapped);
+    pickBvh = {};
+    fluid.invalidate();
+}
+
+// Sets the planes (normalized, facing into the frustum), view matrix and near plane distance used by the cull shaders
+static void frustumUniforms(unsigned int shaderId, const glm::mat4& MVP, const glm::mat4& viewMatrix, const glm::mat4& projectionMatrix) {
+    // Gribb-Hartmann: every plane is the last row of the matrix plus or minus one of the others
+    std::array<glm::vec4, 6> planes;
+    const auto transposed = glm::transpose(MVP);
+    for (int i{0}; i < 3; ++i) {
+        planes[2 * i] = transposed[3] + transposed[i];
+        planes[2 * i + 1] = transposed[3] - transposed[i];
+    }
+    for (auto& plane : planes)
+        plane /= glm::length(glm::vec3{plane});
+
+    // Drawn distances are measured from the near plane, which is at most this far from the eye
+    auto nearCorner = glm::inverse(projectionMatrix) * glm::vec4{1.f, 1.f, -1.f, 1.f};
+    nearCorner /= nearCorner.w;
+
+    glUniform4fv(glGetUniformLocation(shaderId, "planes"), static_cast<GLsizei>(planes.size()), &planes[0].x);
+    uniform(shaderId, "modelViewMatrix", viewMatrix);
+    uniform(shaderId, "nearPlaneDistance", glm::length(glm::vec3{nearCorner}));
+    // Pixels covered by a unit length at distance 1
+    uniform(shaderId, "projectionScale", 0.5f * static_cast<float>(Settings::get().SCR_SIZE.y) * projectionMatrix[1][1]);
+}
+
+std::pair<VertexArray*, std::size_t> Scene::bindSceneSource() {
+    if (trajectorySlot)
+        return {trajectoryBuffer.get(), *trajectorySlot * sceneSize};
+
+    if (bGpuAnimation)
+        return {gpuSceneBuffer.get(), 0};
+
+    if (bQuantized) {
+        // Both rings are acquired together, so their current regions belong together
+        const auto region = quantizedRing->currentIndex();
+        clusterBuffer->bindRange(static_cast<GLsizeiptr>(clusterRing->getRegionSize()), 2, static_cast<GLintptr>(region * clusterRing->getRegionSize()));
+        radiusBuffer->bindBase(3);
+        return {quantizedBuffer.get(), region * sceneSize};
+    }
+
+    // The region last written to
+    return {sceneBuffer.get(), sceneRing->currentIndex() * sceneSize};
+}
+
+bool Scene::beginCulling(const glm::mat4& MVP, const glm::mat4& viewMatrix, const glm::mat4& projectionMatrix, bool bQuantizedSource, float splatRadiusScale) {
+    const auto program = bQuantizedSource ? "cullQuantized" : "cull";
+    if (!shaders.contains(program))
+        return false;
+    cullShaderId = *shaders.at(program);
+
+    // Counts start at zero. Each list has room for the whole scene, and a group's indices start where the group does.
+    std::vector<DrawElementsIndirectCommand> commands;
+    for (const auto& range : groups)
+        for (glm::uint list{0}; list < static_cast<glm::uint>(DrawList::Count); ++list)
+            commands.push_back({0, 1, list * static_cast<glm::uint>(sceneSize) + range.first, 0, 0});
+    cullCommandBuffer->updateBuffer(commands);
+
+    glUseProgram(cullShaderId);
+    frustumUniforms(cullShaderId, MVP, viewMatrix, projectionMatrix);
+    uniform(cullShaderId, "projectionMatrix", projectionMatrix);
+    uniform(cullShaderId, "splatPixels", bSplats ? splatPixels : 0.f);
+    uniform(cullShaderId, "splatRadiusScale", splatRadiusScale);
+    return true;
+}
+
+void Scene::cullGroup(glm::uint group, CullMode mode, DrawList list, float radiusScale, bool bWriteSplats) {
+    const auto& range = groups[group];
+    if (range.count == 0)
+        return;
+
+    const auto [source, baseVertex] = bindSceneSource();
+    source->vertexBuffer->bindBase(0, GL_SHADER_STORAGE_BUFFER);
+    cullCommandBuffer->bindBase(4, GL_SHADER_STORAGE_BUFFER);
+    cullIndexBuffer->bindBase(5, GL_SHADER_STORAGE_BUFFER);
+    visibilityBuffer->bindBase(6);
+    hiZTexture->bind(0);
+
+    const auto listIndex = static_cast<glm::uint>(list);
+    glUseProgram(cullShaderId);
+    uniform(cullShaderId, "mode", static_cast<glm::uint>(mode));
+    uniform(cullShaderId, "radiusScale", radiusScale);
+    uniform(cullShaderId, "baseVertex", static_cast<glm::uint>(baseVertex));
+    uniform(cullShaderId, "first", range.first);
+    uniform(cullShaderId, "count", range.count);
+    uniform(cullShaderId, "commandIndex", group * static_cast<glm::uint>(DrawList::Count) + listIndex);
+    uniform(cullShaderId, "firstIndex", listIndex * static_cast<glm::uint>(sceneSize) + range.first);
+    const auto splatIndex = static_cast<glm::uint>(DrawList::Splats);
+    uniform(cullShaderId, "writeSplats", static_cast<glm::uint>(bWriteSplats));
+    uniform(cullShaderId, "splatCommand", group * static_cast<glm::uint>(DrawList::Count) + splatIndex);
+    uniform(cullShaderId, "splatFirstIndex", splatIndex * static_cast<glm::uint>(sceneSize) + range.first);
+    glDispatchCompute((range.count + 255) / 256, 1, 1);
+    // The visibility written by CullMode::Refine is read by the next frame's cull
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+void Scene::buildHiZ(Tex2D& positions) {
+    const auto shaderId = *shaders.at("hiZ");
+    glUseProgram(shaderId);
+    positions.bind(0);
+
+    for (GLsizei level{0}; level < hiZTexture->levels(); ++level) {
+        const auto size = glm::max(glm::ivec2{hiZTexture->texSize.x >> level, hiZTexture->texSize.y >> level}, glm::ivec2{1});
+        glBindImageTexture(0, hiZTexture->id, std::max(level - 1, 0), GL_FALSE, 0, GL_READ_ONLY, GL_R32F);
+        glBindImageTexture(1, hiZTexture->id, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+        uniform(shaderId, "level", static_cast<glm::uint>(level));
+        glDispatchCompute((static_cast<glm::uint>(size.x) + 15) / 16, (static_cast<glm::uint>(size.y) + 15) / 16, 1);
+        glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+    }
+    glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+}
+
+void Scene::updateLod() {
+    if (lodBuild.valid() && lodBuild.wait_for(std::chrono::seconds{0}) == std::future_status::ready && lodBuildReorders != reorderCount) {
+        // The leaves index spheres that have moved since, and the scene is stale anyway
+        lodBuild.get();
+    } else if (lodBuild.valid() && lodBuild.wait_for(std::chrono::seconds{0}) == std::future_status::ready) {
+        const auto hierarchy = lodBuild.get();
+        if (!lodBuffer) {
+            lodBuffer = std::make_shared<VertexArray>();
+            lodClusterBuffer = std::make_shared<Buffer<GL_SHADER_STORAGE_BUFFER>>();
+            lodLeafBuffer = std::make_shared<Buffer<GL_SHADER_STORAGE_BUFFER>>();
         }
+        // Reallocating lets the driver keep the old storage around for draws still in flight
+        lodBuffer->vertexBuffer->bufferData(hierarchy.spheres, GL_DYNAMIC_DRAW);
+        lodBuffer->vertexAttribute(0, 4, GL_FLOAT, GL_FALSE);
+        lodClusterBuffer->bufferData(hierarchy.clusters, GL_DYNAMIC_DRAW);
+        lodLeafBuffer->bufferData(hierarchy.leafIndices, GL_DYNAMIC_DRAW);
+        lodGroupClusters = hierarchy.groupClusters;
+        lodCellSizes = hierarchy.cellSizes;
+        lodSphereCount = hierarchy.spheres.size();
     }
 
-    sceneBuffer->vertexBuffer->updateBuffer(positions);
-    sceneBuffer2->vertexBuffer->updateBuffer(positions2);
-}
\ No newline at end of file
+    if (!bLod || lodBuild.valid() || !bLodStale)
+        return;
+    bLodStale = false;
+    lodBuildReorders = reorderCount;
+
+    // Built from a copy, so the scene can keep changing meanwhile
+    std::vector<glm::vec4> spheres;
+    copySpheres(spheres);
+    std::vector<glm::uvec2> ranges;
+    for (const auto& range : groups)
+        ranges.emplace_back(range.first, range.count);
+    lodBuild = jobs::async([spheres = std::move(spheres), ranges = std::move(ranges)]{
+        return util::buildLodHierarchy(spheres, ranges);
+    });
+}
+
+void Scene::selectLod(const glm::mat4& MVP, const glm::mat4& viewMatrix, const glm::mat4& projectionMatrix, float radiusScale) {
+    const auto shaderId = *shaders.at("lod");
+    const auto [source, baseVertex] = bindSceneSource();
+    cullCommandBuffer->bindBase(4, GL_SHADER_STORAGE_BUFFER);
+    cullIndexBuffer->bindBase(5, GL_SHADER_STORAGE_BUFFER);
+    lodClusterBuffer->bindBase(7);
+    lodLeafBuffer->bindBase(8);
+
+    glUseProgram(shaderId);
+    frustumUniforms(shaderId, MVP, viewMatrix, projectionMatrix);
+    uniform(shaderId, "radiusScale", radiusScale);
+    uniform(shaderId, "baseVertex", static_cast<glm::uint>(baseVertex));
+    uniform(shaderId, "cellSizes", lodCellSizes);
+    uniform(shaderId, "pixelThreshold", lodPixels);
+
+    constexpr glm::uint MAX_GROUPS_X = 65535;
+    const auto lists = static_cast<glm::uint>(DrawList::Count);
+    for (glm::uint i{0}; i < std::min(groups.size(), lodGroupClusters.size()); ++i) {
+        const auto clusters = lodGroupClusters[i];
+        if (clusters.y == 0)
+            continue;
+        const auto sceneFirst = static_cast<glm::uint>(DrawList::Spheres) * static_cast<glm::uint>(sceneSize) + groups[i].first;
+        const auto lodFirst = static_cast<glm::uint>(DrawList::Lod) * static_cast<glm::uint>(sceneSize) + groups[i].first;
+        uniform(shaderId, "clusterFirst", clusters.x);
+        uniform(shaderId, "clusterCount", clusters.y);
+        uniform(shaderId, "sceneCommand", i * lists + static_cast<glm::uint>(DrawList::Spheres));
+        uniform(shaderId, "sceneFirstIndex", sceneFirst);
+        uniform(shaderId, "lodCommand", i * lists + static_cast<glm::uint>(DrawList::Lod));
+        uniform(shaderId, "lodFirstIndex", lodFirst);
+        glDispatchCompute(std::min(clusters.y, MAX_GROUPS_X), (clusters.y + MAX_GROUPS_X - 1) / MAX_GROUPS_X, 1);
+    }
+}
+
+// Match the stages of lbvh.comp.glsl and the modes of radixsort.comp.glsl
+enum class LbvhStage : glm::uint {
+    Bounds = 0,
+    Morton,
+    Build,
+    Fit
+};
+
+enum class RadixMode : glm::uint {
+    Count = 0,
+    Scan,
+    Scatter
+};
+
+bool Scene::buildLbvh(float radiusScale, bool bQuantizedSource) {
+    const auto program = bQuantizedSource ? "lbvhQuantized" : "lbvh";
+    if (!shaders.contains(program) || !shaders.contains("radixSort"))
+        return false;
+    const auto shaderId = *shaders.at(program);
+    const auto sortShaderId = *shaders.at("radixSort");
+
+    // Allocated on first use. Keys and values have an input and an output half for the sort,
+    // and every group of n spheres has n - 1 inner nodes and n leaves.
+    if (!lbvhNodeBuffer) {
+        lbvhKeyBuffer = std::make_shared<Buffer<GL_SHADER_STORAGE_BUFFER>>(sizeof(glm::uint) * 2 * sceneSize, GL_DYNAMIC_COPY);
+        lbvhValueBuffer = std::make_shared<Buffer<GL_SHADER_STORAGE_BUFFER>>(sizeof(glm::uint) * 2 * sceneSize, GL_DYNAMIC_COPY);
+        lbvhHistogramBuffer = std::make_shared<Buffer<GL_SHADER_STORAGE_BUFFER>>(sizeof(glm::uint) * 16 * ((sceneSize + 255) / 256), GL_DYNAMIC_COPY);
+        lbvhBoundsBuffer = std::make_shared<Buffer<GL_SHADER_STORAGE_BUFFER>>(sizeof(glm::uint) * 6 * groups.size(), GL_DYNAMIC_COPY);
+        lbvhNodeBuffer = std::make_shared<Buffer<GL_SHADER_STORAGE_BUFFER>>(2 * sizeof(glm::vec4) * 2 * sceneSize, GL_DYNAMIC_COPY);
+        lbvhLinkBuffer = std::make_shared<Buffer<GL_SHADER_STORAGE_BUFFER>>(sizeof(glm::uvec2) * 2 * sceneSize, GL_DYNAMIC_COPY);
+        lbvhSphereBuffer = std::make_shared<Buffer<GL_SHADER_STORAGE_BUFFER>>(sizeof(glm::vec4) * sceneSize, GL_DYNAMIC_COPY);
+    }
+
+    // Empty bounds, as the order preserving uints of lbvh.comp.glsl
+    std::vector<glm::uint> bounds;
+    for (std::size_t i{0}; i < groups.size(); ++i)
+        bounds.insert(bounds.end(), {~0u, ~0u, ~0u, 0u, 0u, 0u});
+    lbvhBoundsBuffer->updateBuffer(bounds);
+
+    const auto [source, baseVertex] = bindSceneSource();
+    source->vertexBuffer->bindBase(0, GL_SHADER_STORAGE_BUFFER);
+    lbvhBoundsBuffer->bindBase(1);
+    lbvhKeyBuffer->bindBase(4);
+    lbvhValueBuffer->bindBase(5);
+    lbvhNodeBuffer->bindBase(6);
+    lbvhLinkBuffer->bindBase(7);
+    lbvhSphereBuffer->bindBase(8);
+    lbvhHistogramBuffer->bindBase(9);
+
+    const auto dispatch = [](glm::uint count){
+        glDispatchCompute((count + 255) / 256, 1, 1);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    };
+    for (glm::uint group{0}; group < groups.size(); ++group) {
+        const auto& range = groups[group];
+        if (range.count == 0)
+            continue;
+
+        glUseProgram(shaderId);
+        uniform(shaderId, "group", group);
+        uniform(shaderId, "first", range.first);
+        uniform(shaderId, "count", range.count);
+        uniform(shaderId, "baseVertex", static_cast<glm::uint>(baseVertex));
+        uniform(shaderId, "radiusScale", radiusScale);
+        for (const auto stage : {LbvhStage::Bounds, LbvhStage::Morton}) {
+            uniform(shaderId, "stage", static_cast<glm::uint>(stage));
+            dispatch(range.count);
+        }
+
+        // Eight 4-bit passes over the 30-bit codes, ping-ponging between the halves and ending up in the first
+        glUseProgram(sortShaderId);
+        uniform(sortShaderId, "first", range.first);
+        uniform(sortShaderId, "count", range.count);
+        for (glm::uint pass{0}; pass < 8; ++pass) {
+            uniform(sortShaderId, "shift", 4 * pass);
+            uniform(sortShaderId, "inputOffset", static_cast<glm::uint>(pass % 2 * sceneSize));
+            uniform(sortShaderId, "outputOffset", static_cast<glm::uint>((pass + 1) % 2 * sceneSize));
+            uniform(sortShaderId, "mode", static_cast<glm::uint>(RadixMode::Count));
+            dispatch(range.count);
+            uniform(sortShaderId, "mode", static_cast<glm::uint>(RadixMode::Scan));
+            glDispatchCompute(1, 1, 1);
+            glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+            uniform(sortShaderId, "mode", static_cast<glm::uint>(RadixMode::Scatter));
+            dispatch(range.count);
+        }
+
+        glUseProgram(shaderId);
+        for (const auto stage : {LbvhStage::Build, LbvhStage::Fit}) {
+            uniform(shaderId, "stage", static_cast<glm::uint>(stage));
+            dispatch(range.count);
+        }
+    }
+    return true;
+}
+
+void Scene::traceScene(const glm::mat4& MVP, const glm::mat4& MVPInverse, float radiusScale, float smoothing, float interpolation) {
+    glClearColor(0.2f, 0.3f, 0.3f, 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    if (!shaders.contains("trace"))
+        return;
+
+    const auto shaderId = *shaders.at("trace");
+    glUseProgram(shaderId);
+    lbvhNodeBuffer->bindBase(6);
+    lbvhSphereBuffer->bindBase(8);
+    uniform(shaderId, "MVP", MVP);
+    uniform(shaderId, "MVPInverse", MVPInverse);
+    uniform(shaderId, "radiusScale", radiusScale);
+    uniform(shaderId, "smoothing", smoothing);
+    uniform(shaderId, "interpolation", interpolation);
+    // The root of a group is its first node
+    glUniform2ui(glGetUniformLocation(shaderId, "roots"), 2 * groups[0].first, 2 * groups[1].first);
+    glUniform2ui(glGetUniformLocation(shaderId, "counts"), groups[0].count, groups[1].count);
+
+    // Writes depth like the surface pass
+    glEnable(GL_DEPTH_TEST);
+    glDepthFunc(GL_ALWAYS);
+    screenMesh.draw();
+    glDepthFunc(GL_LESS);
+    glDisable(GL_DEPTH_TEST);
+}
+
+void Scene::drawScene(glm::uint group, std::optional<DrawList> list) {
+    const auto& range = groups[group];
+    // LOD spheres have a buffer of their own
+    const auto [source, baseVertex] = list == DrawList::Lod ? std::pair{lodBuffer.get(), std::size_t{0}} : bindSceneSource();
+    auto g = source->guard();
+
+    if (list) {
+        // Binding the index buffer attaches it to the bound vertex array
+        const auto command = group * static_cast<glm::uint>(DrawList::Count) + static_cast<glm::uint>(*list);
+        cullIndexBuffer->bind();
+        cullCommandBuffer->bind();
+        glDrawElementsIndirect(GL_POINTS, GL_UNSIGNED_INT, reinterpret_cast<const void*>(command * sizeof(DrawElementsIndirectCommand)));
+        cullCommandBuffer->unbind();
+        return;
+    }
+
+    glDrawArrays(GL_POINTS, static_cast<GLint>(baseVertex + range.first), static_cast<GLsizei>(range.count));
+}
+
+void Scene::onSphereUpdate(entt::registry& registry, entt::entity entity) {
+    const auto group = registry.group<Sphere, Physics>();
+    const auto index = static_cast<glm::uint>(group.find(entity) - group.begin());
+    markSceneChanged(index, 1);
+}
+
+void Scene::markSceneChanged(glm::uint first, glm::uint count) {
+    for (auto& changes : regionChanges)
+        changes.mark(first, count);
+    bLodStale = true;
+    if (bGpuAnimation)
+        gpuChanges.mark(first, count);
+    bSceneEdited = true;
+}
+
+void Scene::uploadChanges() {
+    // While interpolating, every frame is a full upload anyway and the edits arrive with the next snapshot
+    if (!bSceneEdited || (bInterpolating && !bGpuAnimation))
+        return;
+    bSceneEdited = false;
+
+    auto simulationLock = simulation->lock();
+    if (bQuantized && !bGpuAnimation) {
+        // Edits are rare, so they requantize everything. The scene buffer regions stay marked for when quantization is turned off.
+        quantizeEntities();
+        return;
+    }
+
+    const auto group = EM.group<Sphere, Physics>();
+    auto& changes = bGpuAnimation ? gpuChanges : regionChanges[sceneRing->acquire()];
+    const auto& ranges = changes.merged();
+    lastUploadCount = changes.elementCount();
+    lastUploadRanges = ranges.size();
+
+    if (bGpuAnimation) {
+        // Only positions are edited, velocities stay on the GPU
+        std::vector<glm::vec4> spheres;
+        for (const auto& range : ranges) {
+            spheres.clear();
+            for (auto i{range.first}; i < range.end(); ++i) {
+                const auto& sphere = group.get<Sphere>(group[i]);
+                spheres.emplace_back(sphere.pos, sphere.radius);
+            }
+            gpuSceneBuffer->vertexBuffer->updateBufferRange<glm::vec4>(spheres, range.first);
+        }
+    } else {
+        // The acquired region is brought up to date, including edits it missed while it was in use
+        const auto positions = sceneRing->currentRegion<glm::vec4>();
+        for (const auto& range : ranges) {
+            for (auto i{range.first}; i < range.end(); ++i) {
+                const auto& sphere = group.get<Sphere>(group[i]);
+                positions[i] = glm::vec4{sphere.pos, sphere.radius};
+            }
+        }
+    }
+    changes.clear();
+}
+
+void Scene::editSpheres() {
+    static int jitterCount = 10;
+
+    if (!ImGui::TreeNode("Edit spheres"))
+        return;
+    if (sceneSize == 0) {
+        ImGui::TextDisabled("No spheres to edit");
+        ImGui::TreePop();
+        return;
+    }
+
+    const auto group = EM.group<Sphere, Physics>();
+    ImGui::SliderInt("Sphere", &selectedSphere, 0, static_cast<int>(sceneSize) - 1);
+    ImGui::SameLine();
+    ImGui::TextDisabled("(or click it)");
+    const auto entity = group[static_cast<std::size_t>(selectedSphere)];
+    auto sphere = EM.get<Sphere>(entity);
+    if (ImGui::DragFloat3("Position", &sphere.pos.x, 0.001f) | ImGui::DragFloat("Sphere radius", &sphere.radius, 0.001f, 0.001f, 0.5f))
+        EM.replace<Sphere>(entity, sphere);
+
+    ImGui::DragInt("Count", &jitterCount, 1.f, 1, static_cast<int>(sceneSize));
+    if (ImGui::Button("Jitter random spheres"))
+        for (int i{0}; i < jitterCount; ++i)
+            EM.patch<Sphere>(group[static_cast<std::size_t>(glm::linearRand(0, static_cast<int>(sceneSize) - 1))], [](Sphere& s){ s.pos += glm::ballRand(0.01f); });
+
+    ImGui::Text("Last upload: %zu spheres in %zu ranges", lastUploadCount, lastUploadRanges);
+    ImGui::TreePop();
+}
+
+void Scene::interpolatePositions() {
+    // Render one snapshot interval behind the simulation, interpolating between the last two snapshots
+    if (snapshots.update()) {
+        // Stepped before the spheres were reordered
+        if (snapshots.readBuffer().step <= reorderStep)
+            return;
+        bInterpolating = true;
+        bLodStale = true;
+    }
+
+    if (!bInterpolating)
+        return;
+
+    const auto& current = snapshots.readBuffer();
+    const auto& previous = snapshots.readBuffer(1);
+    const auto interval = current.timestamp - previous.timestamp;
+    // Don't interpolate over gaps much longer than a timestep (e.g. after the simulation was paused)
+    const auto maxInterval = std::chrono::duration<float>{simulation->getTimestep() * 16.f};
+    float alpha{1.f};
+    if (0 < interval.count() && interval < maxInterval && previous.positions.size() == sceneSize && reorderStep < previous.step) {
+        const auto sinceLatest = std::chrono::steady_clock::now() - current.timestamp;
+        alpha = std::clamp(std::chrono::duration<float>{sinceLatest} / std::chrono::duration<float>{interval}, 0.f, 1.f);
+    }
+
+    // Write straight into the next free region of the mapped buffer, or into a staging copy to be quantized
+    std::optional<std::size_t> region;
+    std::span<glm::vec4> positions;
+    if (bQuantized) {
+        quantizeSource.resize(sceneSize);
+        positions = quantizeSource;
+    } else {
+        region = sceneRing->acquire();
+        positions = sceneRing->region<glm::vec4>(*region);
+    }
+    util::parallelFor(sceneSize, [&](std::size_t begin, std::size_t end){
+        if (alpha < 1.f)
+            for (auto i{begin}; i < end; ++i)
+                positions[i] = glm::mix(previous.positions[i], current.positions[i], alpha);
+        else
+            std::copy(current.positions.begin() + begin, current.positions.begin() + end, positions.begin() + begin);
+    });
+    // Edits made meanwhile may have changed radii, so the table is rebuilt from what's quantized until they've been uploaded
+    if (bQuantized)
+        quantizeScene(positions, bSceneEdited);
+
+    // The other regions are now entirely out of date
+    for (std::size_t i{0}; i < regionChanges.size(); ++i) {
+        regionChanges[i].clear();
+        if (i != region)
+            regionChanges[i].mark(0, static_cast<std::uint32_t>(sceneSize));
+    }
+
+    // Once we've caught up with the latest snapshot there's nothing new to upload
+    if (1.f <= alpha)
+        bInterpolating = false;
+}
+
+void Scene::animate(float deltaTime, sim::Snapshot& out) {
+    // The GPU path owns the simulation state while enabled
+    if (bGpuAnimation)
+        return;
+
+    out.positions.resize(sceneSize);
+
+    if (simulationMode == SimulationMode::NBody)
+        animateGravity(deltaTime, out);
+    else if (simulationMode == SimulationMode::Fluid)
+        animateFluid(deltaTime, out);
+    else
+        animateOrbits(deltaTime, out);
+
+    if (bCollisions)
+        collideSpheres(out);
+
+    if (recorder)
+        recorder->append(out.positions);
+}
+
+void Scene::setQuantized(bool enabled) {
+    if (enabled == bQuantized)
+        return;
+    bQuantized = enabled;
+
+    if (!enabled) {
+        quantizedRing.reset();
+        quantizedBuffer.reset();
+        clusterRing.reset();
+        clusterBuffer.reset();
+        radiusBuffer.reset();
+        quantizeSource = {};
+        // The scene buffer missed everything that happened meanwhile
+        markSceneChanged(0, static_cast<glm::uint>(sceneSize));
+        return;
+    }
+
+    quantizedBuffer = std::make_shared<VertexArray>();
+    quantizedRing = std::make_unique<RingBuffer<GL_ARRAY_BUFFER>>(*quantizedBuffer->vertexBuffer, sizeof(glm::uvec2) * sceneSize, SCENE_BUFFER_REGIONS);
+    quantizedBuffer->vertexAttributeInteger(0, 2, GL_UNSIGNED_INT);
+
+    // Cluster regions are bound as ranges, so they have to start at aligned offsets
+    GLint alignment{1};
+    glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    const std::size_t clusterCount = (sceneSize + util::QUANTIZATION_CLUSTER_SIZE - 1) / util::QUANTIZATION_CLUSTER_SIZE;
+    const std::size_t clusterBytes = sizeof(util::QuantizedCluster) * clusterCount;
+    const auto align = static_cast<std::size_t>(std::max(alignment, 1));
+    clusterBuffer = std::make_shared<Buffer<GL_SHADER_STORAGE_BUFFER>>();
+    clusterRing = std::make_unique<RingBuffer<GL_SHADER_STORAGE_BUFFER>>(*clusterBuffer, (clusterBytes + align - 1) / align * align, SCENE_BUFFER_REGIONS);
+    radiusBuffer = std::make_shared<Buffer<GL_SHADER_STORAGE_BUFFER>>(sizeof(float) * util::RADIUS_TABLE_SIZE, GL_DYNAMIC_DRAW);
+
+    quantizeEntities();
+}
+
+void Scene::quantizeEntities() {
+    // Radii only change through edits, which end up here once the scene isn't interpolating
+    const auto group = EM.group<Sphere, Physics>();
+    quantizeSource.resize(sceneSize);
+    util::parallelFor(sceneSize, [&](std::size_t begin, std::size_t end){
+        for (auto i{begin}; i < end; ++i) {
+            const auto& sphere = group.get<Sphere>(group[i]);
+            quantizeSource[i] = glm::vec4{sphere.pos, sphere.radius};
+        }
+    });
+    quantizeScene(quantizeSource, true);
+}
+
+void Scene::quantizeScene(std::span<const glm::vec4> spheres, bool bRadiiChanged) {
+    if (bRadiiChanged) {
+        radiusTable.build(spheres);
+        radiusBuffer->updateBuffer(radiusTable.values());
+    }
+
+    const auto region = quantizedRing->acquire();
+    clusterRing->acquire();
+    const auto clusterCount = (sceneSize + util::QUANTIZATION_CLUSTER_SIZE - 1) / util::QUANTIZATION_CLUSTER_SIZE;
+    util::quantizeSpheres(spheres, radiusTable, quantizedRing->region<glm::uvec2>(region),
+        clusterRing->region<util::QuantizedCluster>(region).first(clusterCount));
+}
+
+bool Scene::loadTrajectory(const std::filesystem::path& path) {
+    // The reader owns the file, which lives until the streamer is gone
+    io::FrameStreamer::FrameReader reader;
+    std::size_t frameCount{0}, sphereCount{0};
+    float frameRate{30.f};
+    const auto useFile = [&](auto&& file){
+        if (!file)
+            return;
+        frameCount = file->frameCount();
+        sphereCount = file->sphereCount();
+        frameRate = file->framesPerSecond();
+        auto shared = std::make_shared<std::remove_reference_t<decltype(*file)>>(std::move(*file));
+        reader = [shared](std::size_t frame, std::span<glm::vec4> out){ return shared->readFrame(frame, out); };
+    };
+    if (path.extension() == ".ctraj")
+        useFile(io::CompressedTrajectory::open(path));
+    else
+        useFile(io::TrajectoryFile::open(path));
+
+    if (!reader)
+        return false;
+    if (sphereCount != sceneSize) {
+        std::cout << std::format("TRAJECTORY ERROR: \"{}\" has {} spheres, the scene has {}.", path.string(), sphereCount, sceneSize) << std::endl;
+        return false;
+    }
+
+    closeTrajectory();
+    trajectoryFrames = frameCount;
+    trajectoryRate = frameRate;
+
+    trajectoryBuffer = std::make_shared<VertexArray>();
+    trajectoryRing = std::make_unique<RingBuffer<GL_ARRAY_BUFFER>>(*trajectoryBuffer->vertexBuffer, sizeof(glm::vec4) * sceneSize, TRAJECTORY_SLOTS);
+    trajectoryBuffer->vertexAttribute(0, 4, GL_FLOAT, GL_FALSE);
+
+    std::vector<std::span<glm::vec4>> slots;
+    for (std::size_t i{0}; i < TRAJECTORY_SLOTS; ++i)
+        slots.push_back(trajectoryRing->region<glm::vec4>(i));
+    playhead = 0.f;
+    trajectoryStreamer = std::make_unique<io::FrameStreamer>(std::move(reader), frameCount, slots);
+
+    std::cout << std::format("Loaded trajectory with {} frames", frameCount) << std::endl;
+    return true;
+}
+
+void Scene::closeTrajectory() {
+    // The streamer writes into the slots, so it goes first
+    trajectoryStreamer.reset();
+    trajectorySlot.reset();
+    retiredSlots.clear();
+    trajectoryRing.reset();
+    trajectoryBuffer.reset();
+    trajectoryFrames = 0;
+}
+
+void Scene::updateTrajectory(float deltaTime) {
+    // Hand slots back to the streamer once the GPU is done drawing them
+    std::erase_if(retiredSlots, [this](std::size_t slot){
+        if (!trajectoryRing->isIdle(slot))
+            return false;
+        trajectoryStreamer->release(slot);
+        return true;
+    });
+
+    const auto frameCount = static_cast<float>(trajectoryFrames);
+    if (bPlaying)
+        playhead = std::fmod(playhead + deltaTime * trajectoryRate * playbackSpeed + frameCount, frameCount);
+    const auto frame = std::min(static_cast<std::size_t>(playhead), trajectoryFrames - 1);
+
+    // Never waits: if the frame isn't loaded yet, the last one stays on screen
+    trajectoryStreamer->seek(frame, playbackSpeed < 0.f);
+    if (const auto slot = trajectoryStreamer->present(frame)) {
+        if (trajectorySlot) {
+            trajectoryRing->fence(*trajectorySlot);
+            retiredSlots.push_back(*trajectorySlot);
+        }
+        trajectorySlot = slot;
+    }
+}
+
+void Scene::trajectoryMenu() {
+    if (!ImGui::TreeNode("Trajectory"))
+        return;
+
+    static char trajectoryPath[256] = "scene.traj";
+    ImGui::InputText("Trajectory file", trajectoryPath, sizeof(trajectoryPath));
+
+    if (trajectoryStreamer) {
+        ImGui::Checkbox("Play", &bPlaying);
+        ImGui::SameLine();
+        if (ImGui::Button("Close"))
+            closeTrajectory();
+    } else if (ImGui::Button("Play trajectory")) {
+        loadTrajectory(trajectoryPath);
+    }
+
+    if (trajectoryStreamer) {
+        const auto lastFrame = static_cast<float>(trajectoryFrames - 1);
+        ImGui::SliderFloat("Frame", &playhead, 0.f, lastFrame, "%.0f");
+        ImGui::DragFloat("Playback speed", &playbackSpeed, 0.05f, -10.f, 10.f);
+        ImGui::Text("Prefetched %zu, loaded %llu, dropped %llu, missed %llu", trajectoryStreamer->getReadyCount(),
+            static_cast<unsigned long long>(trajectoryStreamer->getLoadedCount()),
+            static_cast<unsigned long long>(trajectoryStreamer->getDroppedCount()),
+            static_cast<unsigned long long>(trajectoryStreamer->getMissCount()));
+    } else if (!recorder) {
+        if (ImGui::Button("Record simulation"))
+            recorder = io::TrajectoryWriter::create(trajectoryPath, sceneSize, 1.f / SIMULATION_TIMESTEP);
+    } else {
+        ImGui::Text("Recorded %zu frames", recorder->frameCount());
+        if (ImGui::Button("Stop recording")) {
+            if (!recorder->close())
+                std::cout << "Writing trajectory failed!" << std::endl;
+            recorder.reset();
+        }
+    }
+
+    ImGui::TreePop();
+}
+
+void Scene::collideSpheres(sim::Snapshot& out) {
+    gatherState(stateSpheres, stateVelocities);
+    grid.build(stateSpheres);
+    contactCount = sim::resolveCollisions(grid, stateSpheres, stateVelocities, collision);
+    scatterState(stateSpheres, stateVelocities);
+    std::copy(stateSpheres.begin(), stateSpheres.end(), out.positions.begin());
+}
+
+void Scene::animateFluid(float deltaTime, sim::Snapshot& out) {
+    gatherState(stateSpheres, stateVelocities);
+    fluid.step(stateSpheres, stateVelocities, deltaTime, fluidParams);
+    scatterState(stateSpheres, stateVelocities);
+    std::copy(stateSpheres.begin(), stateSpheres.end(), out.positions.begin());
+}
+
+void Scene::resetFluid() {
+    // Start from rest, and let the spheres fall into the box
+    for (auto [entity, trans, phys] : EM.group<Sphere, Physics>().each())
+        phys.velocity = glm::vec3{0.f};
+    fluid.invalidate();
+}
+
+void Scene::animateOrbits(float deltaTime, sim::Snapshot& out) {
+    // Group order is scene buffer order
+    auto group = EM.group<Sphere, Physics>();
+    util::parallelFor(group.size(), [&](std::size_t begin, std::size_t end){
+        for (auto i{begin}; i < end; ++i) {
+            auto [trans, phys] = group.get<Sphere, Physics>(group[i]);
+            sim::orbitStep(trans.pos, phys.velocity, deltaTime);
+            out.positions[i] = glm::vec4{trans.pos, trans.radius};
+        }
+    });
+}
+
+void Scene::gatherBodies() {
+    const auto group = EM.group<Sphere, Physics>();
+    bodies.resize(group.size());
+    util::parallelFor(bodies.size(), [&](std::size_t begin, std::size_t end){
+        for (auto i{begin}; i < end; ++i) {
+            const auto [trans, phys] = group.get<Sphere, Physics>(group[i]);
+            bodies[i] = glm::vec4{trans.pos, phys.mass * massScale};
+        }
+    });
+    accelerations.resize(bodies.size());
+}
+
+void Scene::animateGravity(float deltaTime, sim::Snapshot& out) {
+    gatherBodies();
+    octree.build(bodies);
+    octree.accelerations(accelerations, gravity);
+
+    // Semi-implicit Euler (symplectic)
+    auto group = EM.group<Sphere, Physics>();
+    util::parallelFor(group.size(), [&](std::size_t begin, std::size_t end){
+        for (auto i{begin}; i < end; ++i) {
+            auto [trans, phys] = group.get<Sphere, Physics>(group[i]);
+            phys.velocity += (accelerations[i] + sim::centerAcceleration(trans.pos, gravity)) * deltaTime;
+            trans.pos += phys.velocity * deltaTime;
+            out.positions[i] = glm::vec4{trans.pos, trans.radius};
+        }
+    });
+}
+
+void Scene::resetOrbitalVelocities() {
+    for (auto [entity, trans, phys] : EM.group<Sphere, Physics>().each()) {
+        const float r = glm::length(trans.pos);
+        if (r < 1e-6f)
+            continue;
+
+        // Keep the direction of travel, but make it tangential and
+        // multiply with mean orbital speed (https://en.wikipedia.org/wiki/Orbital_speed#Mean_orbital_speed):
+        const auto radial = trans.pos / r;
+        auto tangent = phys.velocity - radial * glm::dot(phys.velocity, radial);
+        if (glm::dot(tangent, tangent) < 1e-12f)
+            tangent = glm::cross(radial, glm::vec3{0.f, 1.f, 0.f});
+        phys.velocity = glm::normalize(tangent) * std::sqrt((G * PHYSICS_CENTER_MASS) / r);
+    }
+}
+
+void Scene::compareGravity() {
+    gatherBodies();
+    std::vector<glm::vec3> reference(bodies.size());
+
+    Timer<std::chrono::high_resolution_clock> timer{};
+    octree.build(bodies);
+    octree.accelerations(accelerations, gravity);
+    const auto bhTime = timer.elapsedReset<std::chrono::microseconds>();
+    sim::directSum(bodies, reference, gravity);
+    const auto directTime = timer.elapsedReset<std::chrono::microseconds>();
+
+    double error{0.0}, norm{0.0};
+    for (std::size_t i{0}; i < bodies.size(); ++i) {
+        const auto d = accelerations[i] - reference[i];
+        error += glm::dot(d, d);
+        norm += glm::dot(reference[i], reference[i]);
+    }
+
+    std::cout << std::format("Barnes-Hut (theta = {}): {}ms, direct sum: {}ms, relative RMS error: {}",
+        gravity.theta, bhTime * 0.001, directTime * 0.001, 0.0 < norm ? std::sqrt(error / norm) : 0.0) << std::endl;
+}
+
+void Scene::gatherState(std::vector<glm::vec4>& spheres, std::vector<glm::vec4>& velocities) {
+    const auto group = EM.group<Sphere, Physics>();
+    spheres.resize(group.size());
+    velocities.resize(group.size());
+    util::parallelFor(group.size(), [&](std::size_t begin, std::size_t end){
+        for (auto i{begin}; i < end; ++i) {
+            const auto [trans, phys] = group.get<Sphere, Physics>(group[i]);
+            spheres[i] = glm::vec4{trans.pos, trans.radius};
+            velocities[i] = glm::vec4{phys.velocity, phys.mass};
+        }
+    });
+}
+
+void Scene::copySpheres(std::vector<glm::vec4>& spheres) {
+    auto simulationLock = simulation->lock();
+    const auto group = EM.group<Sphere, Physics>();
+    spheres.resize(group.size());
+    util::parallelFor(spheres.size(), [&](std::size_t begin, std::size_t end){
+        for (auto i{begin}; i < end; ++i) {
+            const auto& sphere = group.get<Sphere>(group[i]);
+            spheres[i] = glm::vec4{sphere.pos, sphere.radius};
+        }
+    });
+}
+
+std::optional<glm::uint> Scene::pickSphere(const glm::mat4& MVPInverse, const glm::vec2& ndc) {
+    copySpheres(pickSpheres);
+    bool bRebuild = pickBvh.sphereCount() != pickSpheres.size();
+    if (!bRebuild) {
+        pickBvh.refit(pickSpheres);
+        bRebuild = 1.5f * pickBvhCost < pickBvh.cost();
+    }
+    if (bRebuild) {
+        accel::Bvh binary;
+        binary.build(pickSpheres);
+        pickBvh.collapse(binary, pickSpheres);
+        pickBvhCost = pickBvh.cost();
+    }
+
+    auto near = MVPInverse * glm::vec4{ndc, -1.f, 1.f};
+    auto far = MVPInverse * glm::vec4{ndc, 1.f, 1.f};
+    near /= near.w;
+    far /= far.w;
+    if (const auto hit = pickBvh.intersect(glm::vec3{near}, glm::vec3{far - near}, 1.f))
+        return hit->sphere;
+    return std::nullopt;
+}
+
+void Scene::scatterState(const std::vector<glm::vec4>& spheres, const std::vector<glm::vec4>& velocities) {
+    auto group = EM.group<Sphere, Physics>();
+    util::parallelFor(group.size(), [&](std::size_t begin, std::size_t end){
+        for (auto i{begin}; i < end; ++i) {
+            auto [trans, phys] = group.get<Sphere, Physics>(group[i]);
+            trans.pos = glm::vec3{spheres[i]};
+            phys.velocity = glm::vec3{velocities[i]};
+        }
+    });
+}
+
+void Scene::uploadGpuState() {
+    std::vector<glm::vec4> spheres, velocities;
+    gatherState(spheres, velocities);
+
+    // Allocated on first use, then reused
+    if (!gpuSceneBuffer) {
+        gpuSceneBuffer = std::make_shared<VertexArray>();
+        gpuSceneBuffer->vertexBuffer->bufferStorage(sizeof(glm::vec4) * spheres.size(), GL_DYNAMIC_STORAGE_BIT, spheres.data());
+        gpuSceneBuffer->vertexAttribute(0, 4, GL_FLOAT, GL_FALSE);
+        gpuSceneBuffer->unbind();
+        gpuVelocityBuffer = std::make_shared<Buffer<GL_SHADER_STORAGE_BUFFER>>();
+        gpuVelocityBuffer->bufferStorage(sizeof(glm::vec4) * velocities.size(), GL_DYNAMIC_STORAGE_BIT, velocities.data());
+    } else {
+        gpuSceneBuffer->vertexBuffer->updateBuffer(spheres);
+        gpuVelocityBuffer->updateBuffer(velocities);
+    }
+    gpuChanges.clear();
+    gpuAccumulator = 0.f;
+}
+
+void Scene::downloadGpuState() {
+    if (!gpuSceneBuffer)
+        return;
+
+    glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+    const auto spheres = gpuSceneBuffer->vertexBuffer->getBufferData<glm::vec4>(sceneSize);
+    const auto velocities = gpuVelocityBuffer->getBufferData<glm::vec4>(sceneSize);
+    scatterState(spheres, velocities);
+    // The scene buffer still holds the positions from before the GPU took over
+    markSceneChanged(0, static_cast<glm::uint>(sceneSize));
+}
+
+void Scene::dispatchAnimation(float deltaTime, unsigned int steps) {
+    const auto count = static_cast<glm::uint>(sceneSize);
+    const auto shaderId = *shaders.at("animate");
+    glUseProgram(shaderId);
+    uniform(shaderId, "deltaTime", deltaTime);
+    uniform(shaderId, "sphereCount", count);
+
+    gpuSceneBuffer->vertexBuffer->bindBase(0, GL_SHADER_STORAGE_BUFFER);
+    gpuVelocityBuffer->bindBase(1);
+
+    for (unsigned int i{0}; i < steps; ++i) {
+        glDispatchCompute((count + 255) / 256, 1, 1);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    }
+}
+
+void Scene::animateGpu(float deltaTime) {
+    if (!shaders.contains("animate") || !shaders.at("animate").valid())
+        return;
+
+    // Same fixed timestep as the CPU simulation, so both paths follow the same trajectories
+    gpuAccumulator = std::min(gpuAccumulator + deltaTime, SIMULATION_TIMESTEP * sim::Simulation::MAX_STEPS_PER_UPDATE);
+    const auto steps = static_cast<unsigned int>(gpuAccumulator / SIMULATION_TIMESTEP);
+    if (steps == 0)
+        return;
+    gpuAccumulator -= steps * SIMULATION_TIMESTEP;
+
+    dispatchAnimation(SIMULATION_TIMESTEP, steps);
+
+    glMemoryBarrier(GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
+}
+
+void Scene::validateGpuAnimation() {
+    constexpr unsigned int VALIDATION_STEPS = 600;
+    constexpr float TOLERANCE = 1e-3f;
+
+    if (!shaders.contains("animate") || !shaders.at("animate").valid())
+        return;
+
+    // Keep the current GPU state (if any) and run the validation on a fresh upload
+    if (bGpuAnimation)
+        downloadGpuState();
+    uploadGpuState();
+
+    std::vector<glm::vec4> spheres, velocities;
+    gatherState(spheres, velocities);
+
+    dispatchAnimation(SIMULATION_TIMESTEP, VALIDATION_STEPS);
+
+    // CPU reference
+    for (std::size_t i{0}; i < spheres.size(); ++i) {
+        glm::vec3 pos{spheres[i]}, velocity{velocities[i]};
+        for (unsigned int step{0}; step < VALIDATION_STEPS; ++step)
+            sim::orbitStep(pos, velocity, SIMULATION_TIMESTEP);
+        spheres[i] = glm::vec4{pos, spheres[i].w};
+    }
+
+    glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+    const auto gpuSpheres = gpuSceneBuffer->vertexBuffer->getBufferData<glm::vec4>(spheres.size());
+    float maxError{0.f};
+    for (std::size_t i{0}; i < spheres.size(); ++i)
+        maxError = std::max(maxError, glm::length(glm::vec3{gpuSpheres[i]} - glm::vec3{spheres[i]}));
+
+    std::cout << std::format("GPU animation after {} steps: max position deviation from CPU {} ({})",
+        VALIDATION_STEPS, maxError, maxError <= TOLERANCE ? "ok" : "exceeds tolerance") << std::endl;
+
+    // Restore the GPU state, the validation run advanced it
+    uploadGpuState();
+}
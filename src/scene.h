@@ -5,17 +5,70 @@
 #include "components.h"
 #include "utils.h"
 #include "globjects.h"
+#include "nbody.h"
+#include "collision.h"
+#include "sph.h"
+#include "simulation.h"
+#include "dirtyranges.h"
+#include "scenefile.h"
+#include "trajectory.h"
+#include "trajcodec.h"
+#include "framestreamer.h"
+#include "quantization.h"
+#include "lod.h"
+#include "bvh.h"
 
 #include <map>
 #include <array>
+#include <filesystem>
+#include <future>
 #include <entt/entt.hpp>
 
+// Range of a render group in the scene buffer
+struct GroupRange {
+    glm::uint first{0}, count{0};
+};
+
+// Index lists written by the cull pass. Every group has its own range and indirect draw command in each.
+enum class DrawList : glm::uint {
+    // Sphere pass. With occlusion culling, the spheres visible last frame.
+    Spheres = 0,
+    // Sphere pass, spheres the pyramid of the first list doesn't occlude (occlusion culling only)
+    SpheresLate,
+    // List pass
+    List,
+    // Coarse LOD spheres, indexing the LOD buffer. Drawn by both passes along with Spheres (level of detail only).
+    Lod,
+    // Spheres smaller than splatPixels, drawn as points after the surface pass instead of by the other passes
+    Splats,
+    Count
+};
+
+// Matches the modes of cull.comp.glsl
+enum class CullMode : glm::uint {
+    Frustum = 0,
+    History,
+    Refine,
+    Occlusion
+};
+
+enum class SimulationMode : int {
+    Orbit = 0,
+    NBody,
+    Fluid
+};
+
 class Scene {
 private:
     std::map<std::string, Shader> shaders;
     comp::Mesh screenMesh;
     entt::registry EM;
-    std::shared_ptr<globjects::VertexArray> sceneBuffer, sceneBuffer2;
+    // All spheres, ordered by render group (see sortGroups)
+    std::shared_ptr<globjects::VertexArray> sceneBuffer;
+    // Persistently mapped regions of the scene buffer. The render thread writes interpolated positions straight into them.
+    std::unique_ptr<globjects::RingBuffer<GL_ARRAY_BUFFER>> sceneRing;
+    std::size_t sceneSize{0};
+    std::array<GroupRange, 2> groups;
 
     std::shared_ptr<globjects::Tex2D> positionTexture, normalTexture, positionTexture2, normalTexture2, depthTexture;
     std::shared_ptr<globjects::Framebuffer> sphereFramebuffer, sphereFramebuffer2;
@@ -23,15 +76,202 @@ private:
     std::shared_ptr<globjects::Buffer<GL_SHADER_STORAGE_BUFFER>> listBuffer;
     std::shared_ptr<globjects::Tex2D> listIndexTexture, listIndexTexture2;
 
-    std::vector<glm::vec4> positions, positions2;
+    // N-body simulation
+    SimulationMode simulationMode = SimulationMode::Orbit;
+    sim::GravityParams gravity;
+    float massScale = 1e6f;
+    sim::Octree octree;
+    std::vector<glm::vec4> bodies;
+    std::vector<glm::vec3> accelerations;
+
+    // SPH fluid simulation
+    sim::Fluid fluid;
+    sim::FluidParams fluidParams;
+
+    // Sphere-sphere collisions, applied after any simulation mode
+    bool bCollisions = false;
+    sim::CollisionParams collision;
+    sim::SpatialGrid grid;
+    std::size_t contactCount{0};
+
+    // Copies of the sphere state for the simulations that work on flat arrays (see gatherState)
+    std::vector<glm::vec4> stateSpheres, stateVelocities;
+
+    // GPU animation path. Positions and velocities stay in GPU buffers while it's enabled.
+    bool bGpuAnimation = false;
+    float gpuAccumulator = 0.f;
+    std::shared_ptr<globjects::VertexArray> gpuSceneBuffer;
+    std::shared_ptr<globjects::Buffer<GL_SHADER_STORAGE_BUFFER>> gpuVelocityBuffer;
+
+    void gatherState(std::vector<glm::vec4>& spheres, std::vector<glm::vec4>& velocities);
+    // Positions and radii in scene buffer order, in parallel. Takes the simulation lock.
+    void copySpheres(std::vector<glm::vec4>& spheres);
+    void scatterState(const std::vector<glm::vec4>& spheres, const std::vector<glm::vec4>& velocities);
+    void uploadGpuState();
+    void downloadGpuState();
+    void dispatchAnimation(float deltaTime, unsigned int steps = 1);
+    void animateGpu(float deltaTime);
+    void validateGpuAnimation();
+
+    // Input of the render thread. The simulation thread publishes snapshots into it, and the render thread
+    // interpolates between the last two it took, which stay valid until the next update().
+    sim::SnapshotChannel snapshots;
+    bool bInterpolating = false;
+
+    void animateOrbits(float deltaTime, sim::Snapshot& out);
+    void animateGravity(float deltaTime, sim::Snapshot& out);
+    void gatherBodies();
+    void resetOrbitalVelocities();
+    void compareGravity();
+    void animateFluid(float deltaTime, sim::Snapshot& out);
+    void resetFluid();
+    void collideSpheres(sim::Snapshot& out);
+    void interpolatePositions();
+    // Vertex array of the copy of the scene drawn this frame, and the vertex that copy starts at.
+    // Binds the cluster and radius tables when that's the quantized scene.
+    std::pair<globjects::VertexArray*, std::size_t> bindSceneSource();
+    // Draws a group, from an index list of the cull pass if given
+    void drawScene(glm::uint group, std::optional<DrawList> list = std::nullopt);
+    // Generates the spheres as a function of the seed alone
+    void generateScene(std::uint64_t seed);
+    void loadScene(std::span<const io::SceneGroup> sceneGroups, std::span<const glm::vec4> spheres, std::span<const glm::vec4> velocities);
+    bool saveScene(const std::filesystem::path& path);
+    // Sorts the spheres by render group, and within every group along a Morton curve if bSpatial is set. Returns them in the new order.
+    std::vector<glm::vec4> sortGroups(bool bSpatial);
+
+    // Sphere edits (made through EM.patch / EM.replace) not yet uploaded. Tracked per ring region,
+    // since each region lags behind by a different number of writes.
+    std::vector<DirtyRanges> regionChanges;
+    DirtyRanges gpuChanges;
+    bool bSceneEdited = false;
+    std::size_t lastUploadCount{0}, lastUploadRanges{0};
+
+    void onSphereUpdate(entt::registry& registry, entt::entity entity);
+    void markSceneChanged(glm::uint first, glm::uint count);
+    void uploadChanges();
+    void editSpheres();
+    int selectedSphere{0};
+
+    // Picking. A click casts a ray through the wide BVH of the simulation state, which is refit to the current
+    // positions on every pick and only rebuilt (and collapsed) when the sphere count changed or refitting made it much worse.
+    accel::WideBvh pickBvh;
+    float pickBvhCost{0.f};
+    std::vector<glm::vec4> pickSpheres;
+
+    std::optional<glm::uint> pickSphere(const glm::mat4& MVPInverse, const glm::vec2& ndc);
+
+    // Quantized copy of the scene buffer (see quantization.h), drawn instead of it while enabled.
+    // Positions are quantized on the CPU whenever the scene changes. Cluster tables are ring buffered along with the spheres.
+    bool bQuantized = false;
+    std::shared_ptr<globjects::VertexArray> quantizedBuffer;
+    std::unique_ptr<globjects::RingBuffer<GL_ARRAY_BUFFER>> quantizedRing;
+    std::shared_ptr<globjects::Buffer<GL_SHADER_STORAGE_BUFFER>> clusterBuffer, radiusBuffer;
+    std::unique_ptr<globjects::RingBuffer<GL_SHADER_STORAGE_BUFFER>> clusterRing;
+    util::RadiusTable radiusTable;
+    std::vector<glm::vec4> quantizeSource;
+
+    void setQuantized(bool enabled);
+    void quantizeScene(std::span<const glm::vec4> spheres, bool bRadiiChanged);
+    void quantizeEntities();
+
+    // GPU culling. A compute pass compacts the visible spheres of every group into index lists (see DrawList)
+    // and counts them in indirect draw commands, so the sphere and list passes only process visible spheres.
+    // Occlusion culling is two-phase: spheres visible last frame are drawn first, the rest is tested against
+    // a pyramid of the farthest distances drawn (hiZTexture), and the final pyramid culls the list pass.
+    bool bCulling = true;
+    bool bOcclusionCulling = true;
+    unsigned int cullShaderId{0};
+    std::shared_ptr<globjects::Buffer<GL_ELEMENT_ARRAY_BUFFER>> cullIndexBuffer;
+    std::shared_ptr<globjects::Buffer<GL_DRAW_INDIRECT_BUFFER>> cullCommandBuffer;
+    std::shared_ptr<globjects::Buffer<GL_SHADER_STORAGE_BUFFER>> visibilityBuffer;
+    std::shared_ptr<globjects::Tex2D> hiZTexture;
+    // Spheres whose outer radius projects to less than splatPixels skip the A-buffer and are drawn as depth tested points
+    bool bSplats = true;
+    float splatPixels = 0.5f;
+
+    // Resets the draw commands and sets the per frame uniforms. Returns false if the cull shader is missing.
+    bool beginCulling(const glm::mat4& MVP, const glm::mat4& viewMatrix, const glm::mat4& projectionMatrix, bool bQuantizedSource, float splatRadiusScale);
+    // The final cull of each group's list pass sets bWriteSplats, so every splat is written once
+    void cullGroup(glm::uint group, CullMode mode, DrawList list, float radiusScale, bool bWriteSplats = false);
+    void buildHiZ(globjects::Tex2D& positions);
+
+    // Level of detail (see lod.h). The hierarchy is rebuilt in the background whenever the scene changed since the last build.
+    // Every cluster is drawn at the coarsest level whose cells project to at most lodPixels, writing the Spheres and Lod lists.
+    // Only the scene buffer is drawn with LOD, the other sources are culled per sphere.
+    bool bLod = false;
+    bool bLodStale = true;
+    float lodPixels = 3.f;
+    std::future<util::LodHierarchy> lodBuild;
+    std::shared_ptr<globjects::VertexArray> lodBuffer;
+    std::shared_ptr<globjects::Buffer<GL_SHADER_STORAGE_BUFFER>> lodClusterBuffer, lodLeafBuffer;
+    std::vector<glm::uvec2> lodGroupClusters;
+    glm::vec4 lodCellSizes{0.f};
+    std::size_t lodSphereCount{0};
+
+    // Reorders done when the build in flight started. Builds from before the last reorder index spheres that moved.
+    std::size_t lodBuildReorders{0};
+
+    void updateLod();
+    void selectLod(const glm::mat4& MVP, const glm::mat4& viewMatrix, const glm::mat4& projectionMatrix, float radiusScale);
+
+    // Ray traced mode. A linear BVH (see lbvh.comp.glsl) is built over every group on the GPU each frame, and a fullscreen
+    // pass traverses it per pixel in place of the sphere, list and surface passes, so nothing is stored per pixel.
+    bool bTracing = false;
+    std::shared_ptr<globjects::Buffer<GL_SHADER_STORAGE_BUFFER>> lbvhKeyBuffer, lbvhValueBuffer, lbvhHistogramBuffer,
+        lbvhBoundsBuffer, lbvhNodeBuffer, lbvhLinkBuffer, lbvhSphereBuffer;
+
+    // Returns false if the shaders are missing
+    bool buildLbvh(float radiusScale, bool bQuantizedSource);
+    void traceScene(const glm::mat4& MVP, const glm::mat4& MVPInverse, float radiusScale, float smoothing, float interpolation);
+
+    // Spatial order. The spheres of every render group are kept sorted along a Morton curve (see util::mortonOrder), so spheres
+    // next to each other in the scene buffer are close on screen too. Animated scenes are resorted every sortInterval seconds.
+    // Entities keep their identity, anything referring to spheres by index is remapped.
+    bool bSpatialOrder = true;
+    float sortInterval = 1.f;
+    float sortTimer = 0.f;
+    std::size_t reorderCount{0};
+    // Simulation step of the last reorder. Snapshots up to it are in the old order.
+    std::uint64_t reorderStep{0};
+
+    // Sorts the ECS storage within every render group. Returns the new index of every sphere. Expects the simulation to be locked.
+    std::vector<glm::uint> sortSpatially();
+    void reorderSpheres();
+
+    // Trajectory playback. Frames are streamed into the slots of a persistently mapped buffer by a background thread,
+    // and drawn straight from the slot holding the frame under the playhead. Raw (.traj) and compressed (.ctraj) files are supported.
+    std::size_t trajectoryFrames{0};
+    float trajectoryRate{30.f};
+    std::shared_ptr<globjects::VertexArray> trajectoryBuffer;
+    std::unique_ptr<globjects::RingBuffer<GL_ARRAY_BUFFER>> trajectoryRing;
+    std::unique_ptr<io::FrameStreamer> trajectoryStreamer;
+    // Slot currently drawn, and slots no longer drawn that wait for the GPU before going back to the streamer
+    std::optional<std::size_t> trajectorySlot;
+    std::vector<std::size_t> retiredSlots;
+    float playhead = 0.f;
+    float playbackSpeed = 1.f;
+    bool bPlaying = true;
+    // Records simulation steps to a trajectory, on the simulation thread
+    std::optional<io::TrajectoryWriter> recorder;
+
+    bool loadTrajectory(const std::filesystem::path& path);
+    void closeTrajectory();
+    void updateTrajectory(float deltaTime);
+    void trajectoryMenu();
+
+    // Declared last so the simulation thread is stopped before the state it uses is destroyed
+    std::unique_ptr<sim::Simulation> simulation;
 
 public:
-    Scene();
+    // Loads the scene from a scene or molecule file if a path is given, otherwise generates a random one.
+    // A trajectory matching the scene can be given to play back instead of simulating.
+    Scene(const std::filesystem::path& scenePath = {}, const std::filesystem::path& trajectoryPath = {});
 
     void reloadShaders();
 
     void render(float deltaTime = 0.f);
-    void animate(float deltaTime = 0.f);
+    // Steps the simulation. Called on the simulation thread.
+    void animate(float deltaTime, sim::Snapshot& out);
 };
 
 #endif // SCENE_H
\ No newline at end of file
@@ -0,0 +1,229 @@
+#include "scenefile.h"
+
+#include <iostream>
+#include <fstream>
+#include <format>
+#include <cstring>
+#include <limits>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+namespace io {
+
+MappedFile::MappedFile(MappedFile&& other) noexcept {
+    *this = std::move(other);
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept {
+    if (this != &other) {
+        close();
+        std::swap(ptr, other.ptr);
+        std::swap(byteSize, other.byteSize);
+#ifdef _WIN32
+        std::swap(fileHandle, other.fileHandle);
+        std::swap(mappingHandle, other.mappingHandle);
+#else
+        std::swap(fd, other.fd);
+#endif
+    }
+    return *this;
+}
+
+MappedFile::~MappedFile() {
+    close();
+}
+
+#ifdef _WIN32
+
+std::optional<MappedFile> MappedFile::open(const std::filesystem::path& path) {
+    MappedFile mapped;
+    mapped.fileHandle = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (mapped.fileHandle == INVALID_HANDLE_VALUE) {
+        mapped.fileHandle = nullptr;
+        return std::nullopt;
+    }
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(mapped.fileHandle, &size) || size.QuadPart == 0)
+        return std::nullopt;
+    mapped.byteSize = static_cast<std::size_t>(size.QuadPart);
+
+    mapped.mappingHandle = CreateFileMappingW(mapped.fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!mapped.mappingHandle)
+        return std::nullopt;
+
+    mapped.ptr = static_cast<const std::byte*>(MapViewOfFile(mapped.mappingHandle, FILE_MAP_READ, 0, 0, 0));
+    if (!mapped.ptr)
+        return std::nullopt;
+
+    return mapped;
+}
+
+void MappedFile::close() {
+    if (ptr)
+        UnmapViewOfFile(ptr);
+    if (mappingHandle)
+        CloseHandle(mappingHandle);
+    if (fileHandle)
+        CloseHandle(fileHandle);
+    ptr = nullptr;
+    mappingHandle = fileHandle = nullptr;
+    byteSize = 0;
+}
+
+#else
+
+std::optional<MappedFile> MappedFile::open(const std::filesystem::path& path) {
+    MappedFile mapped;
+    mapped.fd = ::open(path.c_str(), O_RDONLY);
+    if (mapped.fd < 0)
+        return std::nullopt;
+
+    struct stat info;
+    if (fstat(mapped.fd, &info) != 0 || info.st_size == 0)
+        return std::nullopt;
+    mapped.byteSize = static_cast<std::size_t>(info.st_size);
+
+    void* address = mmap(nullptr, mapped.byteSize, PROT_READ, MAP_PRIVATE, mapped.fd, 0);
+    if (address == MAP_FAILED)
+        return std::nullopt;
+    // The scene is read front to back exactly once
+    madvise(address, mapped.byteSize, MADV_SEQUENTIAL);
+    madvise(address, mapped.byteSize, MADV_WILLNEED);
+    mapped.ptr = static_cast<const std::byte*>(address);
+
+    return mapped;
+}
+
+void MappedFile::close() {
+    if (ptr)
+        munmap(const_cast<std::byte*>(ptr), byteSize);
+    if (0 <= fd)
+        ::close(fd);
+    ptr = nullptr;
+    fd = -1;
+    byteSize = 0;
+}
+
+#endif
+
+// Checks that [offset, offset + count * elementSize) lies inside the file
+static bool inFile(std::uint64_t offset, std::uint64_t count, std::uint64_t elementSize, std::size_t fileSize) {
+    return offset <= fileSize && count <= (fileSize - offset) / elementSize;
+}
+
+std::optional<SceneFile> SceneFile::open(const std::filesystem::path& path) {
+    auto mapped = MappedFile::open(path);
+    if (!mapped) {
+        std::cout << std::format("SCENE ERROR: Could not map \"{}\".", path.string()) << std::endl;
+        return std::nullopt;
+    }
+
+    const auto fail = [&](const char* reason){
+        std::cout << std::format("SCENE ERROR: \"{}\": {}", path.string(), reason) << std::endl;
+        return std::nullopt;
+    };
+
+    SceneHeader header;
+    if (mapped->size() < sizeof(SceneHeader))
+        return fail("file too small");
+    std::memcpy(&header, mapped->data(), sizeof(SceneHeader));
+
+    if (header.magic != SceneHeader::MAGIC)
+        return fail("not a scene file");
+    if (header.version != SceneHeader::VERSION)
+        return fail("unsupported version");
+    if (!inFile(header.groupOffset, header.groupCount, sizeof(SceneGroup), mapped->size())
+        || !inFile(header.sphereOffset, header.sphereCount, sizeof(glm::vec4), mapped->size())
+        || ((header.flags & SceneHeader::HAS_VELOCITIES) && !inFile(header.velocityOffset, header.sphereCount, sizeof(glm::vec4), mapped->size())))
+        return fail("truncated");
+    if (header.groupOffset % alignof(SceneGroup) || header.sphereOffset % 16
+        || ((header.flags & SceneHeader::HAS_VELOCITIES) && header.velocityOffset % 16))
+        return fail("misaligned arrays");
+    if (header.sphereCount == 0)
+        return fail("no spheres");
+    if (std::numeric_limits<std::uint32_t>::max() < header.sphereCount)
+        return fail("too many spheres");
+
+    SceneFile file{std::move(*mapped), header};
+
+    // Groups have to tile the sphere array in LOD order, so each render group is one contiguous range
+    std::uint64_t next{0};
+    std::uint32_t lastLOD{0};
+    for (const auto& group : file.groups()) {
+        if (group.first != next || group.LOD < lastLOD)
+            return fail("groups are not contiguous and sorted by LOD");
+        next += group.count;
+        lastLOD = group.LOD;
+    }
+    if (next != header.sphereCount)
+        return fail("groups don't cover all spheres");
+
+    return file;
+}
+
+std::span<const SceneGroup> SceneFile::groups() const {
+    return {reinterpret_cast<const SceneGroup*>(file.data() + header.groupOffset), header.groupCount};
+}
+
+std::span<const glm::vec4> SceneFile::spheres() const {
+    return {reinterpret_cast<const glm::vec4*>(file.data() + header.sphereOffset), static_cast<std::size_t>(header.sphereCount)};
+}
+
+std::span<const glm::vec4> SceneFile::velocities() const {
+    if (!(header.flags & SceneHeader::HAS_VELOCITIES))
+        return {};
+    return {reinterpret_cast<const glm::vec4*>(file.data() + header.velocityOffset), static_cast<std::size_t>(header.sphereCount)};
+}
+
+static std::uint64_t align16(std::uint64_t offset) {
+    return (offset + 15) & ~std::uint64_t{15};
+}
+
+bool saveScene(const std::filesystem::path& path, std::span<const SceneGroup> groups,
+    std::span<const glm::vec4> spheres, std::span<const glm::vec4> velocities) {
+    const bool bVelocities = !velocities.empty();
+    if (bVelocities && velocities.size() != spheres.size())
+        return false;
+
+    SceneHeader header;
+    header.flags = bVelocities ? SceneHeader::HAS_VELOCITIES : 0u;
+    header.groupCount = static_cast<std::uint32_t>(groups.size());
+    header.sphereCount = spheres.size();
+    header.groupOffset = align16(sizeof(SceneHeader));
+    header.sphereOffset = align16(header.groupOffset + groups.size_bytes());
+    header.velocityOffset = bVelocities ? align16(header.sphereOffset + spheres.size_bytes()) : 0u;
+
+    std::ofstream out{path, std::ios::binary | std::ios::trunc};
+    if (!out) {
+        std::cout << std::format("SCENE ERROR: Could not open \"{}\" for writing.", path.string()) << std::endl;
+        return false;
+    }
+
+    const auto writeAt = [&out](std::uint64_t offset, const void* data, std::size_t size){
+        // Zero padding up to the aligned offset
+        constexpr char zeros[16]{};
+        const auto position = static_cast<std::uint64_t>(out.tellp());
+        out.write(zeros, static_cast<std::streamsize>(offset - position));
+        out.write(static_cast<const char*>(data), static_cast<std::streamsize>(size));
+    };
+
+    writeAt(0, &header, sizeof(header));
+    writeAt(header.groupOffset, groups.data(), groups.size_bytes());
+    writeAt(header.sphereOffset, spheres.data(), spheres.size_bytes());
+    if (bVelocities)
+        writeAt(header.velocityOffset, velocities.data(), velocities.size_bytes());
+
+    return static_cast<bool>(out.flush());
+}
+
+}
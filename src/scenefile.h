@@ -0,0 +1,102 @@
+#ifndef SCENEFILE_H
+#define SCENEFILE_H
+
+#include <glm/glm.hpp>
+
+#include <array>
+#include <span>
+#include <optional>
+#include <filesystem>
+#include <cstdint>
+#include <cstddef>
+
+namespace io {
+
+/**
+ * @brief Read-only memory mapping of a whole file.
+ */
+class MappedFile {
+private:
+    const std::byte* ptr{nullptr};
+    std::size_t byteSize{0};
+#ifdef _WIN32
+    void* fileHandle{nullptr};
+    void* mappingHandle{nullptr};
+#else
+    int fd{-1};
+#endif
+
+    void close();
+
+public:
+    MappedFile() = default;
+    MappedFile(MappedFile&& other) noexcept;
+    MappedFile& operator=(MappedFile&& other) noexcept;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile();
+
+    static std::optional<MappedFile> open(const std::filesystem::path& path);
+
+    const std::byte* data() const { return ptr; }
+    std::size_t size() const { return byteSize; }
+};
+
+// Binary sphere scene, version 1. All values are little endian.
+// The header is followed by the group table and the sphere array, and optionally the velocity array.
+// Arrays start at 16 byte aligned offsets, so they can be used (and uploaded) straight from the mapping.
+struct SceneHeader {
+    static constexpr std::array<char, 4> MAGIC{'B', 'S', 'P', 'H'};
+    static constexpr std::uint32_t VERSION = 1;
+    static constexpr std::uint32_t HAS_VELOCITIES = 1u << 0;
+
+    std::array<char, 4> magic{MAGIC};
+    std::uint32_t version{VERSION};
+    std::uint32_t flags{0};
+    std::uint32_t groupCount{0};
+    std::uint64_t sphereCount{0};
+    // Byte offsets from the start of the file
+    std::uint64_t groupOffset{0};
+    std::uint64_t sphereOffset{0};
+    std::uint64_t velocityOffset{0};
+};
+
+// Contiguous range of spheres sharing a render group. Groups are stored sorted by LOD and cover all spheres in order.
+struct SceneGroup {
+    std::uint32_t first{0};
+    std::uint32_t count{0};
+    std::uint32_t LOD{0};
+    std::uint32_t reserved{0};
+};
+
+static_assert(sizeof(SceneHeader) == 48);
+static_assert(sizeof(SceneGroup) == 16);
+
+/**
+ * @brief Validated view of a mapped scene file. Spans point into the mapping and live as long as the SceneFile.
+ */
+class SceneFile {
+private:
+    MappedFile file;
+    SceneHeader header;
+
+    SceneFile(MappedFile&& mapped, const SceneHeader& fileHeader) : file{std::move(mapped)}, header{fileHeader} {}
+
+public:
+    // Maps and validates a scene file. Prints the reason and returns nothing if it can't be used.
+    static std::optional<SceneFile> open(const std::filesystem::path& path);
+
+    std::span<const SceneGroup> groups() const;
+    // xyz = position, w = radius
+    std::span<const glm::vec4> spheres() const;
+    // xyz = velocity, w = mass. Empty if the file has no velocities.
+    std::span<const glm::vec4> velocities() const;
+};
+
+// Writes a version 1 scene file. Velocities are optional (pass an empty span to leave them out).
+bool saveScene(const std::filesystem::path& path, std::span<const SceneGroup> groups,
+    std::span<const glm::vec4> spheres, std::span<const glm::vec4> velocities = {});
+
+}
+
+#endif // SCENEFILE_H
@@ -6,6 +6,10 @@
 #include <sstream>
 #include <ranges>
 #include <iostream>
+#include <filesystem>
+#include <vector>
+#include <cstring>
+#include <cstdint>
 
 #include <glad/glad.h>
 
@@ -13,18 +17,102 @@
 
 static unsigned int debugMessageId = 0;
 
-Shader::SubShader::SubShader(int _id, const std::string& path)
- : id{_id}, filePath{path}
+namespace {
+
+// FNV-1a, continuing from hash
+std::uint64_t hashBytes(std::string_view bytes, std::uint64_t hash = 0xcbf29ce484222325) {
+    for (const auto c : bytes) {
+        hash ^= static_cast<unsigned char>(c);
+        hash *= 0x100000001b3;
+    }
+    return hash;
+}
+
+// Binaries only load into the driver that wrote them, so the driver is part of every cache key
+const std::string& driverString() {
+    static const std::string driver = []{
+        std::string str;
+        for (const auto name : {GL_VENDOR, GL_RENDERER, GL_VERSION})
+            if (const auto value = glGetString(name))
+                str.append(reinterpret_cast<const char*>(value)).push_back('\n');
+        return str;
+    }();
+    return driver;
+}
+
+bool binaryCacheSupported() {
+    static const bool bSupported = []{
+        GLint formats{0};
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+        return 0 < formats;
+    }();
+    return bSupported;
+}
+
+// Cache files hold the binary format, followed by the binary
+bool loadProgramBinary(GLuint program, const std::filesystem::path& path) {
+    std::ifstream input{path, std::ifstream::binary | std::ifstream::ate};
+    if (!input)
+        return false;
+    const auto size = static_cast<std::size_t>(input.tellg());
+    if (size <= sizeof(GLenum))
+        return false;
+    std::vector<char> data(size);
+    input.seekg(0, input.beg);
+    if (!input.read(data.data(), static_cast<std::streamsize>(size)))
+        return false;
+
+    GLenum format;
+    std::memcpy(&format, data.data(), sizeof(format));
+    glProgramBinary(program, format, data.data() + sizeof(format), static_cast<GLsizei>(size - sizeof(format)));
+    // Drivers reject binaries they can't use, after which the program is compiled from source again
+    int success;
+    glGetProgramiv(program, GL_LINK_STATUS, &success);
+    return success;
+}
+
+void saveProgramBinary(GLuint program, const std::filesystem::path& path) {
+    GLint length{0};
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0)
+        return;
+    std::vector<char> data(sizeof(GLenum) + static_cast<std::size_t>(length));
+    GLenum format;
+    glGetProgramBinary(program, length, nullptr, &format, data.data() + sizeof(format));
+    std::memcpy(data.data(), &format, sizeof(format));
+
+    // Written beside the entry and renamed, so an interrupted write never leaves a truncated entry
+    std::error_code error;
+    std::filesystem::create_directories(path.parent_path(), error);
+    auto tempPath = path;
+    tempPath += ".tmp";
+    {
+        std::ofstream output{tempPath, std::ofstream::binary | std::ofstream::trunc};
+        if (!output.write(data.data(), static_cast<std::streamsize>(data.size()))) {
+            std::cout << "SHADER CACHE ERROR: Could not write " << tempPath.string() << std::endl;
+            return;
+        }
+    }
+    std::filesystem::rename(tempPath, path, error);
+    if (error)
+        std::cout << "SHADER CACHE ERROR: Could not write " << path.string() << ": " << error.message() << std::endl;
+}
+
+}
+
+Shader::SubShader::SubShader(const std::string& path, std::string&& _source)
+ : id{0}, filePath{path}, source{std::move(_source)}
 {}
 
 Shader::SubShader::SubShader(SubShader&& lhs)
- : id{lhs.id}, filePath{std::move(lhs.filePath)} {
+ : id{lhs.id}, filePath{std::move(lhs.filePath)}, source{std::move(lhs.source)} {
     lhs.bOwned = false;
 }
 
 Shader::SubShader& Shader::SubShader::operator=(SubShader&& lhs) {
     id = lhs.id;
     filePath = std::move(lhs.filePath);
+    source = std::move(lhs.source);
     lhs.bOwned = false;
     return *this;
 }
@@ -37,8 +125,7 @@ Shader::SubShader::~SubShader() {
 
 
 
-std::optional<std::pair<GLenum, int>> Shader::createSubShader(const std::pair<GLenum, std::string>& program, const std::string& programDefines) {
-    const auto& [type, relPath] = program;
+std::optional<std::string> Shader::readSource(const std::string& relPath, const std::string& programDefines) {
     const auto path = std::string{SHADER_BASE_PATH}.append(relPath);
 
     // Read file:
@@ -66,8 +153,11 @@ std::optional<std::pair<GLenum, int>> Shader::createSubShader(const std::pair<GL
     source += programDefines;
     // 3. Read rest of file:
     source.insert(source.end(), std::istreambuf_iterator<char>{input}, std::istreambuf_iterator<char>{});
+    return source;
+}
+
+std::optional<int> Shader::compileSubShader(GLenum type, const std::string& source, const std::string& path) {
     auto sourcePtr = source.c_str();
-    input.close();
 
     // Compile shader:
     int prog = glCreateShader(type);
@@ -82,20 +172,20 @@ std::optional<std::pair<GLenum, int>> Shader::createSubShader(const std::pair<GL
         glGetShaderInfoLog(prog, 512, NULL, infoLog);
         std::cout << "SHADER COMPILATION ERROR in file: \"" << path << "\"\n"
                     << infoLog << std::endl;
+        glDeleteShader(prog);
         return std::nullopt;
     }
 
-    return std::make_pair(type, prog);
+    return prog;
 }
 
-// Compiles and appends a program to this shaders list of subshaders. Returns true if new shader was added.
+// Reads and appends a program to this shaders list of subshaders. Returns true if new shader was added.
 bool Shader::addShader(const std::pair<GLenum, std::string>& program) {
-    auto result = createSubShader(program, getDefineStr());
-    if (!result)
+    auto source = readSource(program.second, getDefineStr());
+    if (!source)
         return false;
 
-    auto [key, value] = *result;
-    programs.insert(std::move(std::make_pair(key, std::move(SubShader{value, program.second}))));
+    programs.insert(std::move(std::make_pair(program.first, std::move(SubShader{program.second, std::move(*source)}))));
     bValid = false;
     return true;
 }
@@ -117,25 +207,54 @@ std::string Shader::getDefineStr() const {
     return output;
 }
 
-// Attempts to link this shaers subshaders. Returns true if successfull. 
+// Attempts to load this shaders program from the binary cache, or else to compile and link its subshaders. Returns true if successfull.
 bool Shader::link() {
+    // Sources already hold the defines, which are hashed anyway so a change to how they're inserted can't go unnoticed
+    auto key = hashBytes(driverString());
+    key = hashBytes(getDefineStr(), key);
+    for (const auto& [type, prog] : programs) {
+        key = hashBytes(std::format("{}:{}\n", type, prog.filePath), key);
+        key = hashBytes(prog.source, key);
+    }
+    const auto cachePath = std::filesystem::path{SHADER_CACHE_PATH} / std::format("{:016x}.bin", key);
+    const bool bCache = binaryCacheSupported();
+
     id = glCreateProgram();
-    for (const auto& prog : programs)
-        glAttachShader(id, prog.second.id);
-        
-    glLinkProgram(id);
-    // check for linking errors
-    int success;
-    char infoLog[512];
-    glGetProgramiv(id, GL_LINK_STATUS, &success);
-    if (!success)
-    {
-        glGetProgramInfoLog(id, 512, NULL, infoLog);
-        std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n"
-                    << infoLog << std::endl;
-        
+    const bool bCached = bCache && loadProgramBinary(id, cachePath);
+    if (!bCached) {
         glDeleteProgram(id);
-        return false;
+        for (auto& [type, prog] : programs) {
+            if (prog.id != 0)
+                continue;
+            const auto result = compileSubShader(type, prog.source, prog.filePath);
+            if (!result)
+                return false;
+            prog.id = *result;
+        }
+
+        id = glCreateProgram();
+        if (bCache)
+            glProgramParameteri(id, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+        for (const auto& prog : programs)
+            glAttachShader(id, prog.second.id);
+
+        glLinkProgram(id);
+        // check for linking errors
+        int success;
+        char infoLog[512];
+        glGetProgramiv(id, GL_LINK_STATUS, &success);
+        if (!success)
+        {
+            glGetProgramInfoLog(id, 512, NULL, infoLog);
+            std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n"
+                        << infoLog << std::endl;
+
+            glDeleteProgram(id);
+            return false;
+        }
+
+        if (bCache)
+            saveProgramBinary(id, cachePath);
     }
 
     // Print debug info:
@@ -143,7 +262,7 @@ bool Shader::link() {
     std::size_t i{0};
     for (auto it{programs.begin()}; it != programs.end(); ++it, ++i)
         shaderIdentifier << it->second.filePath << (i == programs.size() - 1 ? "" : ", ");
-    const auto debugMessage = std::format("Shader {{{}}} successfully compiled with id {}", shaderIdentifier.str(), id);
+    const auto debugMessage = std::format("Shader {{{}}} successfully {} with id {}", shaderIdentifier.str(), bCached ? "loaded from the binary cache" : "compiled", id);
     glDebugMessageInsert(GL_DEBUG_SOURCE_APPLICATION, GL_DEBUG_TYPE_OTHER, ++debugMessageId, GL_DEBUG_SEVERITY_NOTIFICATION, debugMessage.size(), debugMessage.c_str());
     
     bValid = true;
@@ -164,12 +283,11 @@ bool Shader::reload() {
         auto node = std::move(programs.extract(key));
         const auto& filePath = node.mapped().filePath;
 
-        auto result = createSubShader(std::make_pair(key, filePath), defines);
-        if (!result)
+        auto source = readSource(filePath, defines);
+        if (!source)
             return false;
         
-        const auto id = result->second;
-        node.mapped() = std::move(SubShader{id, filePath});
+        node.mapped() = std::move(SubShader{filePath, std::move(*source)});
         programs.insert(std::move(node));
     }
 
@@ -16,14 +16,16 @@ class Shader
 {
 public:
     struct SubShader {
+        // 0 until compiled, which a program loaded from the binary cache never needs
         int id;
         std::string filePath;
+        std::string source;
     
     private:
         bool bOwned = true;
         
     public:
-        SubShader(int _id, const std::string& path);
+        SubShader(const std::string& path, std::string&& _source);
         SubShader(const SubShader&) = default;
         SubShader(SubShader&& lhs);
 
@@ -42,10 +44,14 @@ private:
     std::set<std::string> defines;
 
 public:
-    // Reads a program from file and compiles it to a subshader. Returns subshader if successful.
-    static std::optional<std::pair<GLenum, int>> createSubShader(const std::pair<GLenum, std::string>& program, const std::string& programDefines = "");
+    // Reads a program from file and inserts the defines after its leading # lines. Returns the source if successful.
+    static std::optional<std::string> readSource(const std::string& relPath, const std::string& programDefines = "");
 
-    // Compiles and appends a program to this shaders list of subshaders. Returns true if new shader was added.
+    // Compiles a source to a subshader. Returns the subshader id if successful.
+    static std::optional<int> compileSubShader(GLenum type, const std::string& source, const std::string& path);
+
+    // Reads and appends a program to this shaders list of subshaders. Returns true if new shader was added.
+    // Subshaders are compiled when linking, unless the program is found in the binary cache.
     bool addShader(const std::pair<GLenum, std::string>& program);
 
     void addDefine(const std::string& value);
@@ -53,7 +59,8 @@ public:
 
     std::string getDefineStr() const;
 
-    // Attempts to link this shaers subshaders. Returns true if successfull. 
+    // Attempts to load this shaders program from the binary cache, or else to compile and link its subshaders
+    // and add the program to the cache. Returns true if successfull.
     bool link();
 
     bool reload();
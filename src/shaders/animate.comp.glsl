@@ -0,0 +1,46 @@
+// GPU version of the orbit animation in Scene::animateOrbits (sim::orbitStep).
+// Rotates each sphere and its velocity around the axis perpendicular to both, by an angle proportional to the speed.
+#version 450
+
+layout(local_size_x = 256) in;
+
+uniform float deltaTime = 0.0;
+uniform uint sphereCount = 0u;
+
+layout(std430, binding = 0) buffer sphereBuffer
+{
+	vec4 spheres[];
+};
+
+// xyz = velocity, w = mass
+layout(std430, binding = 1) buffer velocityBuffer
+{
+	vec4 velocities[];
+};
+
+// Rodrigues' rotation formula (same rotation as glm::angleAxis(angle, axis) * v)
+vec3 rotate(vec3 v, vec3 axis, float angle)
+{
+	float c = cos(angle);
+	float s = sin(angle);
+	return v * c + cross(axis, v) * s + axis * dot(axis, v) * (1.0 - c);
+}
+
+void main()
+{
+	uint i = gl_GlobalInvocationID.x;
+	if (sphereCount <= i)
+		return;
+
+	vec3 pos = spheres[i].xyz;
+	vec3 velocity = velocities[i].xyz;
+
+	vec3 axis = cross(velocity, pos);
+	if (dot(axis, axis) < 1e-12)
+		return;
+	axis = normalize(axis);
+	float angle = length(velocity) * deltaTime;
+
+	spheres[i].xyz = rotate(pos, axis, angle);
+	velocities[i].xyz = rotate(velocity, axis, angle);
+}
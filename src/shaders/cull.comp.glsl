@@ -0,0 +1,223 @@
+// Culls the spheres of one render group and compacts the visible ones into an index buffer,
+// counting them in an indirect draw command (see Scene::cullGroup).
+// Occlusion is tested against a pyramid of the farthest distances drawn so far (see hiz.comp.glsl).
+// Spheres projecting to less than splatPixels are left out of every list, and go to the splat list instead.
+#version 450
+
+layout(local_size_x = 256) in;
+
+#ifdef QUANTIZED
+// Same encoding as sphere.vert.glsl
+layout(std430, binding = 0) readonly buffer sphereBuffer
+{
+	uvec2 spheres[];
+};
+
+layout(std430, binding = 2) readonly buffer clusterBuffer
+{
+	vec4 clusters[];
+};
+
+layout(std430, binding = 3) readonly buffer radiusBuffer
+{
+	float radii[];
+};
+#else
+layout(std430, binding = 0) readonly buffer sphereBuffer
+{
+	vec4 spheres[];
+};
+#endif
+
+// DrawElementsIndirectCommand
+struct DrawCommand
+{
+	uint count;
+	uint instanceCount;
+	uint firstIndex;
+	int baseVertex;
+	uint baseInstance;
+};
+
+layout(std430, binding = 4) buffer commandBuffer
+{
+	DrawCommand commands[];
+};
+
+layout(std430, binding = 5) writeonly buffer indexBuffer
+{
+	uint indices[];
+};
+
+// Whether a sphere passed the occlusion test last frame, by scene index
+layout(std430, binding = 6) buffer visibilityBuffer
+{
+	uint visibility[];
+};
+
+layout(binding = 0) uniform sampler2D hiZTexture;
+
+// Frustum only
+#define CULL_FRUSTUM 0u
+// Frustum, and only spheres visible last frame
+#define CULL_HISTORY 1u
+// Frustum and occlusion, recording the result. Only spheres not visible last frame are kept, the others are drawn already.
+#define CULL_REFINE 2u
+// Frustum and occlusion
+#define CULL_OCCLUSION 3u
+
+uniform uint mode = CULL_FRUSTUM;
+
+// Range of the group in the scene, and the vertex the drawn copy of the scene starts at
+uniform uint first = 0u;
+uniform uint count = 0u;
+uniform uint baseVertex = 0u;
+// Where the output goes
+uniform uint commandIndex = 0u;
+uniform uint firstIndex = 0u;
+// Normalized planes, facing into the frustum
+uniform vec4 planes[6];
+uniform float radiusScale = 1.0;
+
+uniform mat4 modelViewMatrix;
+uniform mat4 projectionMatrix;
+// Distance from the eye to the corners of the near plane. Drawn distances are measured from the near plane.
+uniform float nearPlaneDistance = 0.0;
+
+// Pixels covered by a unit length at distance 1
+uniform float projectionScale = 1.0;
+// Spheres with a smaller projected radius (scaled by splatRadiusScale) are splats. 0 disables splats.
+uniform float splatPixels = 0.0;
+uniform float splatRadiusScale = 1.0;
+// Set for the one dispatch per frame and group that writes the splat list
+uniform bool writeSplats = false;
+uniform uint splatCommand = 0u;
+uniform uint splatFirstIndex = 0u;
+
+shared uint visibleCount;
+shared uint groupOffset;
+shared uint splatCount;
+shared uint splatOffset;
+
+vec4 loadSphere(uint i)
+{
+#ifdef QUANTIZED
+	uvec2 q = spheres[baseVertex + i];
+	uint cluster = i / CLUSTER_SIZE;
+	vec3 quantized = vec3(q.x & 0xFFFFu, q.x >> 16, q.y & 0xFFFFu);
+	return vec4(clusters[2u * cluster].xyz + quantized * clusters[2u * cluster + 1u].xyz, radii[(q.y >> 16) & 0xFFu]);
+#else
+	return spheres[baseVertex + i];
+#endif
+}
+
+// Projected radius under splatPixels, by the same estimate the bounds of a small sphere reduce to (see sphere.geom.glsl)
+bool isSplat(vec4 sphere)
+{
+	if (splatPixels <= 0.0)
+		return false;
+	float radius = sphere.w * splatRadiusScale;
+	float depth = -(modelViewMatrix * vec4(sphere.xyz, 1.0)).z;
+	if (depth - radius <= nearPlaneDistance)
+		return false;
+	return projectionScale * radius < splatPixels * depth;
+}
+
+bool isOccluded(vec3 center, float radius)
+{
+	vec3 c = (modelViewMatrix * vec4(center, 1.0)).xyz;
+	// Lower bound of the distance from the near plane to the sphere, along any ray
+	float nearest = length(c) - radius - nearPlaneDistance;
+	if (nearest <= 0.0)
+		return false;
+
+	// Screen bounds of the view space bounding box
+	vec2 lo = vec2(1.0);
+	vec2 hi = vec2(-1.0);
+	for (int k = 0; k < 8; ++k)
+	{
+		vec3 corner = c + radius * vec3((k & 1) == 0 ? -1.0 : 1.0, (k & 2) == 0 ? -1.0 : 1.0, (k & 4) == 0 ? -1.0 : 1.0);
+		vec4 clip = projectionMatrix * vec4(corner, 1.0);
+		if (clip.w <= 0.0)
+			return false;
+		lo = min(lo, clip.xy / clip.w);
+		hi = max(hi, clip.xy / clip.w);
+	}
+	vec2 screenSize = vec2(textureSize(hiZTexture, 0));
+	lo = clamp(lo * 0.5 + 0.5, 0.0, 1.0) * screenSize;
+	hi = clamp(hi * 0.5 + 0.5, 0.0, 1.0) * screenSize;
+
+	// The level where the bounds span at most two texels in each direction
+	vec2 extent = hi - lo;
+	int level = min(int(ceil(log2(max(max(extent.x, extent.y), 1.0)))), textureQueryLevels(hiZTexture) - 1);
+	ivec2 levelMax = textureSize(hiZTexture, level) - 1;
+	ivec2 a = min(ivec2(lo) >> level, levelMax);
+	ivec2 b = min(ivec2(hi) >> level, levelMax);
+
+	float farthest = max(max(texelFetch(hiZTexture, a, level).r, texelFetch(hiZTexture, ivec2(b.x, a.y), level).r),
+		max(texelFetch(hiZTexture, ivec2(a.x, b.y), level).r, texelFetch(hiZTexture, b, level).r));
+	return farthest < nearest;
+}
+
+void main()
+{
+	if (gl_LocalInvocationIndex == 0u)
+	{
+		visibleCount = 0u;
+		splatCount = 0u;
+	}
+	barrier();
+
+	uint i = first + gl_GlobalInvocationID.x;
+	bool visible = gl_GlobalInvocationID.x < count;
+	bool splat = false;
+	if (visible)
+	{
+		vec4 sphere = loadSphere(i);
+		float radius = sphere.w * radiusScale;
+		for (int p = 0; p < 6; ++p)
+			visible = visible && -radius <= dot(planes[p].xyz, sphere.xyz) + planes[p].w;
+
+		if (visible && isSplat(sphere))
+		{
+			visible = false;
+			splat = writeSplats && !(mode == CULL_OCCLUSION && isOccluded(sphere.xyz, sphere.w));
+		}
+		else if (mode == CULL_HISTORY)
+		{
+			visible = visible && visibility[i] != 0u;
+		}
+		else if (mode == CULL_REFINE)
+		{
+			visible = visible && !isOccluded(sphere.xyz, radius);
+			bool drawn = visibility[i] != 0u;
+			visibility[i] = visible ? 1u : 0u;
+			visible = visible && !drawn;
+		}
+		else if (mode == CULL_OCCLUSION)
+		{
+			visible = visible && !isOccluded(sphere.xyz, radius);
+		}
+	}
+
+	// Compact within the workgroup first, so there's a single global atomic per workgroup
+	uint localIndex = 0u;
+	uint splatIndex = 0u;
+	if (visible)
+		localIndex = atomicAdd(visibleCount, 1u);
+	if (splat)
+		splatIndex = atomicAdd(splatCount, 1u);
+	barrier();
+	if (gl_LocalInvocationIndex == 0u)
+	{
+		groupOffset = atomicAdd(commands[commandIndex].count, visibleCount);
+		if (0u < splatCount)
+			splatOffset = atomicAdd(commands[splatCommand].count, splatCount);
+	}
+	barrier();
+
+	if (visible)
+		indices[firstIndex + groupOffset + localIndex] = baseVertex + i;
+	if (splat)
+		indices[splatFirstIndex + splatOffset + splatIndex] = baseVertex + i;
+}
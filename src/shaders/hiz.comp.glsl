@@ -0,0 +1,38 @@
+// Builds one level of the depth pyramid used for occlusion culling (see cull.comp.glsl).
+// Every texel holds the farthest distance (positionTexture.w) of the pixels it covers.
+#version 450
+
+layout(local_size_x = 16, local_size_y = 16) in;
+
+layout(binding = 0) uniform sampler2D positionTexture;
+layout(r32f, binding = 0) readonly uniform image2D source;
+layout(r32f, binding = 1) writeonly uniform image2D destination;
+
+// Level 0 is copied from positionTexture, the others reduce the level above (bound as source)
+uniform uint level = 0u;
+
+void main()
+{
+	ivec2 p = ivec2(gl_GlobalInvocationID.xy);
+	ivec2 size = imageSize(destination);
+	if (any(greaterThanEqual(p, size)))
+		return;
+
+	if (level == 0u)
+	{
+		imageStore(destination, p, vec4(texelFetch(positionTexture, p, 0).w));
+		return;
+	}
+
+	// The last texel also covers the extra row or column of an odd sized level above it,
+	// so texel p of level n covers the pixels [p * 2^n, (p + 1) * 2^n), clamped to the last texel
+	ivec2 sourceSize = imageSize(source);
+	ivec2 first = 2 * p;
+	ivec2 last = min(first + 1 + ivec2(equal(p, size - 1)) * (sourceSize & 1), sourceSize - 1);
+
+	float farthest = 0.0;
+	for (int y = first.y; y <= last.y; ++y)
+		for (int x = first.x; x <= last.x; ++x)
+			farthest = max(farthest, imageLoad(source, ivec2(x, y)).r);
+	imageStore(destination, p, vec4(farthest));
+}
@@ -0,0 +1,268 @@
+// Builds a linear BVH (Karras 2012) over the spheres of one render group, in stages (see Scene::buildLbvh):
+// scene bounds, Morton codes of the centers, which are then sorted by radixsort.comp.glsl, the tree topology from
+// the sorted codes, and finally the bounds of the nodes, bottom-up.
+// Nodes of a group start at twice its first sphere: first the count - 1 inner nodes, then the leaves in code order.
+#version 450
+
+layout(local_size_x = 256) in;
+
+#ifdef QUANTIZED
+// Same encoding as sphere.vert.glsl
+layout(std430, binding = 0) readonly buffer sphereBuffer
+{
+	uvec2 spheres[];
+};
+
+layout(std430, binding = 2) readonly buffer clusterBuffer
+{
+	vec4 clusters[];
+};
+
+layout(std430, binding = 3) readonly buffer radiusBuffer
+{
+	float radii[];
+};
+#else
+layout(std430, binding = 0) readonly buffer sphereBuffer
+{
+	vec4 spheres[];
+};
+#endif
+
+// Bounds of the centers of every group, low then high corner, as order preserving uints (see orderedBits)
+layout(std430, binding = 1) buffer boundsBuffer
+{
+	uint bounds[];
+};
+
+layout(std430, binding = 4) buffer keyBuffer
+{
+	uint keys[];
+};
+
+// Scene index of every key
+layout(std430, binding = 5) buffer valueBuffer
+{
+	uint values[];
+};
+
+struct Node
+{
+	vec3 lo;
+	// Left child, or the sphere of a leaf
+	uint left;
+	vec3 hi;
+	// Right child, or LEAF
+	uint right;
+};
+
+layout(std430, binding = 6) coherent buffer nodeBuffer
+{
+	Node nodes[];
+};
+
+struct Link
+{
+	uint parent;
+	// Children done with so far, while fitting
+	uint visits;
+};
+
+layout(std430, binding = 7) coherent buffer linkBuffer
+{
+	Link links[];
+};
+
+// Spheres in leaf order, read by trace.frag.glsl
+layout(std430, binding = 8) writeonly buffer leafSphereBuffer
+{
+	vec4 leafSpheres[];
+};
+
+#define LBVH_BOUNDS 0u
+#define LBVH_MORTON 1u
+#define LBVH_BUILD 2u
+#define LBVH_FIT 3u
+
+#define LEAF 0xFFFFFFFFu
+#define NO_PARENT 0xFFFFFFFFu
+
+uniform uint stage = LBVH_BOUNDS;
+uniform uint group = 0u;
+// Range of the group in the scene, and the vertex the drawn copy of the scene starts at
+uniform uint first = 0u;
+uniform uint count = 0u;
+uniform uint baseVertex = 0u;
+// Leaves bound the spheres scaled by this
+uniform float radiusScale = 1.0;
+
+shared uint sharedBounds[6];
+
+vec4 loadSphere(uint i)
+{
+#ifdef QUANTIZED
+	uvec2 q = spheres[baseVertex + i];
+	uint cluster = i / CLUSTER_SIZE;
+	vec3 quantized = vec3(q.x & 0xFFFFu, q.x >> 16, q.y & 0xFFFFu);
+	return vec4(clusters[2u * cluster].xyz + quantized * clusters[2u * cluster + 1u].xyz, radii[(q.y >> 16) & 0xFFu]);
+#else
+	return spheres[baseVertex + i];
+#endif
+}
+
+// Float bits that sort like the floats, so atomicMin and atomicMax work on them
+uvec3 orderedBits(vec3 v)
+{
+	uvec3 bits = floatBitsToUint(v);
+	return mix(~bits, bits | 0x80000000u, greaterThanEqual(v, vec3(0.0)));
+}
+
+vec3 fromOrderedBits(uvec3 bits)
+{
+	return uintBitsToFloat(mix(~bits, bits & 0x7FFFFFFFu, greaterThanEqual(bits, uvec3(0x80000000u))));
+}
+
+// Spreads the lower 10 bits of v so there are two zero bits between every bit (see morton.h)
+uint expandBits(uint v)
+{
+	v = (v * 0x00010001u) & 0xFF0000FFu;
+	v = (v * 0x00000101u) & 0x0F00F00Fu;
+	v = (v * 0x00000011u) & 0xC30C30C3u;
+	v = (v * 0x00000005u) & 0x49249249u;
+	return v;
+}
+
+// Length of the common prefix of two sorted keys, with the position as a tie breaker for equal keys
+int delta(int i, int j)
+{
+	if (j < 0 || int(count) <= j)
+		return -1;
+	uint a = keys[first + uint(i)], b = keys[first + uint(j)];
+	return a == b ? 32 + 31 - findMSB(uint(i) ^ uint(j)) : 31 - findMSB(a ^ b);
+}
+
+uint innerNode(int i)
+{
+	return 2u * first + uint(i);
+}
+
+uint leafNode(int i)
+{
+	return 2u * first + count - 1u + uint(i);
+}
+
+void computeBounds(uint i)
+{
+	uint k = gl_LocalInvocationIndex;
+	if (k < 6u)
+		sharedBounds[k] = k < 3u ? 0xFFFFFFFFu : 0u;
+	barrier();
+
+	if (i < count)
+	{
+		uvec3 bits = orderedBits(loadSphere(first + i).xyz);
+		for (uint axis = 0u; axis < 3u; ++axis)
+		{
+			atomicMin(sharedBounds[axis], bits[axis]);
+			atomicMax(sharedBounds[3u + axis], bits[axis]);
+		}
+	}
+	barrier();
+
+	if (k < 3u)
+		atomicMin(bounds[6u * group + k], sharedBounds[k]);
+	else if (k < 6u)
+		atomicMax(bounds[6u * group + k], sharedBounds[k]);
+}
+
+void computeMortonCode(uint i)
+{
+	vec3 lo = fromOrderedBits(uvec3(bounds[6u * group], bounds[6u * group + 1u], bounds[6u * group + 2u]));
+	vec3 hi = fromOrderedBits(uvec3(bounds[6u * group + 3u], bounds[6u * group + 4u], bounds[6u * group + 5u]));
+	vec3 cell = clamp((loadSphere(first + i).xyz - lo) / max(hi - lo, vec3(1e-30)) * 1024.0, vec3(0.0), vec3(1023.0));
+	uvec3 c = uvec3(cell);
+	keys[first + i] = expandBits(c.x) << 2 | expandBits(c.y) << 1 | expandBits(c.z);
+	values[first + i] = first + i;
+}
+
+// Thread i sets up leaf i and, but for the last one, inner node i
+void buildNode(int i)
+{
+	vec4 sphere = loadSphere(values[first + uint(i)]);
+	float radius = sphere.w * max(radiusScale, 1.0);
+	leafSpheres[first + uint(i)] = sphere;
+	nodes[leafNode(i)] = Node(sphere.xyz - radius, first + uint(i), sphere.xyz + radius, LEAF);
+	if (i == 0)
+		links[2u * first].parent = NO_PARENT;
+	if (int(count) - 1 <= i)
+		return;
+
+	// Direction of the range of the node, and its other end
+	int d = delta(i, i + 1) < delta(i, i - 1) ? -1 : 1;
+	int deltaMin = delta(i, i - d);
+	int lengthMax = 2;
+	while (deltaMin < delta(i, i + lengthMax * d))
+		lengthMax *= 2;
+	int l = 0;
+	for (int t = lengthMax / 2; 1 <= t; t /= 2)
+		if (deltaMin < delta(i, i + (l + t) * d))
+			l += t;
+	int j = i + l * d;
+
+	// Split where the common prefix gets longer than the node's
+	int deltaNode = delta(i, j);
+	int s = 0;
+	for (int divisor = 2; ; divisor *= 2)
+	{
+		int t = (l + divisor - 1) / divisor;
+		if (deltaNode < delta(i, i + (s + t) * d))
+			s += t;
+		if (t <= 1)
+			break;
+	}
+	int split = i + s * d + min(d, 0);
+
+	uint left = min(i, j) == split ? leafNode(split) : innerNode(split);
+	uint right = max(i, j) == split + 1 ? leafNode(split + 1) : innerNode(split + 1);
+	nodes[innerNode(i)].left = left;
+	nodes[innerNode(i)].right = right;
+	links[left].parent = innerNode(i);
+	links[right].parent = innerNode(i);
+	links[innerNode(i)].visits = 0u;
+}
+
+// Walks up from leaf i. The second child to arrive at a node fits it, so every node is fit after both children.
+void fitNodes(int i)
+{
+	uint node = links[leafNode(i)].parent;
+	while (node != NO_PARENT)
+	{
+		memoryBarrierBuffer();
+		if (atomicAdd(links[node].visits, 1u) == 0u)
+			return;
+		Node left = nodes[nodes[node].left];
+		Node right = nodes[nodes[node].right];
+		nodes[node].lo = min(left.lo, right.lo);
+		nodes[node].hi = max(left.hi, right.hi);
+		node = links[node].parent;
+	}
+}
+
+void main()
+{
+	uint i = gl_GlobalInvocationID.x;
+	if (stage == LBVH_BOUNDS)
+	{
+		computeBounds(i);
+		return;
+	}
+	if (count <= i)
+		return;
+
+	if (stage == LBVH_MORTON)
+		computeMortonCode(i);
+	else if (stage == LBVH_BUILD)
+		buildNode(int(i));
+	else if (stage == LBVH_FIT)
+		fitNodes(int(i));
+}
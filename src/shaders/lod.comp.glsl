@@ -0,0 +1,118 @@
+// Picks a level of detail for every cluster of one render group (see lod.h) by the projected size of the level's cells,
+// and appends the cluster's spheres at that level to the scene or LOD index list. One workgroup per cluster.
+#version 450
+
+layout(local_size_x = 64) in;
+
+// LodCluster
+struct Cluster
+{
+	vec4 bounds;
+	uvec4 first;
+	uvec4 count;
+	float maxRadius;
+};
+
+// DrawElementsIndirectCommand
+struct DrawCommand
+{
+	uint count;
+	uint instanceCount;
+	uint firstIndex;
+	int baseVertex;
+	uint baseInstance;
+};
+
+layout(std430, binding = 4) buffer commandBuffer
+{
+	DrawCommand commands[];
+};
+
+layout(std430, binding = 5) writeonly buffer indexBuffer
+{
+	uint indices[];
+};
+
+layout(std430, binding = 7) readonly buffer clusterBuffer
+{
+	Cluster clusters[];
+};
+
+// Scene indices of the spheres of every cluster
+layout(std430, binding = 8) readonly buffer leafBuffer
+{
+	uint leaves[];
+};
+
+uniform uint clusterFirst = 0u;
+uniform uint clusterCount = 0u;
+// Vertex the drawn copy of the scene starts at
+uniform uint baseVertex = 0u;
+// Level 0 goes to the scene list, the others to the LOD list
+uniform uint sceneCommand = 0u;
+uniform uint sceneFirstIndex = 0u;
+uniform uint lodCommand = 0u;
+uniform uint lodFirstIndex = 0u;
+
+// Normalized planes, facing into the frustum
+uniform vec4 planes[6];
+uniform float radiusScale = 1.0;
+uniform mat4 modelViewMatrix;
+uniform float nearPlaneDistance = 0.0;
+// Pixels covered by a unit length at distance 1
+uniform float projectionScale = 1.0;
+uniform vec4 cellSizes;
+// Coarsest level whose cells project to at most this many pixels is drawn
+uniform float pixelThreshold = 3.0;
+
+shared bool visible;
+shared uint level;
+shared uint listOffset;
+
+void main()
+{
+	// Clusters past 65535 continue in y
+	uint c = gl_WorkGroupID.x + gl_WorkGroupID.y * gl_NumWorkGroups.x;
+	if (clusterCount <= c)
+		return;
+	c += clusterFirst;
+
+	if (gl_LocalInvocationIndex == 0u)
+	{
+		vec4 bounds = clusters[c].bounds;
+		float radius = bounds.w + clusters[c].maxRadius * radiusScale;
+		visible = true;
+		for (int p = 0; p < 6; ++p)
+			visible = visible && -radius <= dot(planes[p].xyz, bounds.xyz) + planes[p].w;
+
+		level = 0u;
+		if (visible)
+		{
+			float clusterDistance = max(length((modelViewMatrix * vec4(bounds.xyz, 1.0)).xyz) - radius, nearPlaneDistance);
+			float pixelsPerUnit = projectionScale / clusterDistance;
+			for (uint l = 3u; 0u < l; --l)
+			{
+				if (cellSizes[l] * pixelsPerUnit <= pixelThreshold)
+				{
+					level = l;
+					break;
+				}
+			}
+			listOffset = atomicAdd(commands[level == 0u ? sceneCommand : lodCommand].count, clusters[c].count[level]);
+		}
+	}
+	barrier();
+
+	if (!visible)
+		return;
+
+	uint count = clusters[c].count[level];
+	uint first = clusters[c].first[level];
+	for (uint k = gl_LocalInvocationIndex; k < count; k += gl_WorkGroupSize.x)
+	{
+		if (level == 0u)
+			indices[sceneFirstIndex + listOffset + k] = baseVertex + leaves[first + k];
+		else
+			indices[lodFirstIndex + listOffset + k] = first + k;
+	}
+}
@@ -0,0 +1,148 @@
+// One 4-bit pass of a stable least significant digit radix sort of key-value pairs (see Scene::buildLbvh).
+// Every workgroup counts its digits, the counts are scanned into global offsets, and every workgroup scatters its
+// pairs to the offset of their digit plus their rank among the workgroup's pairs with the same digit.
+#version 450
+
+layout(local_size_x = 256) in;
+
+layout(std430, binding = 4) buffer keyBuffer
+{
+	uint keys[];
+};
+
+layout(std430, binding = 5) buffer valueBuffer
+{
+	uint values[];
+};
+
+// Digit counts, digit major (digit * groupCount + workgroup), scanned in place into offsets
+layout(std430, binding = 9) buffer histogramBuffer
+{
+	uint histogram[];
+};
+
+#define RADIX_COUNT 0u
+#define RADIX_SCAN 1u
+#define RADIX_SCATTER 2u
+
+#define DIGITS 16u
+
+uniform uint mode = RADIX_COUNT;
+// Range of the pairs, in the input and output halves of the buffers
+uniform uint first = 0u;
+uniform uint count = 0u;
+uniform uint inputOffset = 0u;
+uniform uint outputOffset = 0u;
+uniform uint shift = 0u;
+// Workgroups of the count and scatter dispatches
+uint groupCount()
+{
+	return (count + 255u) / 256u;
+}
+
+// Per thread digit counts, 16 bits per digit: digits 0-7 in the low vector, 8-15 in the high one
+shared uvec4 scanLow[256];
+shared uvec4 scanHigh[256];
+shared uint chunkSums[256];
+
+uint digitCount(uvec4 low, uvec4 high, uint digit)
+{
+	uvec4 v = digit < 8u ? low : high;
+	return (v[(digit & 7u) >> 1] >> ((digit & 1u) * 16u)) & 0xFFFFu;
+}
+
+// Inclusive scan of the one-hot digits of the workgroup's keys. Returns the key's digit, or DIGITS past the end.
+uint scanDigits(out uint key, out uint value)
+{
+	uint t = gl_LocalInvocationIndex;
+	uint i = gl_WorkGroupID.x * 256u + t;
+	uint digit = DIGITS;
+	uvec4 low = uvec4(0u), high = uvec4(0u);
+	if (i < count)
+	{
+		key = keys[inputOffset + first + i];
+		value = values[inputOffset + first + i];
+		digit = (key >> shift) & (DIGITS - 1u);
+		uint bit = 1u << ((digit & 1u) * 16u);
+		if (digit < 8u)
+			low[(digit & 7u) >> 1] = bit;
+		else
+			high[(digit & 7u) >> 1] = bit;
+	}
+	scanLow[t] = low;
+	scanHigh[t] = high;
+	barrier();
+
+	for (uint offset = 1u; offset < 256u; offset *= 2u)
+	{
+		uvec4 addLow = uvec4(0u), addHigh = uvec4(0u);
+		if (offset <= t)
+		{
+			addLow = scanLow[t - offset];
+			addHigh = scanHigh[t - offset];
+		}
+		barrier();
+		scanLow[t] += addLow;
+		scanHigh[t] += addHigh;
+		barrier();
+	}
+	return digit;
+}
+
+// Exclusive scan of the whole histogram by a single workgroup, every thread summing a contiguous chunk
+void scanHistogram()
+{
+	uint t = gl_LocalInvocationIndex;
+	uint size = DIGITS * groupCount();
+	uint chunk = (size + 255u) / 256u;
+	uint begin = min(t * chunk, size), end = min(begin + chunk, size);
+
+	uint sum = 0u;
+	for (uint i = begin; i < end; ++i)
+		sum += histogram[i];
+	chunkSums[t] = sum;
+	barrier();
+
+	for (uint offset = 1u; offset < 256u; offset *= 2u)
+	{
+		uint add = offset <= t ? chunkSums[t - offset] : 0u;
+		barrier();
+		chunkSums[t] += add;
+		barrier();
+	}
+
+	uint prefix = chunkSums[t] - sum;
+	for (uint i = begin; i < end; ++i)
+	{
+		uint c = histogram[i];
+		histogram[i] = prefix;
+		prefix += c;
+	}
+}
+
+void main()
+{
+	if (mode == RADIX_SCAN)
+	{
+		scanHistogram();
+		return;
+	}
+
+	uint key = 0u, value = 0u;
+	uint digit = scanDigits(key, value);
+	uint t = gl_LocalInvocationIndex;
+	if (mode == RADIX_COUNT)
+	{
+		if (t < DIGITS)
+			histogram[t * groupCount() + gl_WorkGroupID.x] = digitCount(scanLow[255], scanHigh[255], t);
+		return;
+	}
+
+	if (digit < DIGITS)
+	{
+		uint rank = digitCount(scanLow[t], scanHigh[t], digit) - 1u;
+		uint target = histogram[digit * groupCount() + gl_WorkGroupID.x] + rank;
+		keys[outputOffset + first + target] = key;
+		values[outputOffset + first + target] = value;
+	}
+}
@@ -8,6 +8,7 @@ layout(pixel_center_integer) in vec4 gl_FragCoord;
 
 in vec2 ndc;
 
+uniform mat4 MVP = mat4(1.0);
 uniform mat4 MVPInverse = mat4(1.0);
 uniform float time = 0.0;
 uniform float smoothing = 0.13;
@@ -69,6 +70,9 @@ vec3 gradient(in vec4 entries[MAX_ENTRIES], uint entryCount, vec3 p) {
 
 void main()
 {
+    // Depth of the hit for the splats drawn after this pass, misses are at the far plane
+    gl_FragDepth = 1.0;
+
     // Near and far plane
     vec4 near = MVPInverse * vec4(ndc, -1., 1.0);
     near /= near.w;
@@ -117,6 +121,8 @@ void main()
             vec3 normal = normalize(grad);
             vec3 phong = vec3(1.0, 0.0, 0.0) * max(dot(normal, -lightDir), 0.15);
             fragColor = vec4(phong, 1.0);
+            vec4 clip = MVP * vec4(p.xyz, 1.0);
+            gl_FragDepth = clip.z / clip.w * 0.5 + 0.5;
             // fragColor = vec4(vec3(p.w + dist), 1.0);
             return;
         }
@@ -8,6 +8,7 @@
 #version 450
 
 in float vRadius[];
+flat in uint vSphereId[];
 
 uniform mat4 modelViewMatrix;
 uniform mat4 projectionMatrix;
@@ -212,7 +213,7 @@ void main()
     float sphereRadius = vRadius[0] * radiusScale;
     float sphereClipRadius = sphereRadius * clipRadiusScale;
 
-	gSphereId = gl_PrimitiveIDIn;
+	gSphereId = vSphereId[0];
 	gSpherePosition = gl_in[0].gl_Position;
     gSphereRadius = vRadius[0];
 	gOuterRadius = sphereRadius;
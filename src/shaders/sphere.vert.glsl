@@ -1,11 +1,40 @@
 #version 450 core
 
+#ifdef QUANTIZED
+// x | y << 16, z | radius index << 16 (see quantization.h)
+layout (location = 0) in uvec2 inQuantized;
+
+// Origin and step of every cluster of CLUSTER_SIZE spheres
+layout(std430, binding = 2) readonly buffer clusterBuffer
+{
+    vec4 clusters[];
+};
+
+layout(std430, binding = 3) readonly buffer radiusBuffer
+{
+    float radii[];
+};
+#else
 layout (location = 0) in vec4 inPos;
+#endif
+
+// The buffer holds several copies of the scene, so this recovers the sphere index from the vertex index.
+// Culled draws are indexed, so the primitive ID no longer identifies the sphere.
+uniform uint sceneSize;
 
 out float vRadius;
+flat out uint vSphereId;
 
 void main()
 {
+    vSphereId = uint(gl_VertexID) % sceneSize;
+#ifdef QUANTIZED
+    const uint cluster = vSphereId / CLUSTER_SIZE;
+    const vec3 quantized = vec3(inQuantized.x & 0xFFFFu, inQuantized.x >> 16, inQuantized.y & 0xFFFFu);
+    vRadius = radii[(inQuantized.y >> 16) & 0xFFu];
+    gl_Position = vec4(clusters[2u * cluster].xyz + quantized * clusters[2u * cluster + 1u].xyz, 1.0);
+#else
     vRadius = inPos.w;
     gl_Position = vec4(inPos.xyz, 1.0);
-}
\ No newline at end of file
+#endif
+}
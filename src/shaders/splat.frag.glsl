@@ -0,0 +1,9 @@
+#version 450 core
+
+out vec4 fragColor;
+
+void main()
+{
+	// Average of the surface pass shading over the visible disk of a sphere, max(dot(n, -rd), 0.15) averages to about 2/3
+	fragColor = vec4(vec3(1.0, 0.0, 0.0) * (2.0 / 3.0), 1.0);
+}
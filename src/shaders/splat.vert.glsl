@@ -0,0 +1,40 @@
+#version 450 core
+
+#ifdef QUANTIZED
+// x | y << 16, z | radius index << 16 (see quantization.h)
+layout (location = 0) in uvec2 inQuantized;
+
+layout(std430, binding = 2) readonly buffer clusterBuffer
+{
+    vec4 clusters[];
+};
+
+layout(std430, binding = 3) readonly buffer radiusBuffer
+{
+    float radii[];
+};
+#else
+layout (location = 0) in vec4 inPos;
+#endif
+
+uniform uint sceneSize;
+uniform mat4 MVP;
+uniform float radiusScale = 1.0;
+// Pixels covered by a unit length at distance 1
+uniform float projectionScale = 1.0;
+
+void main()
+{
+#ifdef QUANTIZED
+    const uint cluster = (uint(gl_VertexID) % sceneSize) / CLUSTER_SIZE;
+    const vec3 quantized = vec3(inQuantized.x & 0xFFFFu, inQuantized.x >> 16, inQuantized.y & 0xFFFFu);
+    const float radius = radii[(inQuantized.y >> 16) & 0xFFu];
+    const vec3 center = clusters[2u * cluster].xyz + quantized * clusters[2u * cluster + 1u].xyz;
+#else
+    const float radius = inPos.w;
+    const vec3 center = inPos.xyz;
+#endif
+    gl_Position = MVP * vec4(center, 1.0);
+    // Sub-pixel spheres still cover the pixel they are in
+    gl_PointSize = max(1.0, 2.0 * projectionScale * radius * radiusScale / gl_Position.w);
+}
@@ -0,0 +1,216 @@
+#version 450 core
+
+// Ray traced surface: the same smooth union as sdf.frag.glsl, of the spheres found by traversing the linear BVH
+// of every render group (see lbvh.comp.glsl) instead of the per-pixel lists of the list pass.
+
+#define EPSILON 0.001
+#define MAX_STEPS 100u
+// lbvh.comp.glsl splits every node at a longer common prefix of the 64 bits it compares, a 30 bit Morton code in a
+// 32 bit word followed by the 32 bit index, of which the two top bits always match. So a path down the tree has at
+// most 62 interior nodes, and the stack, which holds one pending sibling per level, at most 63 entries.
+#define STACK_SIZE 64
+
+in vec2 ndc;
+
+uniform mat4 MVP = mat4(1.0);
+uniform mat4 MVPInverse = mat4(1.0);
+uniform float smoothing = 0.13;
+uniform float interpolation = 0.0;
+uniform float radiusScale = 1.0;
+// Root node and sphere count of both groups
+uniform uvec2 roots = uvec2(0u);
+uniform uvec2 counts = uvec2(0u);
+
+#define LEAF 0xFFFFFFFFu
+
+struct Node
+{
+	vec3 lo;
+	uint left;
+	vec3 hi;
+	uint right;
+};
+
+layout(std430, binding = 6) readonly buffer nodeBuffer
+{
+	Node nodes[];
+};
+
+layout(std430, binding = 8) readonly buffer leafSphereBuffer
+{
+	vec4 leafSpheres[];
+};
+
+out vec4 fragColor;
+
+// Set when a traversal ran out of stack and skipped part of the tree, shown in magenta instead of a wrong surface
+bool bStackOverflow = false;
+
+// SDF:
+float sdfSphere(vec3 sp, float sr, vec3 p) {
+    return length(sp - p) - sr;
+}
+
+// https://iquilezles.org/www/articles/smin/smin.htm
+// polynomial smooth min (k = 0.1);
+float smin( float a, float b, float k )
+{
+    float h = max( k-abs(a-b), 0.0 )/k;
+    return min( a, b ) - h*h*k*(1.0/4.0);
+}
+
+float sdf(in vec4 entries[MAX_ENTRIES], uint entryCount, vec3 p) {
+    if (entryCount < 1u)
+        return -1.;
+    else if (entryCount < 2u)
+        return sdfSphere(entries[0].xyz, entries[0].w, p);
+    else {
+        float m = sdfSphere(entries[0].xyz, entries[0].w, p);
+        for (uint i = 1u; i < entryCount; ++i)
+            m = smin(m, sdfSphere(entries[i].xyz, entries[i].w, p), smoothing);
+        return m;
+    }
+}
+
+vec3 gradient(in vec4 entries[MAX_ENTRIES], uint entryCount, vec3 p) {
+    return vec3(
+        sdf(entries, entryCount, p + vec3(EPSILON, 0., 0.)) - sdf(entries, entryCount, p - vec3(EPSILON, 0., 0.)),
+        sdf(entries, entryCount, p + vec3(0., EPSILON, 0.)) - sdf(entries, entryCount, p - vec3(0., EPSILON, 0.)),
+        sdf(entries, entryCount, p + vec3(0., 0., EPSILON)) - sdf(entries, entryCount, p - vec3(0., 0., EPSILON))
+    );
+}
+
+// Distance along the ray to where it enters the sphere, negative if it misses or the sphere is behind it
+float sphereEntry(vec3 ro, vec3 rd, vec4 sphere, float radius)
+{
+    vec3 oc = ro - sphere.xyz;
+    float b = dot(oc, rd);
+    float discriminant = b * b - dot(oc, oc) + radius * radius;
+    if (discriminant < 0.0)
+        return -1.0;
+    float root = sqrt(discriminant);
+    return -b - root < 0.0 ? -b + root : -b - root;
+}
+
+float boxEntry(vec3 ro, vec3 invRd, Node node)
+{
+    vec3 t0 = (node.lo - ro) * invRd, t1 = (node.hi - ro) * invRd;
+    vec3 tNear = min(t0, t1), tFar = max(t0, t1);
+    float enter = max(max(tNear.x, tNear.y), max(tNear.z, 0.0));
+    float exit = min(min(tFar.x, tFar.y), tFar.z);
+    return enter <= exit ? enter : -1.0;
+}
+
+// Collects the spheres whose outer radius the ray enters before it hits the first sphere, like the list pass does.
+// Keeps the MAX_ENTRIES closest ones, in order.
+uint collect(uint root, vec3 ro, vec3 rd, out vec4 entries[MAX_ENTRIES])
+{
+    float entryDistances[MAX_ENTRIES];
+    uint entryCount = 0u;
+    // Closest hit of an actual sphere so far, nothing behind it is collected
+    float firstHit = 1e30;
+    vec3 invRd = 1.0 / rd;
+
+    uint stack[STACK_SIZE];
+    int size = 0;
+    stack[size++] = root;
+    while (0 < size)
+    {
+        Node node = nodes[stack[--size]];
+        float t = boxEntry(ro, invRd, node);
+        if (t < 0.0 || firstHit < t)
+            continue;
+
+        if (node.right != LEAF)
+        {
+            if (STACK_SIZE < size + 2)
+            {
+                bStackOverflow = true;
+                continue;
+            }
+            stack[size++] = node.right;
+            stack[size++] = node.left;
+            continue;
+        }
+
+        vec4 sphere = leafSpheres[node.left];
+        float outer = sphereEntry(ro, rd, sphere, sphere.w * radiusScale);
+        if (outer < 0.0 || firstHit < outer)
+            continue;
+        float inner = sphereEntry(ro, rd, sphere, sphere.w);
+        if (0.0 <= inner)
+            firstHit = min(firstHit, inner);
+
+        // Insertion into the sorted entries, dropping the farthest when full
+        if (entryCount == MAX_ENTRIES && entryDistances[MAX_ENTRIES - 1u] <= outer)
+            continue;
+        uint i = min(entryCount, MAX_ENTRIES - 1u);
+        for (; 0u < i && outer < entryDistances[i - 1u]; --i)
+        {
+            entries[i] = entries[i - 1u];
+            entryDistances[i] = entryDistances[i - 1u];
+        }
+        entries[i] = sphere;
+        entryDistances[i] = outer;
+        entryCount = min(entryCount + 1u, MAX_ENTRIES);
+    }
+
+    while (0u < entryCount && firstHit < entryDistances[entryCount - 1u])
+        --entryCount;
+    return entryCount;
+}
+
+void main()
+{
+    // Depth of the hit for the splats drawn after this pass, misses are at the far plane
+    gl_FragDepth = 1.0;
+
+    // Near and far plane
+    vec4 near = MVPInverse * vec4(ndc, -1., 1.0);
+    near /= near.w;
+    vec4 far = MVPInverse * vec4(ndc, 1., 1.0);
+    far /= far.w;
+
+    vec4 ro = vec4(near.xyz, 0.0);
+    vec4 rd = vec4(normalize((far - near).xyz), 1.0);
+
+    vec4 entries[MAX_ENTRIES], entries2[MAX_ENTRIES];
+    uint entryCount = 0u < counts.x ? collect(roots.x, ro.xyz, rd.xyz, entries) : 0u;
+    uint entryCount2 = 0u < counts.y ? collect(roots.y, ro.xyz, rd.xyz, entries2) : 0u;
+    if (bStackOverflow) {
+        fragColor = vec4(1.0, 0.0, 1.0, 1.0);
+        return;
+    }
+    bool bEmpty = entryCount == 0;
+    bool bEmpty2 = entryCount2 == 0;
+    if (bEmpty && bEmpty2) {
+        fragColor = vec4(abs(rd.xyz) * 0.6, 1.0);
+        return;
+    }
+
+    vec4 p = ro;
+    for (uint i = 0u; i < MAX_STEPS; ++i) {
+        float dist =    bEmpty ? sdf(entries2, entryCount2, p.xyz) :
+                        bEmpty2 ? sdf(entries, entryCount, p.xyz) :
+                        mix(sdf(entries, entryCount, p.xyz), sdf(entries2, entryCount2, p.xyz), interpolation);
+
+        if (1000.0 <= dist)
+            break;
+
+        if (dist < EPSILON) {
+            vec3 grad = bEmpty ? gradient(entries2, entryCount2, p.xyz) :
+                        bEmpty2 ? gradient(entries, entryCount, p.xyz) :
+                        mix(gradient(entries, entryCount, p.xyz), gradient(entries2, entryCount2, p.xyz), interpolation);
+            vec3 normal = normalize(grad);
+            vec3 phong = vec3(1.0, 0.0, 0.0) * max(dot(normal, -rd.xyz), 0.15);
+            fragColor = vec4(phong, 1.0);
+            vec4 clip = MVP * vec4(p.xyz, 1.0);
+            gl_FragDepth = clip.z / clip.w * 0.5 + 0.5;
+            return;
+        }
+
+        p += rd * dist;
+    }
+
+    fragColor = vec4(abs(rd.xyz) * 0.6, 1.0);
+}
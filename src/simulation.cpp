@@ -0,0 +1,59 @@
+#include "simulation.h"
+
+namespace sim {
+
+Simulation::Simulation(StepFunction step, float fixedTimestep, SnapshotChannel& output)
+    : stepFunction{std::move(step)}, timestep{fixedTimestep}, output{output},
+    thread{[this](std::stop_token stopToken){ run(stopToken); }}
+{}
+
+void Simulation::run(std::stop_token stopToken) {
+    using clock = std::chrono::steady_clock;
+    using seconds = std::chrono::duration<double>;
+
+    auto last = clock::now();
+    double accumulator{0.0};
+
+    while (!stopToken.stop_requested()) {
+        const auto now = clock::now();
+        const double simulationSpeed = speed.load(std::memory_order_relaxed);
+
+        if (isPaused() || simulationSpeed <= 0.0) {
+            accumulator = 0.0;
+            last = now;
+            std::this_thread::sleep_for(std::chrono::milliseconds{1});
+            continue;
+        }
+
+        accumulator += seconds{now - last}.count() * simulationSpeed;
+        last = now;
+
+        if (accumulator < timestep) {
+            std::this_thread::sleep_for(seconds{(timestep - accumulator) / simulationSpeed});
+            continue;
+        }
+
+        // Drop the time we can't catch up on instead of spiraling
+        accumulator = std::min(accumulator, static_cast<double>(timestep) * MAX_STEPS_PER_UPDATE);
+
+        {
+            auto guard = lock();
+            auto& snapshot = output.writeBuffer();
+            for (; timestep <= accumulator; accumulator -= timestep) {
+                stepFunction(timestep, snapshot);
+                ++stepCount;
+            }
+            snapshot.step = stepCount;
+            snapshot.timestamp = clock::now();
+        }
+        output.publish();
+    }
+}
+
+Simulation::~Simulation() {
+    thread.request_stop();
+    if (thread.joinable())
+        thread.join();
+}
+
+}
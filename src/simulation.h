@@ -0,0 +1,94 @@
+#ifndef SIMULATION_H
+#define SIMULATION_H
+
+#include <glm/glm.hpp>
+#include <glm/gtx/quaternion.hpp>
+
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <cstdint>
+
+#include "snapshotchannel.h"
+
+namespace sim {
+
+// "Fakes" gravity by rotating position and velocity around the axis perpendicular to both.
+// Reference for the compute shader version in animate.comp.glsl.
+inline void orbitStep(glm::vec3& pos, glm::vec3& velocity, float deltaTime) {
+    const auto axis = glm::cross(velocity, pos);
+    // No rotation axis for spheres at rest (e.g. loaded without velocities) or moving straight towards the center
+    if (glm::dot(axis, axis) < 1e-12f)
+        return;
+    const auto rotDir = glm::normalize(axis);
+    const auto rotAmount = glm::length(velocity) * deltaTime;
+    const auto rotation = glm::angleAxis(rotAmount, rotDir);
+
+    pos = rotation * pos;
+    velocity = rotation * velocity;
+}
+
+struct Snapshot {
+    // Sphere positions and radii, in scene buffer order
+    std::vector<glm::vec4> positions;
+    // Wall clock time at which the simulation reached this state
+    std::chrono::steady_clock::time_point timestamp;
+    std::uint64_t step{0};
+};
+
+// The consumer keeps the previous snapshot along with the newest one, to interpolate between them
+using SnapshotChannel = ::SnapshotChannel<Snapshot, 2>;
+
+/**
+ * @brief Runs a step function on its own thread at a fixed timestep.
+ * After each batch of steps, the state written by the step function is published as an immutable snapshot
+ * to a channel owned by the consumer, so the render thread can pick up the newest state without waiting.
+ */
+class Simulation {
+public:
+    // Advances the simulation by the given timestep and writes the resulting state to the snapshot.
+    using StepFunction = std::function<void(float, Snapshot&)>;
+
+    // Upper limit on steps per update, so a slow step function can't fall further and further behind.
+    static constexpr unsigned int MAX_STEPS_PER_UPDATE = 4;
+
+private:
+    StepFunction stepFunction;
+    const float timestep;
+    std::atomic<float> speed{1.f};
+    std::atomic<bool> paused{true};
+
+    std::mutex stateMutex;
+    SnapshotChannel& output;
+    std::uint64_t stepCount{0};
+
+    std::jthread thread;
+
+    void run(std::stop_token stopToken);
+
+public:
+    // The channel has to outlive the simulation
+    Simulation(StepFunction step, float fixedTimestep, SnapshotChannel& output);
+    Simulation(const Simulation&) = delete;
+    Simulation& operator=(const Simulation&) = delete;
+
+    void setPaused(bool value) { paused.store(value, std::memory_order_relaxed); }
+    bool isPaused() const { return paused.load(std::memory_order_relaxed); }
+    void setSpeed(float value) { speed.store(value, std::memory_order_relaxed); }
+    float getTimestep() const { return timestep; }
+    // Steps taken so far. Only stable while the lock is held.
+    std::uint64_t getStepCount() const { return stepCount; }
+
+    // Keeps the simulation thread from stepping while the lock is held.
+    // Required before touching any state the step function uses from another thread.
+    [[nodiscard]] std::unique_lock<std::mutex> lock() { return std::unique_lock{stateMutex}; }
+
+    ~Simulation();
+};
+
+}
+
+#endif // SIMULATION_H
@@ -0,0 +1,87 @@
+#ifndef SNAPSHOTCHANNEL_H
+#define SNAPSHOTCHANNEL_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * @brief Wait-free single-producer/single-consumer channel handing whole buffers from one thread to another.
+ * Of the History + 2 buffers, the producer always has one to write into, the newest published one waits in the middle,
+ * and the consumer holds on to the History newest ones it took, so it can e.g. interpolate between the last two.
+ * publish() and update() trade buffer indices with the middle through a single atomic exchange, so nothing is copied
+ * and neither side ever blocks. If the producer publishes faster than the consumer takes, only the newest buffer is
+ * kept. Every publish is numbered, which tells the consumer how many it missed.
+ */
+template <typename T, std::size_t History = 1>
+class SnapshotChannel {
+private:
+    static constexpr std::size_t SIZE = History + 2;
+    static_assert(1 <= History && SIZE <= 8, "buffer indices have three bits");
+    static constexpr std::uint8_t INDEX_MASK = 0b0111;
+    // Set on the middle index when it holds a buffer the consumer hasn't taken yet
+    static constexpr std::uint8_t DIRTY_BIT = 0b1000;
+
+    struct Slot {
+        T value;
+        std::uint64_t sequence{0};
+    };
+
+    std::array<Slot, SIZE> slots;
+    std::atomic<std::uint8_t> middle{1};
+    // Producer side
+    std::uint8_t back{0};
+    std::uint64_t publishCount{0};
+    // Consumer side, newest first
+    std::array<std::uint8_t, History> held;
+    std::uint64_t dropCount{0};
+
+public:
+    SnapshotChannel() {
+        for (std::size_t i{0}; i < History; ++i)
+            held[i] = static_cast<std::uint8_t>(2 + i);
+    }
+    explicit SnapshotChannel(const T& initial) : SnapshotChannel{} {
+        for (auto& slot : slots)
+            slot.value = initial;
+    }
+
+    // Producer side. The buffer holds what was published a few publishes ago, or the initial value.
+    T& writeBuffer() { return slots[back].value; }
+
+    // Hands the write buffer over and takes the middle one back in its place. Returns the sequence number of the buffer.
+    std::uint64_t publish() {
+        slots[back].sequence = ++publishCount;
+        back = middle.exchange(back | DIRTY_BIT, std::memory_order_acq_rel) & INDEX_MASK;
+        return publishCount;
+    }
+
+    // Consumer side:
+    bool pending() const {
+        return middle.load(std::memory_order_acquire) & DIRTY_BIT;
+    }
+
+    // Takes the newest published buffer if there is one, giving back the oldest one held. Returns true if it took one.
+    bool update() {
+        if (!pending())
+            return false;
+
+        const auto lastSequence = slots[held[0]].sequence;
+        const auto newest = static_cast<std::uint8_t>(middle.exchange(held[History - 1], std::memory_order_acq_rel) & INDEX_MASK);
+        for (auto i{History - 1}; 0 < i; --i)
+            held[i] = held[i - 1];
+        held[0] = newest;
+        dropCount += slots[newest].sequence - lastSequence - 1;
+        return true;
+    }
+
+    // The age-th newest buffer taken, 0 being the newest. Valid until it ages out of the History held.
+    const T& readBuffer(std::size_t age = 0) const { return slots[held[age]].value; }
+    // Number of the publish that buffer came from, 0 for the initial value
+    std::uint64_t sequence(std::size_t age = 0) const { return slots[held[age]].sequence; }
+    // Buffers published but never taken, because a newer one replaced them first
+    std::uint64_t droppedCount() const { return dropCount; }
+};
+
+#endif // SNAPSHOTCHANNEL_H
@@ -0,0 +1,110 @@
+#include "spatialsort.h"
+#include "morton.h"
+#include "jobs.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <array>
+#include <limits>
+#include <numeric>
+
+namespace util {
+
+namespace {
+
+constexpr unsigned int RADIX_BITS = 8;
+constexpr std::size_t RADIX = 1 << RADIX_BITS;
+// Keys per chunk, each of which is counted and scattered by one thread
+constexpr std::size_t RADIX_CHUNK = 1 << 14;
+// Cells per axis of the Morton curve, as many as fit in 63 bit codes
+constexpr float MORTON_CELLS = static_cast<float>(1u << 21);
+
+}
+
+void radixSort(std::vector<std::uint64_t>& keys, std::vector<glm::uint>& values, unsigned int keyBits) {
+    const auto n = keys.size();
+    const std::size_t chunkCount = std::clamp<std::size_t>(n / RADIX_CHUNK, 1, jobs::Scheduler::global().threadCount() * 4);
+    const auto chunkBegin = [&](std::size_t c){ return c * n / chunkCount; };
+    std::vector<std::uint64_t> keyScratch(n);
+    std::vector<glm::uint> valueScratch(n);
+    std::vector<std::array<std::size_t, RADIX>> offsets(chunkCount);
+
+    for (unsigned int shift{0}; shift < keyBits; shift += RADIX_BITS) {
+        // At most one chunk per parallelFor chunk, so every chunk is counted by a single thread
+        parallelFor(chunkCount, [&](std::size_t begin, std::size_t end){
+            for (auto c{begin}; c < end; ++c) {
+                auto& counts = offsets[c];
+                counts.fill(0);
+                for (auto i{chunkBegin(c)}; i < chunkBegin(c + 1); ++i)
+                    ++counts[keys[i] >> shift & (RADIX - 1)];
+            }
+        }, 1);
+
+        // Offsets digit by digit, then chunk by chunk, which keeps equal digits in order.
+        // A digit all the keys share leaves nothing to do for this pass.
+        std::size_t offset{0};
+        bool bSkip{false};
+        for (std::size_t digit{0}; digit < RADIX; ++digit) {
+            const auto digitBegin = offset;
+            for (auto& counts : offsets) {
+                const auto count = counts[digit];
+                counts[digit] = offset;
+                offset += count;
+            }
+            bSkip |= offset - digitBegin == n;
+        }
+        if (bSkip)
+            continue;
+
+        parallelFor(chunkCount, [&](std::size_t begin, std::size_t end){
+            for (auto c{begin}; c < end; ++c) {
+                auto& next = offsets[c];
+                for (auto i{chunkBegin(c)}; i < chunkBegin(c + 1); ++i) {
+                    const auto target = next[keys[i] >> shift & (RADIX - 1)]++;
+                    keyScratch[target] = keys[i];
+                    valueScratch[target] = values[i];
+                }
+            }
+        }, 1);
+        keys.swap(keyScratch);
+        values.swap(valueScratch);
+    }
+}
+
+std::vector<glm::uint> mortonOrder(std::span<const glm::vec4> spheres, std::span<const glm::uvec2> ranges) {
+    std::vector<glm::uint> order(spheres.size());
+    std::iota(order.begin(), order.end(), 0u);
+
+    std::vector<std::uint64_t> keys;
+    std::vector<glm::uint> values;
+    for (const auto& range : ranges) {
+        const auto rangeSpheres = spheres.subspan(range.x, range.y);
+        if (rangeSpheres.size() < 2)
+            continue;
+
+        constexpr auto inf = std::numeric_limits<float>::max();
+        using Bounds = std::pair<glm::vec3, glm::vec3>;
+        const auto [lo, hi] = jobs::transformReduce(rangeSpheres.size(), Bounds{glm::vec3{inf}, glm::vec3{-inf}},
+            [](const Bounds& a, const Bounds& b){ return Bounds{glm::min(a.first, b.first), glm::max(a.second, b.second)}; },
+            [&](std::size_t i){ return Bounds{glm::vec3{rangeSpheres[i]}, glm::vec3{rangeSpheres[i]}}; }
+        );
+        // A cube, so the curve is equally fine along every axis
+        const auto extent = hi - lo;
+        const float scale = MORTON_CELLS / std::max(std::max(extent.x, extent.y), std::max(extent.z, 1e-30f));
+
+        keys.resize(rangeSpheres.size());
+        values.resize(rangeSpheres.size());
+        parallelFor(rangeSpheres.size(), [&](std::size_t begin, std::size_t end){
+            for (auto i{begin}; i < end; ++i) {
+                const auto cell = glm::clamp((glm::vec3{rangeSpheres[i]} - lo) * scale, glm::vec3{0.f}, glm::vec3{MORTON_CELLS - 1.f});
+                keys[i] = mortonCode(glm::uvec3{cell});
+                values[i] = range.x + static_cast<glm::uint>(i);
+            }
+        });
+        radixSort(keys, values, 63);
+        std::copy(values.begin(), values.end(), order.begin() + range.x);
+    }
+    return order;
+}
+
+}
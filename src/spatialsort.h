@@ -0,0 +1,21 @@
+#ifndef SPATIALSORT_H
+#define SPATIALSORT_H
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <span>
+#include <vector>
+
+namespace util {
+
+// Stable parallel LSD radix sort of the values by their keys, 8 bits per pass. Only the lowest keyBits bits of the keys are sorted by.
+void radixSort(std::vector<std::uint64_t>& keys, std::vector<glm::uint>& values, unsigned int keyBits = 64);
+
+// Order of the spheres along a Morton curve through the bounding cube of their centers, as the index of the sphere that goes
+// to every place. Every range (first, count) is ordered on its own, spheres outside of all ranges stay in place.
+std::vector<glm::uint> mortonOrder(std::span<const glm::vec4> spheres, std::span<const glm::uvec2> ranges);
+
+}
+
+#endif // SPATIALSORT_H
@@ -0,0 +1,207 @@
+#include "sph.h"
+#include "utils.h"
+#include "jobs.h"
+
+#include <algorithm>
+#include <numeric>
+#include <numbers>
+#include <cmath>
+
+namespace sim {
+
+// Smoothing kernels with support radius h (Müller et al. 2003). Normalization constants are computed once per step.
+struct Kernels {
+    float h, h2, poly6, spiky, viscosity;
+
+    explicit Kernels(float radius)
+        : h{radius}, h2{radius * radius},
+        poly6{315.f / (64.f * std::numbers::pi_v<float> * std::pow(radius, 9.f))},
+        spiky{-45.f / (std::numbers::pi_v<float> * std::pow(radius, 6.f))},
+        viscosity{45.f / (std::numbers::pi_v<float> * std::pow(radius, 6.f))}
+    {}
+
+    // Density kernel, from squared distance
+    float density(float r2) const {
+        if (h2 <= r2)
+            return 0.f;
+        const float d = h2 - r2;
+        return poly6 * d * d * d;
+    }
+
+    // Gradient of the spiky kernel for offset d = xi - xj at distance r
+    glm::vec3 pressureGradient(glm::vec3 d, float r) const {
+        if (h <= r || r < 1e-6f)
+            return glm::vec3{0.f};
+        const float x = h - r;
+        return d * (spiky * x * x / r);
+    }
+
+    float viscosityLaplacian(float r) const {
+        return h <= r ? 0.f : viscosity * (h - r);
+    }
+};
+
+bool Fluid::needsRebuild(std::span<const glm::vec4> spheres, const FluidParams& params) const {
+    if (buildPositions.size() != spheres.size() || listRadius != params.smoothingRadius * (1.f + params.skin))
+        return true;
+
+    // Lists stay valid until two particles could have closed the skin between them
+    const float limit = 0.5f * params.skin * params.smoothingRadius;
+    const float maxDistSq = jobs::transformReduce(spheres.size(), 0.f,
+        [](float a, float b){ return std::max(a, b); },
+        [&](std::size_t i){ const auto d = glm::vec3{spheres[i]} - buildPositions[i]; return glm::dot(d, d); }
+    );
+    return limit * limit < maxDistSq;
+}
+
+void Fluid::buildNeighbourLists(std::span<const glm::vec4> spheres, const FluidParams& params) {
+    const auto n = spheres.size();
+    listRadius = params.smoothingRadius * (1.f + params.skin);
+    const float radiusSq = listRadius * listRadius;
+
+    // The grid's cell size is the largest diameter, so use half the list radius as "radius"
+    gridPoints.resize(n);
+    buildPositions.resize(n);
+    util::parallelFor(n, [&](std::size_t begin, std::size_t end){
+        for (auto i{begin}; i < end; ++i) {
+            buildPositions[i] = glm::vec3{spheres[i]};
+            gridPoints[i] = glm::vec4{buildPositions[i], 0.5f * listRadius};
+        }
+    });
+    grid.build(gridPoints);
+
+    const auto& order = grid.getOrder();
+    const auto& sorted = grid.getSpheres();
+    const auto forEachNeighbour = [&](std::size_t i, auto&& f){
+        const auto pos = buildPositions[i];
+        grid.forEachNeighbour(pos, [&](std::uint32_t k){
+            const auto j = order[k];
+            const auto d = glm::vec3{sorted[k]} - pos;
+            if (j != i && glm::dot(d, d) < radiusSq)
+                f(j);
+        });
+    };
+
+    // Count, prefix sum, then fill, so each particle's list is written by one thread only
+    neighbourStart.assign(n + 1, 0u);
+    util::parallelFor(n, [&](std::size_t begin, std::size_t end){
+        for (auto i{begin}; i < end; ++i) {
+            std::uint32_t count{0};
+            forEachNeighbour(i, [&](std::uint32_t){ ++count; });
+            neighbourStart[i + 1] = count;
+        }
+    }, 256);
+    std::inclusive_scan(neighbourStart.begin(), neighbourStart.end(), neighbourStart.begin());
+
+    neighbours.resize(neighbourStart.back());
+    util::parallelFor(n, [&](std::size_t begin, std::size_t end){
+        for (auto i{begin}; i < end; ++i) {
+            auto next = neighbourStart[i];
+            forEachNeighbour(i, [&](std::uint32_t j){ neighbours[next++] = j; });
+        }
+    }, 256);
+
+    ++rebuildCount;
+}
+
+void Fluid::step(std::span<glm::vec4> spheres, std::span<glm::vec4> velocities, float deltaTime, const FluidParams& params) {
+    const auto n = spheres.size();
+    if (n == 0)
+        return;
+
+    const Kernels kernels{params.smoothingRadius};
+    const float h = params.smoothingRadius;
+    const float mass = params.particleMass;
+    const float selfDensity = mass * kernels.density(0.f);
+    // Walls push back over the outer half kernel radius, as stiff as the fluid itself
+    const float wallMargin = 0.5f * h;
+    const float wallStiffness = params.stiffness / (h * h);
+    const float wallDamping = 2.f * std::sqrt(wallStiffness);
+
+    densities.resize(n);
+    pressures.resize(n);
+    accelerations.resize(n);
+
+    const float maxSpeedSq = jobs::transformReduce(velocities.size(), 0.f,
+        [](float a, float b){ return std::max(a, b); },
+        [&](std::size_t i){ return glm::dot(glm::vec3{velocities[i]}, glm::vec3{velocities[i]}); }
+    );
+    const float maxStep = params.courant * h / (std::sqrt(params.stiffness) + std::sqrt(maxSpeedSq));
+    const auto substeps = static_cast<unsigned int>(std::clamp(std::ceil(deltaTime / maxStep), 1.f, 16.f));
+    const float dt = deltaTime / static_cast<float>(substeps);
+
+    for (unsigned int substep{0}; substep < substeps; ++substep) {
+        if (needsRebuild(spheres, params))
+            buildNeighbourLists(spheres, params);
+
+        // Density and pressure:
+        util::parallelFor(n, [&](std::size_t begin, std::size_t end){
+            for (auto i{begin}; i < end; ++i) {
+                const glm::vec3 pos{spheres[i]};
+                float density{selfDensity};
+                for (auto k{neighbourStart[i]}; k < neighbourStart[i + 1]; ++k) {
+                    const auto d = pos - glm::vec3{spheres[neighbours[k]]};
+                    density += mass * kernels.density(glm::dot(d, d));
+                }
+                densities[i] = density;
+                // No negative pressure, so particles at the surface don't clump together
+                pressures[i] = std::max(params.stiffness * (density - params.restDensity), 0.f);
+            }
+        }, 256);
+
+        // Pressure and viscosity forces:
+        util::parallelFor(n, [&](std::size_t begin, std::size_t end){
+            for (auto i{begin}; i < end; ++i) {
+                const glm::vec3 pos{spheres[i]}, velocity{velocities[i]};
+                glm::vec3 pressureForce{0.f}, viscosityForce{0.f};
+                for (auto k{neighbourStart[i]}; k < neighbourStart[i + 1]; ++k) {
+                    const auto j = neighbours[k];
+                    const auto d = pos - glm::vec3{spheres[j]};
+                    const float r = glm::length(d);
+                    if (h <= r)
+                        continue;
+
+                    pressureForce -= kernels.pressureGradient(d, r) * (mass * (pressures[i] + pressures[j]) / (2.f * densities[j]));
+                    viscosityForce += (glm::vec3{velocities[j]} - velocity) * (mass * kernels.viscosityLaplacian(r) / densities[j]);
+                }
+                accelerations[i] = (pressureForce + params.viscosity * viscosityForce) / densities[i] + params.gravity;
+            }
+        }, 256);
+
+        // Semi-implicit Euler. Particles near the box are pushed back by a damped spring. Clamping them to the walls alone
+        // flattens the bottom layer into a plane that never comes to rest.
+        util::parallelFor(n, [&](std::size_t begin, std::size_t end){
+            for (auto i{begin}; i < end; ++i) {
+                glm::vec3 velocity{velocities[i]}, pos{spheres[i]};
+                auto acceleration = accelerations[i];
+                for (int axis{0}; axis < 3; ++axis) {
+                    const float low = pos[axis] + params.boundary, high = params.boundary - pos[axis];
+                    if (low < wallMargin)
+                        acceleration[axis] += wallStiffness * (wallMargin - low) - wallDamping * std::min(velocity[axis], 0.f);
+                    if (high < wallMargin)
+                        acceleration[axis] -= wallStiffness * (wallMargin - high) + wallDamping * std::max(velocity[axis], 0.f);
+                }
+
+                velocity += acceleration * dt;
+                pos += velocity * dt;
+
+                // Hard limit for particles that overshoot the wall force
+                for (int axis{0}; axis < 3; ++axis) {
+                    if (pos[axis] < -params.boundary) {
+                        pos[axis] = -params.boundary;
+                        velocity[axis] = std::abs(velocity[axis]) * params.boundaryRestitution;
+                    } else if (params.boundary < pos[axis]) {
+                        pos[axis] = params.boundary;
+                        velocity[axis] = -std::abs(velocity[axis]) * params.boundaryRestitution;
+                    }
+                }
+
+                spheres[i] = glm::vec4{pos, spheres[i].w};
+                velocities[i] = glm::vec4{velocity, velocities[i].w};
+            }
+        });
+        ++stepCount;
+    }
+}
+
+}
@@ -0,0 +1,72 @@
+#ifndef SPH_H
+#define SPH_H
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <span>
+#include <cstdint>
+
+#include "collision.h"
+
+namespace sim {
+
+struct FluidParams {
+    // Kernel support radius
+    float smoothingRadius = 0.1f;
+    float restDensity = 1000.f;
+    // Pressure = stiffness * (density - restDensity)
+    float stiffness = 100.f;
+    float viscosity = 3.f;
+    // Mass of every particle. The default fills the kernel support with about 30 particles at rest density.
+    float particleMass = 0.14f;
+    glm::vec3 gravity{0.f, -9.81f, 0.f};
+    // Particles are kept inside a box of this half size around the origin
+    float boundary = 0.5f;
+    // Fraction of the normal velocity kept by particles that get past the wall force
+    float boundaryRestitution = 0.3f;
+    // Extra search radius of the neighbour lists, as a fraction of smoothingRadius. Larger means fewer rebuilds but longer lists.
+    float skin = 0.25f;
+    // Steps are split into substeps of at most courant * smoothingRadius / (speed of sound + max particle speed)
+    float courant = 0.4f;
+};
+
+/**
+ * @brief Smoothed particle hydrodynamics (Müller et al. 2003) with poly6 density, spiky pressure and viscosity kernels.
+ * Neighbour lists (Verlet lists) are built from a SpatialGrid with a radius of smoothingRadius * (1 + skin)
+ * and only rebuilt once some particle has moved more than half the skin since the last build,
+ * so most steps skip the grid entirely.
+ */
+class Fluid {
+private:
+    // Compressed neighbour lists: neighbours of particle i are neighbours[neighbourStart[i]] to neighbours[neighbourStart[i + 1]]
+    std::vector<std::uint32_t> neighbourStart, neighbours;
+    std::vector<glm::vec3> buildPositions;
+    std::vector<glm::vec4> gridPoints;
+    SpatialGrid grid;
+    float listRadius{0.f};
+
+    std::vector<float> densities, pressures;
+    std::vector<glm::vec3> accelerations;
+
+    std::uint64_t rebuildCount{0}, stepCount{0};
+
+    bool needsRebuild(std::span<const glm::vec4> spheres, const FluidParams& params) const;
+    void buildNeighbourLists(std::span<const glm::vec4> spheres, const FluidParams& params);
+
+public:
+    // Advances the particles (xyz of spheres and velocities) by deltaTime. Radii and velocity.w are left alone.
+    void step(std::span<glm::vec4> spheres, std::span<glm::vec4> velocities, float deltaTime, const FluidParams& params);
+
+    // Forces a rebuild of the neighbour lists on the next step, e.g. after particles were moved externally.
+    void invalidate() { buildPositions.clear(); }
+
+    std::uint64_t getRebuildCount() const { return rebuildCount; }
+    std::uint64_t getStepCount() const { return stepCount; }
+    std::size_t getNeighbourCount() const { return neighbours.size(); }
+    const std::vector<float>& getDensities() const { return densities; }
+};
+
+}
+
+#endif // SPH_H
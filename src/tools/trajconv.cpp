@@ -0,0 +1,143 @@
+// Converts trajectories between the raw (.traj) and compressed (.ctraj) formats.
+// Compressed output is decoded again afterwards to report the decode speed and the largest quantization error.
+
+#include "trajectory.h"
+#include "trajcodec.h"
+
+#include <iostream>
+#include <format>
+#include <string_view>
+#include <functional>
+#include <charconv>
+#include <chrono>
+#include <algorithm>
+
+namespace {
+
+struct Source {
+    std::size_t frameCount{0}, sphereCount{0};
+    float framesPerSecond{30.f};
+    std::function<bool(std::size_t, std::span<glm::vec4>)> readFrame;
+};
+
+std::optional<Source> openSource(const std::filesystem::path& path, std::optional<io::TrajectoryFile>& raw, std::optional<io::CompressedTrajectory>& compressed) {
+    if (path.extension() == ".ctraj") {
+        compressed = io::CompressedTrajectory::open(path);
+        if (!compressed)
+            return std::nullopt;
+        return Source{compressed->frameCount(), compressed->sphereCount(), compressed->framesPerSecond(),
+            [&compressed](std::size_t frame, std::span<glm::vec4> out){ return compressed->readFrame(frame, out); }};
+    }
+
+    raw = io::TrajectoryFile::open(path);
+    if (!raw)
+        return std::nullopt;
+    return Source{raw->frameCount(), raw->sphereCount(), raw->framesPerSecond(),
+        [&raw](std::size_t frame, std::span<glm::vec4> out){ return raw->readFrame(frame, out); }};
+}
+
+template <typename T>
+bool parseArgument(std::string_view text, T& value) {
+    const auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), value);
+    return error == std::errc{} && end == text.data() + text.size();
+}
+
+int usage() {
+    std::cout << "usage: trajconv <input.traj|input.ctraj> <output.traj|output.ctraj> [--precision 1e-4] [--keyframes 30] [--chunk 4096]" << std::endl;
+    return 1;
+}
+
+double secondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>{std::chrono::steady_clock::now() - start}.count();
+}
+
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 3)
+        return usage();
+
+    const std::filesystem::path inputPath{argv[1]}, outputPath{argv[2]};
+    io::CodecParams params;
+    for (int i = 3; i < argc; i += 2) {
+        const std::string_view option{argv[i]};
+        if (argc <= i + 1)
+            return usage();
+        const std::string_view value{argv[i + 1]};
+        bool bParsed = false;
+        if (option == "--precision")
+            bParsed = parseArgument(value, params.precision);
+        else if (option == "--keyframes")
+            bParsed = parseArgument(value, params.keyframeInterval);
+        else if (option == "--chunk")
+            bParsed = parseArgument(value, params.chunkSize);
+        if (!bParsed)
+            return usage();
+    }
+
+    std::optional<io::TrajectoryFile> raw;
+    std::optional<io::CompressedTrajectory> compressed;
+    const auto source = openSource(inputPath, raw, compressed);
+    if (!source)
+        return 1;
+
+    const bool bCompress = outputPath.extension() == ".ctraj";
+    std::optional<io::TrajectoryWriter> writer;
+    std::optional<io::TrajectoryEncoder> encoder;
+    if (bCompress)
+        encoder = io::TrajectoryEncoder::create(outputPath, source->sphereCount, source->framesPerSecond, params);
+    else
+        writer = io::TrajectoryWriter::create(outputPath, source->sphereCount, source->framesPerSecond);
+    if (!encoder && !writer)
+        return 1;
+
+    std::vector<glm::vec4> frame(source->sphereCount);
+    const auto start = std::chrono::steady_clock::now();
+    for (std::size_t f{0}; f < source->frameCount; ++f) {
+        if (!source->readFrame(f, frame) || !(bCompress ? encoder->append(frame) : writer->append(frame))) {
+            std::cout << std::format("Converting frame {} failed.", f) << std::endl;
+            return 1;
+        }
+    }
+    if (!(bCompress ? encoder->close() : writer->close())) {
+        std::cout << "Writing the output failed." << std::endl;
+        return 1;
+    }
+    const double convertTime = secondsSince(start);
+
+    const auto inputSize = std::filesystem::file_size(inputPath);
+    const auto outputSize = std::filesystem::file_size(outputPath);
+    std::cout << std::format("{} frames of {} spheres in {:.2f}s ({:.1f} frames/s)", source->frameCount, source->sphereCount,
+        convertTime, static_cast<double>(source->frameCount) / convertTime) << std::endl;
+    std::cout << std::format("{:.1f} MB -> {:.1f} MB ({:.2f}x)", static_cast<double>(inputSize) * 1e-6, static_cast<double>(outputSize) * 1e-6,
+        static_cast<double>(inputSize) / static_cast<double>(outputSize)) << std::endl;
+
+    if (!bCompress)
+        return 0;
+
+    // Decode everything again, measuring speed and comparing against the input
+    auto decoded = io::CompressedTrajectory::open(outputPath);
+    if (!decoded)
+        return 1;
+    std::vector<glm::vec4> original(source->sphereCount);
+    float maxError{0.f};
+    double decodeTime{0.0};
+    for (std::size_t f{0}; f < source->frameCount; ++f) {
+        const auto decodeStart = std::chrono::steady_clock::now();
+        if (!decoded->readFrame(f, frame)) {
+            std::cout << std::format("Decoding frame {} failed.", f) << std::endl;
+            return 1;
+        }
+        decodeTime += secondsSince(decodeStart);
+
+        source->readFrame(f, original);
+        for (std::size_t i{0}; i < frame.size(); ++i) {
+            const auto error = glm::abs(frame[i] - original[i]);
+            maxError = std::max({maxError, error.x, error.y, error.z, error.w});
+        }
+    }
+    std::cout << std::format("Decoding: {:.1f} frames/s, largest error {:g} (precision {:g})",
+        static_cast<double>(source->frameCount) / decodeTime, maxError, params.precision) << std::endl;
+
+    return 0;
+}
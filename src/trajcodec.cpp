@@ -0,0 +1,297 @@
+#include "trajcodec.h"
+#include "utils.h"
+
+#include <iostream>
+#include <format>
+#include <cstring>
+#include <cmath>
+#include <bit>
+#include <atomic>
+#include <algorithm>
+
+namespace io {
+
+namespace {
+
+// Quantized values are kept well inside int32, so residuals can't overflow
+constexpr float QUANTIZE_LIMIT = static_cast<float>(1 << 29);
+// Readers load 8 bytes at a time, so frames are padded to never read past the end
+constexpr std::size_t FRAME_PADDING = 8;
+
+std::uint32_t zigzag(std::int32_t value) {
+    return (static_cast<std::uint32_t>(value) << 1) ^ static_cast<std::uint32_t>(value >> 31);
+}
+
+std::int32_t unzigzag(std::uint32_t value) {
+    return static_cast<std::int32_t>(value >> 1) ^ -static_cast<std::int32_t>(value & 1);
+}
+
+class BitWriter {
+private:
+    std::vector<std::uint8_t>& bytes;
+    std::uint64_t buffer{0};
+    unsigned int count{0};
+
+public:
+    explicit BitWriter(std::vector<std::uint8_t>& out) : bytes{out} {}
+
+    void put(std::uint32_t value, unsigned int bits) {
+        buffer |= std::uint64_t{value} << count;
+        count += bits;
+        for (; 8 <= count; count -= 8) {
+            bytes.push_back(static_cast<std::uint8_t>(buffer));
+            buffer >>= 8;
+        }
+    }
+
+    void flush() {
+        if (count)
+            bytes.push_back(static_cast<std::uint8_t>(buffer));
+        buffer = count = 0;
+    }
+};
+
+class BitReader {
+private:
+    const std::byte* data;
+    std::uint64_t position{0};
+
+public:
+    explicit BitReader(const std::byte* bytes) : data{bytes} {}
+
+    std::uint32_t get(unsigned int bits) {
+        if (bits == 0)
+            return 0;
+        std::uint64_t word;
+        std::memcpy(&word, data + (position >> 3), sizeof(word));
+        position += bits;
+        return static_cast<std::uint32_t>((word >> ((position - bits) & 7)) & ((std::uint64_t{1} << bits) - 1));
+    }
+};
+
+}
+
+std::optional<CompressedTrajectory> CompressedTrajectory::open(const std::filesystem::path& path) {
+    auto mapped = MappedFile::open(path);
+    if (!mapped) {
+        std::cout << std::format("TRAJECTORY ERROR: Could not map \"{}\".", path.string()) << std::endl;
+        return std::nullopt;
+    }
+
+    const auto fail = [&](const char* reason){
+        std::cout << std::format("TRAJECTORY ERROR: \"{}\": {}", path.string(), reason) << std::endl;
+        return std::nullopt;
+    };
+
+    CompressedHeader header;
+    if (mapped->size() < sizeof(CompressedHeader))
+        return fail("file too small");
+    std::memcpy(&header, mapped->data(), sizeof(CompressedHeader));
+
+    if (header.magic != CompressedHeader::MAGIC)
+        return fail("not a compressed trajectory");
+    if (header.version != CompressedHeader::VERSION)
+        return fail("unsupported version");
+    if (header.sphereCount == 0 || header.frameCount == 0 || header.keyframeInterval == 0 || header.chunkSize == 0 || !(0.f < header.precision))
+        return fail("invalid parameters");
+    if (header.frameTableOffset % alignof(std::uint64_t) || mapped->size() < header.frameTableOffset
+        || (mapped->size() - header.frameTableOffset) / sizeof(std::uint64_t) < header.frameCount + 1)
+        return fail("truncated");
+
+    CompressedTrajectory trajectory{std::move(*mapped), header};
+
+    // Frames have to be in order and between the header and the frame table
+    const auto* offsets = reinterpret_cast<const std::uint64_t*>(trajectory.file.data() + header.frameTableOffset);
+    if (offsets[0] < sizeof(CompressedHeader) || header.frameTableOffset < offsets[header.frameCount])
+        return fail("frame table out of range");
+    for (std::uint64_t i{0}; i < header.frameCount; ++i)
+        if (offsets[i + 1] < offsets[i])
+            return fail("frame table out of order");
+
+    return trajectory;
+}
+
+std::span<const std::byte> CompressedTrajectory::frameData(std::size_t index) const {
+    const auto* offsets = reinterpret_cast<const std::uint64_t*>(file.data() + header.frameTableOffset);
+    return {file.data() + offsets[index], static_cast<std::size_t>(offsets[index + 1] - offsets[index])};
+}
+
+template <typename F>
+bool CompressedTrajectory::decode(std::size_t index, F&& store) const {
+    const auto data = frameData(index);
+    const std::size_t chunkCount = (header.sphereCount + header.chunkSize - 1) / header.chunkSize;
+    const std::size_t tableSize = (chunkCount + 1) * sizeof(std::uint32_t);
+    if (data.size() < tableSize + FRAME_PADDING)
+        return false;
+
+    const bool bKeyframe = index % header.keyframeInterval == 0;
+    std::atomic<bool> bValid{true};
+    util::parallelFor(chunkCount, [&](std::size_t begin, std::size_t end){
+        for (auto c{begin}; c < end; ++c) {
+            std::uint32_t chunkStart, chunkEnd;
+            std::memcpy(&chunkStart, data.data() + c * sizeof(std::uint32_t), sizeof(std::uint32_t));
+            std::memcpy(&chunkEnd, data.data() + (c + 1) * sizeof(std::uint32_t), sizeof(std::uint32_t));
+
+            const auto first = c * header.chunkSize;
+            const auto count = std::min<std::size_t>(header.chunkSize, header.sphereCount - first);
+
+            // Every bit the chunk claims to hold has to be inside the frame
+            std::array<std::uint8_t, 4> widths;
+            if (chunkEnd < chunkStart || data.size() - FRAME_PADDING < chunkEnd || chunkEnd - chunkStart < widths.size()) {
+                bValid = false;
+                return;
+            }
+            std::memcpy(widths.data(), data.data() + chunkStart, widths.size());
+            std::uint64_t bits{0};
+            for (const auto width : widths)
+                bits += width;
+            if (32 < std::max({widths[0], widths[1], widths[2], widths[3]}) || chunkEnd - chunkStart - widths.size() < (bits * count + 7) / 8) {
+                bValid = false;
+                return;
+            }
+
+            BitReader reader{data.data() + chunkStart + widths.size()};
+            glm::ivec4 value{0};
+            for (std::size_t i{0}; i < count; ++i) {
+                glm::ivec4 residual;
+                for (int k = 0; k < 4; ++k)
+                    residual[k] = unzigzag(reader.get(widths[k]));
+                // Keyframes store differences between neighbouring spheres
+                value = bKeyframe ? value + residual : residual;
+                store(first + i, value);
+            }
+        }
+    }, 1);
+    return bValid;
+}
+
+bool CompressedTrajectory::readFrame(std::size_t index, std::span<glm::vec4> out) {
+    if (frameCount() <= index || out.size() != sphereCount())
+        return false;
+
+    const std::size_t keyIndex = index - index % header.keyframeInterval;
+    if (cachedKeyframe != keyIndex) {
+        keyframe.resize(header.sphereCount);
+        cachedKeyframe.reset();
+        if (!decode(keyIndex, [this](std::size_t i, const glm::ivec4& value){ keyframe[i] = value; }))
+            return false;
+        cachedKeyframe = keyIndex;
+    }
+
+    const float precision = header.precision;
+    if (index == keyIndex) {
+        util::parallelFor(out.size(), [&](std::size_t begin, std::size_t end){
+            for (auto i{begin}; i < end; ++i)
+                out[i] = glm::vec4{keyframe[i]} * precision;
+        });
+        return true;
+    }
+    return decode(index, [&](std::size_t i, const glm::ivec4& delta){ out[i] = glm::vec4{keyframe[i] + delta} * precision; });
+}
+
+std::optional<TrajectoryEncoder> TrajectoryEncoder::create(const std::filesystem::path& path, std::size_t sphereCount, float framesPerSecond, const CodecParams& params) {
+    if (sphereCount == 0 || params.keyframeInterval == 0 || params.chunkSize == 0 || !(0.f < params.precision)) {
+        std::cout << "TRAJECTORY ERROR: Invalid codec parameters." << std::endl;
+        return std::nullopt;
+    }
+
+    TrajectoryEncoder encoder;
+    encoder.out.open(path, std::ios::binary | std::ios::trunc);
+    if (!encoder.out) {
+        std::cout << std::format("TRAJECTORY ERROR: Could not open \"{}\" for writing.", path.string()) << std::endl;
+        return std::nullopt;
+    }
+
+    encoder.header.sphereCount = static_cast<std::uint32_t>(sphereCount);
+    encoder.header.framesPerSecond = framesPerSecond;
+    encoder.header.precision = params.precision;
+    encoder.header.keyframeInterval = params.keyframeInterval;
+    encoder.header.chunkSize = params.chunkSize;
+    encoder.out.write(reinterpret_cast<const char*>(&encoder.header), sizeof(CompressedHeader));
+
+    encoder.quantized.resize(sphereCount);
+    encoder.chunks.resize((sphereCount + params.chunkSize - 1) / params.chunkSize);
+    return encoder;
+}
+
+bool TrajectoryEncoder::append(std::span<const glm::vec4> frame) {
+    if (!out.is_open() || frame.size() != header.sphereCount)
+        return false;
+
+    const float invPrecision = 1.f / header.precision;
+    util::parallelFor(frame.size(), [&](std::size_t begin, std::size_t end){
+        for (auto i{begin}; i < end; ++i)
+            quantized[i] = glm::ivec4{glm::clamp(glm::round(frame[i] * invPrecision), -QUANTIZE_LIMIT, QUANTIZE_LIMIT)};
+    });
+
+    const bool bKeyframe = frameOffsets.size() % header.keyframeInterval == 0;
+    if (bKeyframe)
+        keyframe = quantized;
+
+    util::parallelFor(chunks.size(), [&](std::size_t begin, std::size_t end){
+        std::vector<glm::ivec4> residuals;
+        for (auto c{begin}; c < end; ++c) {
+            const auto first = c * header.chunkSize;
+            const auto count = std::min<std::size_t>(header.chunkSize, header.sphereCount - first);
+
+            residuals.resize(count);
+            glm::uvec4 maxValue{0u};
+            for (std::size_t i{0}; i < count; ++i) {
+                residuals[i] = bKeyframe ? quantized[first + i] - (i ? quantized[first + i - 1] : glm::ivec4{0}) : quantized[first + i] - keyframe[first + i];
+                for (int k = 0; k < 4; ++k)
+                    maxValue[k] = std::max(maxValue[k], zigzag(residuals[i][k]));
+            }
+
+            auto& bytes = chunks[c];
+            bytes.clear();
+            std::array<std::uint8_t, 4> widths;
+            for (int k = 0; k < 4; ++k)
+                widths[k] = static_cast<std::uint8_t>(std::bit_width(maxValue[k]));
+            bytes.insert(bytes.end(), widths.begin(), widths.end());
+
+            BitWriter writer{bytes};
+            for (const auto& residual : residuals)
+                for (int k = 0; k < 4; ++k)
+                    writer.put(zigzag(residual[k]), widths[k]);
+            writer.flush();
+        }
+    }, 1);
+
+    // Chunk table, chunks and padding
+    std::vector<std::uint32_t> chunkOffsets{static_cast<std::uint32_t>((chunks.size() + 1) * sizeof(std::uint32_t))};
+    for (const auto& bytes : chunks)
+        chunkOffsets.push_back(chunkOffsets.back() + static_cast<std::uint32_t>(bytes.size()));
+
+    frameOffsets.push_back(static_cast<std::uint64_t>(out.tellp()));
+    out.write(reinterpret_cast<const char*>(chunkOffsets.data()), static_cast<std::streamsize>(chunkOffsets.size() * sizeof(std::uint32_t)));
+    for (const auto& bytes : chunks)
+        out.write(reinterpret_cast<const char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+    constexpr char zeros[FRAME_PADDING]{};
+    out.write(zeros, FRAME_PADDING);
+
+    return static_cast<bool>(out);
+}
+
+bool TrajectoryEncoder::close() {
+    if (!out.is_open())
+        return false;
+
+    // Frame table, 8 byte aligned
+    auto tableOffset = static_cast<std::uint64_t>(out.tellp());
+    constexpr char zeros[8]{};
+    out.write(zeros, static_cast<std::streamsize>((8 - tableOffset % 8) % 8));
+    tableOffset = static_cast<std::uint64_t>(out.tellp());
+
+    frameOffsets.push_back(tableOffset);
+    out.write(reinterpret_cast<const char*>(frameOffsets.data()), static_cast<std::streamsize>(frameOffsets.size() * sizeof(std::uint64_t)));
+    frameOffsets.pop_back();
+
+    header.frameCount = frameOffsets.size();
+    header.frameTableOffset = tableOffset;
+    out.seekp(0);
+    out.write(reinterpret_cast<const char*>(&header), sizeof(CompressedHeader));
+    out.close();
+    return !out.fail();
+}
+
+}
@@ -0,0 +1,113 @@
+#ifndef TRAJCODEC_H
+#define TRAJCODEC_H
+
+#include <glm/glm.hpp>
+
+#include <array>
+#include <span>
+#include <vector>
+#include <optional>
+#include <fstream>
+#include <filesystem>
+#include <cstdint>
+
+#include "scenefile.h"
+
+namespace io {
+
+struct CodecParams {
+    // Quantization step in scene units. Positions and radii are off by at most half of it.
+    float precision = 1e-4f;
+    // Every this many frames is a keyframe. The other frames store deltas against their keyframe,
+    // so any frame decodes from at most two frames.
+    std::uint32_t keyframeInterval = 30;
+    // Spheres per independently decoded chunk
+    std::uint32_t chunkSize = 4096;
+};
+
+// Compressed trajectory, version 1. Frames are stored one after the other, followed by the frame table
+// (frameCount + 1 byte offsets, the last one being the end of the last frame).
+// A frame starts with chunkCount + 1 offsets (relative to the frame) of its chunks, followed by the chunks and 8 bytes of padding.
+// A chunk holds the bit widths of its x, y, z and w residuals, then the zigzag encoded residuals bit-packed per sphere.
+// Residuals of keyframes are differences to the previous sphere of the chunk, those of other frames differences to the keyframe.
+struct CompressedHeader {
+    static constexpr std::array<char, 4> MAGIC{'B', 'T', 'R', 'C'};
+    static constexpr std::uint32_t VERSION = 1;
+
+    std::array<char, 4> magic{MAGIC};
+    std::uint32_t version{VERSION};
+    std::uint32_t sphereCount{0};
+    float framesPerSecond{30.f};
+    std::uint64_t frameCount{0};
+    std::uint64_t frameTableOffset{0};
+    float precision{1e-4f};
+    std::uint32_t keyframeInterval{30};
+    std::uint32_t chunkSize{4096};
+    std::uint32_t reserved{0};
+};
+
+static_assert(sizeof(CompressedHeader) == 48);
+
+/**
+ * @brief Mapped compressed trajectory. Frames are decoded by chunk in parallel.
+ * The last decoded keyframe is cached, so playing forwards decodes one frame per frame.
+ * Not thread safe: frames should be read from one thread (e.g. a FrameStreamer).
+ */
+class CompressedTrajectory {
+private:
+    MappedFile file;
+    CompressedHeader header;
+    std::vector<glm::ivec4> keyframe;
+    std::optional<std::size_t> cachedKeyframe;
+
+    CompressedTrajectory(MappedFile&& mapped, const CompressedHeader& fileHeader) : file{std::move(mapped)}, header{fileHeader} {}
+
+    std::span<const std::byte> frameData(std::size_t index) const;
+    // Decodes a frame in parallel chunks, passing every sphere's index and value to store.
+    // Values are quantized positions for keyframes and deltas to the keyframe otherwise.
+    template <typename F>
+    bool decode(std::size_t index, F&& store) const;
+
+public:
+    // Maps and validates a compressed trajectory. Prints the reason and returns nothing if it can't be used.
+    static std::optional<CompressedTrajectory> open(const std::filesystem::path& path);
+
+    std::size_t frameCount() const { return static_cast<std::size_t>(header.frameCount); }
+    std::size_t sphereCount() const { return header.sphereCount; }
+    float framesPerSecond() const { return header.framesPerSecond; }
+    const CompressedHeader& getHeader() const { return header; }
+
+    // Decodes a frame into out, which has to hold sphereCount() spheres. Fails on corrupt frames.
+    bool readFrame(std::size_t index, std::span<glm::vec4> out);
+};
+
+/**
+ * @brief Compresses frames into a compressed trajectory. The frame table and header are written on close().
+ */
+class TrajectoryEncoder {
+private:
+    std::ofstream out;
+    CompressedHeader header;
+    std::vector<std::uint64_t> frameOffsets;
+    std::vector<glm::ivec4> quantized, keyframe;
+    std::vector<std::vector<std::uint8_t>> chunks;
+
+public:
+    TrajectoryEncoder() = default;
+    TrajectoryEncoder(TrajectoryEncoder&&) = default;
+    TrajectoryEncoder& operator=(TrajectoryEncoder&&) = default;
+    ~TrajectoryEncoder() { close(); }
+
+    // Prints the reason and returns nothing if the file can't be created.
+    static std::optional<TrajectoryEncoder> create(const std::filesystem::path& path, std::size_t sphereCount, float framesPerSecond, const CodecParams& params = {});
+
+    // Frames have to hold exactly sphereCount spheres
+    bool append(std::span<const glm::vec4> frame);
+    bool close();
+
+    std::size_t frameCount() const { return frameOffsets.size(); }
+};
+
+}
+
+#endif // TRAJCODEC_H
@@ -0,0 +1,90 @@
+#include "trajectory.h"
+
+#include <iostream>
+#include <format>
+#include <cstring>
+#include <algorithm>
+
+namespace io {
+
+std::optional<TrajectoryFile> TrajectoryFile::open(const std::filesystem::path& path) {
+    auto mapped = MappedFile::open(path);
+    if (!mapped) {
+        std::cout << std::format("TRAJECTORY ERROR: Could not map \"{}\".", path.string()) << std::endl;
+        return std::nullopt;
+    }
+
+    const auto fail = [&](const char* reason){
+        std::cout << std::format("TRAJECTORY ERROR: \"{}\": {}", path.string(), reason) << std::endl;
+        return std::nullopt;
+    };
+
+    TrajectoryHeader header;
+    if (mapped->size() < sizeof(TrajectoryHeader))
+        return fail("file too small");
+    std::memcpy(&header, mapped->data(), sizeof(TrajectoryHeader));
+
+    if (header.magic != TrajectoryHeader::MAGIC)
+        return fail("not a trajectory");
+    if (header.version != TrajectoryHeader::VERSION)
+        return fail("unsupported version");
+    if (header.sphereCount == 0 || header.frameCount == 0)
+        return fail("empty");
+    if (header.frameOffset % 16)
+        return fail("misaligned frames");
+    const std::uint64_t frameBytes = header.sphereCount * sizeof(glm::vec4);
+    if (mapped->size() < header.frameOffset || (mapped->size() - header.frameOffset) / frameBytes < header.frameCount)
+        return fail("truncated");
+    if (!(0.f < header.framesPerSecond))
+        header.framesPerSecond = 30.f;
+
+    return TrajectoryFile{std::move(*mapped), header};
+}
+
+std::span<const glm::vec4> TrajectoryFile::frame(std::size_t index) const {
+    const auto offset = header.frameOffset + index * header.sphereCount * sizeof(glm::vec4);
+    return {reinterpret_cast<const glm::vec4*>(file.data() + offset), header.sphereCount};
+}
+
+bool TrajectoryFile::readFrame(std::size_t index, std::span<glm::vec4> out) const {
+    if (frameCount() <= index || out.size() != sphereCount())
+        return false;
+    const auto source = frame(index);
+    std::copy(source.begin(), source.end(), out.begin());
+    return true;
+}
+
+std::optional<TrajectoryWriter> TrajectoryWriter::create(const std::filesystem::path& path, std::size_t sphereCount, float framesPerSecond) {
+    TrajectoryWriter writer;
+    writer.out.open(path, std::ios::binary | std::ios::trunc);
+    if (!writer.out) {
+        std::cout << std::format("TRAJECTORY ERROR: Could not open \"{}\" for writing.", path.string()) << std::endl;
+        return std::nullopt;
+    }
+
+    // The header is 32 bytes, so frames start aligned right after it
+    writer.header.sphereCount = static_cast<std::uint32_t>(sphereCount);
+    writer.header.framesPerSecond = framesPerSecond;
+    writer.header.frameOffset = sizeof(TrajectoryHeader);
+    writer.out.write(reinterpret_cast<const char*>(&writer.header), sizeof(TrajectoryHeader));
+    return writer;
+}
+
+bool TrajectoryWriter::append(std::span<const glm::vec4> frame) {
+    if (!out.is_open() || frame.size() != header.sphereCount)
+        return false;
+    out.write(reinterpret_cast<const char*>(frame.data()), static_cast<std::streamsize>(frame.size_bytes()));
+    ++header.frameCount;
+    return static_cast<bool>(out);
+}
+
+bool TrajectoryWriter::close() {
+    if (!out.is_open())
+        return false;
+    out.seekp(0);
+    out.write(reinterpret_cast<const char*>(&header), sizeof(TrajectoryHeader));
+    out.close();
+    return !out.fail();
+}
+
+}
@@ -0,0 +1,85 @@
+#ifndef TRAJECTORY_H
+#define TRAJECTORY_H
+
+#include <glm/glm.hpp>
+
+#include <array>
+#include <span>
+#include <optional>
+#include <fstream>
+#include <filesystem>
+#include <cstdint>
+
+#include "scenefile.h"
+
+namespace io {
+
+// Raw trajectory, version 1. The header is followed by frameCount frames of sphereCount spheres each,
+// in scene buffer order (xyz = position, w = radius). Frames start at 16 byte aligned offsets.
+struct TrajectoryHeader {
+    static constexpr std::array<char, 4> MAGIC{'B', 'T', 'R', 'J'};
+    static constexpr std::uint32_t VERSION = 1;
+
+    std::array<char, 4> magic{MAGIC};
+    std::uint32_t version{VERSION};
+    std::uint32_t sphereCount{0};
+    float framesPerSecond{30.f};
+    std::uint64_t frameCount{0};
+    // Byte offset of the first frame from the start of the file
+    std::uint64_t frameOffset{0};
+};
+
+static_assert(sizeof(TrajectoryHeader) == 32);
+
+/**
+ * @brief Validated view of a mapped raw trajectory.
+ */
+class TrajectoryFile {
+private:
+    MappedFile file;
+    TrajectoryHeader header;
+
+    TrajectoryFile(MappedFile&& mapped, const TrajectoryHeader& fileHeader) : file{std::move(mapped)}, header{fileHeader} {}
+
+public:
+    // Maps and validates a trajectory. Prints the reason and returns nothing if it can't be used.
+    static std::optional<TrajectoryFile> open(const std::filesystem::path& path);
+
+    std::size_t frameCount() const { return static_cast<std::size_t>(header.frameCount); }
+    std::size_t sphereCount() const { return header.sphereCount; }
+    float framesPerSecond() const { return header.framesPerSecond; }
+
+    // Points into the mapping. Touching it may page the frame in from disk.
+    std::span<const glm::vec4> frame(std::size_t index) const;
+    // Copies a frame into out, which has to hold sphereCount() spheres
+    bool readFrame(std::size_t index, std::span<glm::vec4> out) const;
+};
+
+/**
+ * @brief Appends frames to a raw trajectory. The frame count in the header is written on close().
+ */
+class TrajectoryWriter {
+private:
+    std::ofstream out;
+    TrajectoryHeader header;
+
+public:
+    TrajectoryWriter() = default;
+    TrajectoryWriter(TrajectoryWriter&&) = default;
+    TrajectoryWriter& operator=(TrajectoryWriter&&) = default;
+    // Closes the file if close() wasn't called, so the frame count is never lost
+    ~TrajectoryWriter() { close(); }
+
+    // Prints the reason and returns nothing if the file can't be created.
+    static std::optional<TrajectoryWriter> create(const std::filesystem::path& path, std::size_t sphereCount, float framesPerSecond);
+
+    // Frames have to hold exactly sphereCount spheres
+    bool append(std::span<const glm::vec4> frame);
+    bool close();
+
+    std::size_t frameCount() const { return static_cast<std::size_t>(header.frameCount); }
+};
+
+}
+
+#endif // TRAJECTORY_H
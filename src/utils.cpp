@@ -1,7 +1,6 @@
 #include "utils.h"
 
 #include <glm/gtc/type_ptr.hpp>
-#include <glm/gtc/random.hpp>
 
 namespace util {
 
@@ -51,7 +50,7 @@ template <> void uniform<glm::mat4>(unsigned int location, const glm::mat4& valu
 }
 
 
-glm::vec3 randomDiskPoint(glm::vec3 n, float r) {
+glm::vec3 diskPoint(glm::vec3 n, float r, float angle) {
     auto q = glm::vec3{1.f, 0.f, 0.f};
     if (glm::dot(n, glm::vec3{0.f, 1.f, 0.f}) < glm::dot(n, q))
         q = glm::vec3{0.f, 1.f, 0.f};
@@ -59,8 +58,7 @@ glm::vec3 randomDiskPoint(glm::vec3 n, float r) {
     auto u = glm::normalize(glm::cross(n, q));
     auto v = glm::normalize(glm::cross(n, u));
 
-    auto deg = glm::linearRand(0.f, 2.f * glm::pi<float>());
-    return r * u * std::sin(deg) + r * v * std::cos(deg);
+    return r * u * std::sin(angle) + r * v * std::cos(angle);
 }
 
 }
\ No newline at end of file
@@ -10,8 +10,11 @@
 #include <utility>
 #include <tuple>
 #include <set>
+#include <algorithm>
+#include <numeric>
 
 #include "components.h"
+#include "jobs.h"
 
 typedef std::pair<GLenum, std::string> ESPair;
 #define ESTR(x) ESPair{x, #x}
@@ -132,8 +135,14 @@ auto gen_vec(std::size_t N, T initVal = {}) {
     return v;
 }
 
-// generates a random point around a disk defined by a normal and a radius
-glm::vec3 randomDiskPoint(glm::vec3 n, float r);
+// Splits [0, n) into contiguous chunks and runs f(begin, end) for each chunk in parallel
+template <typename F>
+void parallelFor(std::size_t n, F&& f, std::size_t grainSize = 1024) {
+    jobs::parallelFor(n, std::forward<F>(f), grainSize);
+}
+
+// the point at the given angle around a disk defined by a normal and a radius
+glm::vec3 diskPoint(glm::vec3 n, float r, float angle);
 
 }
 